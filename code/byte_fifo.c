@@ -27,45 +27,173 @@
  *
  * Buffer size is fixed at compile time
  *
- * call bf_write only when there is space available
+ * call bf_write only when there is space available, or count on the drop
+ * accounting to show what was lost
  *
  * call bf_read only when there is data available.
  */
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
 #include "byte_fifo.h"
 
+/*
+ * the producer owns bf_head, the consumer owns bf_tail.
+ * an index owned by the caller can be loaded relaxed, the other side's index
+ * is loaded with acquire so the bytes it covers are visible.
+ * indexes are stored with release after the bytes are copied.
+ */
+
+#define BF_LOAD_OWN(idx) atomic_load_explicit(&(idx), memory_order_relaxed)
+#define BF_LOAD_OTHER(idx) atomic_load_explicit(&(idx), memory_order_acquire)
+#define BF_STORE(idx, val) atomic_store_explicit(&(idx), (val), memory_order_release)
+
+#ifdef BYTE_FIFO_POW2
+
+// free running indexes, every slot can be used
+
+#define BF_CAPACITY(bf) ((bf)->bf_count)
+#define BF_OFFSET(bf, idx) ((idx) & ((bf)->bf_count - 1))
+
+static inline bf_index_t bf_used(Byte_fifo *bf, bf_index_t head, bf_index_t tail)
+{
+	return head - tail;
+}
+
+static inline bf_index_t bf_advance(Byte_fifo *bf, bf_index_t idx, uint16_t len)
+{
+	return idx + len;
+}
+
+#else
+
+// indexes wrap at bf_count
+// one slot is always left empty to tell full from empty
+
+#define BF_CAPACITY(bf) ((bf)->bf_count - 1)
+#define BF_OFFSET(bf, idx) (idx)
+
+static inline bf_index_t bf_used(Byte_fifo *bf, bf_index_t head, bf_index_t tail)
+{
+	if(head >= tail)
+		return head - tail;
+
+	return bf->bf_count - (tail - head);
+}
+
+static inline bf_index_t bf_advance(Byte_fifo *bf, bf_index_t idx, uint16_t len)
+{
+	idx += len;
+	if(idx >= bf->bf_count) idx -= bf->bf_count;
+	return idx;
+}
+
+#endif // BYTE_FIFO_POW2
+
+/*
+ * overflow accounting, bf_high_water only ever goes up so a compare and swap
+ * max keeps it right with more than one producer.
+ */
+
+static inline void bf_note_level(Byte_fifo *bf, uint16_t level)
+{
+	uint16_t high;
+
+	high = atomic_load_explicit(&bf->bf_high_water, memory_order_relaxed);
+	while(level > high && !atomic_compare_exchange_weak_explicit(&bf->bf_high_water,
+				&high, level, memory_order_relaxed, memory_order_relaxed));
+}
+
+static inline void bf_count_drop(Byte_fifo *bf, uint16_t bytes)
+{
+	atomic_fetch_add_explicit(&bf->bf_dropped, bytes, memory_order_relaxed);
+}
+
+static inline void bf_count_overrun(Byte_fifo *bf)
+{
+	atomic_fetch_add_explicit(&bf->bf_overruns, 1, memory_order_relaxed);
+}
+
+/*
+ * overwrite fifos: the producer makes room for need bytes at head by moving
+ * bf_tail past the oldest bytes.  The consumer may free room at the same time,
+ * so only what is still short is dropped.
+ */
+
+static void bf_drop_oldest(Byte_fifo *bf, bf_index_t head, uint16_t need)
+{
+	bf_index_t tail;
+	uint16_t room;
+
+	tail = BF_LOAD_OTHER(bf->bf_tail);
+	for(;;) {
+		room = BF_CAPACITY(bf) - bf_used(bf, head, tail);
+		if(room >= need) return;
+
+		if(atomic_compare_exchange_weak_explicit(&bf->bf_tail, &tail,
+					bf_advance(bf, tail, need - room),
+					memory_order_acq_rel, memory_order_acquire)) {
+			bf_count_drop(bf, need - room);
+			return;
+		}
+	}
+}
+
+/*
+ * the consumer is done with len bytes at tail.  In an overwrite fifo the
+ * producer may have moved bf_tail past them, the bytes read are then suspect
+ * and -1 is returned.
+ */
+
+static inline int bf_consume(Byte_fifo *bf, bf_index_t tail, uint16_t len)
+{
+	if(bf->bf_flags & BF_FLAG_OVERWRITE) {
+		if(!atomic_compare_exchange_strong_explicit(&bf->bf_tail, &tail,
+					bf_advance(bf, tail, len),
+					memory_order_release, memory_order_relaxed)) return -1;
+		return 0;
+	}
+
+	BF_STORE(bf->bf_tail, bf_advance(bf, tail, len));
+	return 0;
+}
+
 uint16_t bf_space_avail(Byte_fifo *bf) 
 {
-	if(bf->bf_head == bf->bf_tail)
-		return bf->bf_count - 1;	// empty
-	if(bf->bf_head > bf->bf_tail)
-		return(bf->bf_count - 1 -(bf->bf_head-bf->bf_tail));
+	bf_index_t head, tail;
+
+	head = BF_LOAD_OWN(bf->bf_head);
+	tail = BF_LOAD_OTHER(bf->bf_tail);
 
-	return(bf->bf_tail-bf->bf_head-1);
+	return BF_CAPACITY(bf) - bf_used(bf, head, tail);
 }
 
 uint16_t bf_data_avail(Byte_fifo *bf)
 {
-	if(bf->bf_tail == bf ->bf_head)
-		return 0;
-	if(bf->bf_head >  bf ->bf_tail)
-		return(bf->bf_head - bf ->bf_tail);
+	bf_index_t head, tail;
 
-	return(bf->bf_count - 1  - (bf->bf_tail - bf->bf_head));
+	head = BF_LOAD_OTHER(bf->bf_head);
+	tail = BF_LOAD_OWN(bf->bf_tail);
+
+	return bf_used(bf, head, tail);
 }
 
 int bf_is_empty(Byte_fifo *bf)
 {
-	if(bf->bf_head == bf->bf_tail) return 1;
+	if(BF_LOAD_OTHER(bf->bf_head) == BF_LOAD_OTHER(bf->bf_tail)) return 1;
 	return 0;
 }
 
 int bf_is_full(Byte_fifo *bf)
 {
-	if((bf->bf_head + 1) == bf->bf_tail) return 1;
-	if(bf->bf_tail == 0 && bf->bf_head == (bf->bf_count -1)) return 1;
+	bf_index_t head, tail;
+
+	head = BF_LOAD_OTHER(bf->bf_head);
+	tail = BF_LOAD_OTHER(bf->bf_tail);
+
+	if(bf_used(bf, head, tail) == BF_CAPACITY(bf)) return 1;
 
 	return 0;
 }
@@ -74,8 +202,25 @@ int bf_is_full(Byte_fifo *bf)
 
 void bf_write(Byte_fifo *bf, uint8_t val)
 {
-	bf->bf_buf[bf->bf_head++] = val;
-	if(bf->bf_head >= bf->bf_count) bf->bf_head = 0;
+	bf_index_t head;
+	uint16_t used;
+
+	head = BF_LOAD_OWN(bf->bf_head);
+	used = bf_used(bf, head, BF_LOAD_OTHER(bf->bf_tail));
+
+	if(used >= BF_CAPACITY(bf)) {
+		bf_count_overrun(bf);
+		if(!(bf->bf_flags & BF_FLAG_OVERWRITE)) {
+			bf_count_drop(bf, 1);
+			return;
+		}
+		bf_drop_oldest(bf, head, 1);
+		used = BF_CAPACITY(bf) - 1;
+	}
+
+	bf->bf_buf[BF_OFFSET(bf, head)] = val;
+	BF_STORE(bf->bf_head, bf_advance(bf, head, 1));
+	bf_note_level(bf, used + 1);
 }
 
 // NB: could be called from interrupts
@@ -83,11 +228,272 @@ void bf_write(Byte_fifo *bf, uint8_t val)
 uint8_t bf_read(Byte_fifo *bf)
 {
 	uint8_t retval;
-	retval = bf->bf_buf[bf->bf_tail++];
-	if(bf->bf_tail >= bf->bf_count) bf->bf_tail = 0;
+	bf_index_t tail;
+
+	do {
+		tail = BF_LOAD_OTHER(bf->bf_tail);
+		retval = bf->bf_buf[BF_OFFSET(bf, tail)];
+	} while(bf_consume(bf, tail, 1) < 0);
+
 	return retval;
 }
 
+/*
+ * fill in the, at most two, regions starting at index start for len bytes
+ */
+
+static uint16_t bf_fill_span(Byte_fifo *bf, bf_index_t start, uint16_t len, Bf_span *span)
+{
+	uint16_t to_end;
+
+	start = BF_OFFSET(bf, start);
+	to_end = bf->bf_count - start;
+
+	span->bs_ptr[0] = &bf->bf_buf[start];
+	span->bs_ptr[1] = &bf->bf_buf[0];
+
+	if(len <= to_end) {
+		span->bs_len[0] = len;
+		span->bs_len[1] = 0;
+	}
+	else {
+		span->bs_len[0] = to_end;
+		span->bs_len[1] = len - to_end;
+	}
+
+	return len;
+}
+
+uint16_t bf_peek_span(Byte_fifo *bf, int dir, Bf_span *span)
+{
+	bf_index_t head, tail;
+
+	if(dir == BF_SPAN_WRITE) {
+		head = BF_LOAD_OWN(bf->bf_head);
+		tail = BF_LOAD_OTHER(bf->bf_tail);
+		return bf_fill_span(bf, head, BF_CAPACITY(bf) - bf_used(bf, head, tail), span);
+	}
+
+	head = BF_LOAD_OTHER(bf->bf_head);
+	tail = BF_LOAD_OTHER(bf->bf_tail);
+	return bf_fill_span(bf, tail, bf_used(bf, head, tail), span);
+}
+
+// NB: len must not be more than bf_peek_span() handed out
+
+int bf_commit(Byte_fifo *bf, int dir, uint16_t len)
+{
+	bf_index_t head;
+
+	if(dir == BF_SPAN_WRITE) {
+		head = bf_advance(bf, BF_LOAD_OWN(bf->bf_head), len);
+		BF_STORE(bf->bf_head, head);
+		bf_note_level(bf, bf_used(bf, head, BF_LOAD_OTHER(bf->bf_tail)));
+		return 0;
+	}
+
+	return bf_consume(bf, BF_LOAD_OTHER(bf->bf_tail), len);
+}
+
+// NB: could be called from interrupts
+
+uint16_t bf_write_block(Byte_fifo *bf, const uint8_t *src, uint16_t len)
+{
+	Bf_span span;
+	uint16_t avail;
+
+	if(len == 0) return 0;
+
+	if(bf->bf_flags & BF_FLAG_OVERWRITE) {
+		// keep the newest, anything over capacity never makes it in
+
+		if(len > BF_CAPACITY(bf)) {
+			bf_count_overrun(bf);
+			bf_count_drop(bf, len - BF_CAPACITY(bf));
+			src += len - BF_CAPACITY(bf);
+			len = BF_CAPACITY(bf);
+		}
+		if(bf_space_avail(bf) < len) {
+			bf_count_overrun(bf);
+			bf_drop_oldest(bf, BF_LOAD_OWN(bf->bf_head), len);
+		}
+	}
+
+	avail = bf_peek_span(bf, BF_SPAN_WRITE, &span);
+	if(len > avail) len = avail;
+	if(len == 0) return 0;
+
+	if(len <= span.bs_len[0]) {
+		memcpy(span.bs_ptr[0], src, len);
+	}
+	else {
+		memcpy(span.bs_ptr[0], src, span.bs_len[0]);
+		memcpy(span.bs_ptr[1], src + span.bs_len[0], len - span.bs_len[0]);
+	}
+
+	bf_commit(bf, BF_SPAN_WRITE, len);
+
+	return len;
+}
+
+// NB: could be called from interrupts
+
+uint16_t bf_read_block(Byte_fifo *bf, uint8_t *dst, uint16_t len)
+{
+	Bf_span span;
+	uint16_t avail, want;
+
+	want = len;
+	do {
+		len = want;
+		avail = bf_peek_span(bf, BF_SPAN_READ, &span);
+		if(len > avail) len = avail;
+		if(len == 0) return 0;
+
+		if(len <= span.bs_len[0]) {
+			memcpy(dst, span.bs_ptr[0], len);
+		}
+		else {
+			memcpy(dst, span.bs_ptr[0], span.bs_len[0]);
+			memcpy(dst + span.bs_len[0], span.bs_ptr[1], len - span.bs_len[0]);
+		}
+	} while(bf_commit(bf, BF_SPAN_READ, len) < 0);
+
+	return len;
+}
+
+
+/*
+ * multi producer writes
+ *
+ * bf_reserve packs the number of writers that have reserved but not finished
+ * copying in the upper 16 bits and the reserve index in the lower 16 bits.
+ * With BYTE_FIFO_POW2 the lower 16 bits are the low half of the free running
+ * index, the full index is rebuilt from bf_head, which is never more than
+ * bf_count, <= 0x8000, behind.  A stale rsv just makes the compare and swap fail.
+ */
+
+#define BF_MP_WRITER		(((uint32_t) 1) << 16)
+#define BF_MP_WRITERS(rsv)	((rsv) >> 16)
+#define BF_MP_INDEX(rsv)	((uint16_t) ((rsv) & 0xffff))
+
+// head must be current when rsv was read, it is never more than bf_count behind
+
+static inline bf_index_t bf_mp_index(Byte_fifo *bf, uint32_t rsv, bf_index_t head)
+{
+#ifdef BYTE_FIFO_POW2
+	return head + (uint16_t) (BF_MP_INDEX(rsv) - (uint16_t) head);
+#else
+	return BF_MP_INDEX(rsv);
+#endif // BYTE_FIFO_POW2
+}
+
+/*
+ * when no writer is copying, everything up to the reserve index has been written,
+ * so bf_head can move up to it.  If a writer is still copying, it will do this
+ * when it finishes.
+ */
+
+static void bf_mp_publish(Byte_fifo *bf)
+{
+	uint32_t rsv;
+	bf_index_t head, index;
+
+	head = atomic_load_explicit(&bf->bf_head, memory_order_relaxed);
+	do {
+		rsv = atomic_load_explicit(&bf->bf_reserve, memory_order_acquire);
+		if(BF_MP_WRITERS(rsv)) return;
+
+		index = bf_mp_index(bf, rsv, head);
+		if(index == head) return;
+	} while(!atomic_compare_exchange_weak_explicit(&bf->bf_head, &head, index,
+				memory_order_release, memory_order_relaxed));
+}
+
+// NB: could be called from interrupts
+
+uint16_t bf_mp_write(Byte_fifo *bf, const uint8_t *src, uint16_t len)
+{
+	uint32_t rsv, new_rsv;
+	bf_index_t start, tail;
+	Bf_span span;
+
+	if(len == 0 || len > BF_CAPACITY(bf)) return 0;
+
+	// reserve len bytes past the reserve index and count ourselves as a writer
+
+	rsv = atomic_load_explicit(&bf->bf_reserve, memory_order_relaxed);
+	for(;;) {
+		start = bf_mp_index(bf, rsv, BF_LOAD_OTHER(bf->bf_head));
+		tail = BF_LOAD_OTHER(bf->bf_tail);
+
+		if((uint32_t) bf_used(bf, start, tail) > (uint32_t) (BF_CAPACITY(bf) - len)) {
+			// no room, unless rsv was stale
+			new_rsv = atomic_load_explicit(&bf->bf_reserve, memory_order_relaxed);
+			if(new_rsv == rsv) return 0;
+			rsv = new_rsv;
+			continue;
+		}
+
+		new_rsv = (rsv & ~((uint32_t) 0xffff)) + BF_MP_WRITER;
+		new_rsv |= (uint16_t) bf_advance(bf, start, len);
+
+		if(atomic_compare_exchange_weak_explicit(&bf->bf_reserve, &rsv, new_rsv,
+					memory_order_acquire, memory_order_relaxed)) break;
+	}
+
+	bf_note_level(bf, bf_used(bf, start, tail) + len);
+
+	bf_fill_span(bf, start, len, &span);
+	memcpy(span.bs_ptr[0], src, span.bs_len[0]);
+	if(span.bs_len[1]) memcpy(span.bs_ptr[1], src + span.bs_len[0], span.bs_len[1]);
+
+	// done copying, the last writer out publishes
+
+	atomic_fetch_sub_explicit(&bf->bf_reserve, BF_MP_WRITER, memory_order_release);
+	bf_mp_publish(bf);
+
+	return len;
+}
+
+// a producer that gives up, e.g., one in an ISR, see byte_fifo.h
+
+void bf_count_dropped(Byte_fifo *bf, uint16_t bytes)
+{
+	bf_count_drop(bf, bytes);
+}
+
+/*
+ * statistics, relaxed loads so they can be read with traffic flowing.
+ * the counters are independent, a snapshot taken during an overrun may have
+ * bfs_dropped a write ahead of bfs_overruns.
+ */
+
+void bf_get_stats(Byte_fifo *bf, Bf_stats *stats)
+{
+	bf_index_t head, tail;
+
+	head = atomic_load_explicit(&bf->bf_head, memory_order_relaxed);
+	tail = atomic_load_explicit(&bf->bf_tail, memory_order_relaxed);
+
+	stats->bfs_level = bf_used(bf, head, tail);
+	stats->bfs_capacity = BF_CAPACITY(bf);
+	stats->bfs_high_water = atomic_load_explicit(&bf->bf_high_water, memory_order_relaxed);
+	stats->bfs_dropped = atomic_load_explicit(&bf->bf_dropped, memory_order_relaxed);
+	stats->bfs_overruns = atomic_load_explicit(&bf->bf_overruns, memory_order_relaxed);
+}
+
+// high water restarts from the current level
+
+void bf_clear_stats(Byte_fifo *bf)
+{
+	Bf_stats stats;
+
+	bf_get_stats(bf, &stats);
+	atomic_store_explicit(&bf->bf_high_water, stats.bfs_level, memory_order_relaxed);
+	atomic_store_explicit(&bf->bf_dropped, 0, memory_order_relaxed);
+	atomic_store_explicit(&bf->bf_overruns, 0, memory_order_relaxed);
+}
 
 #ifdef SA_CONSOLE_BUILD
 
@@ -96,24 +502,23 @@ uint8_t bf_read(Byte_fifo *bf)
 #include <ctype.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <stdint.h>
 #include <pthread.h>
 #include "shell.h"
 
+#ifdef BYTE_FIFO_POW2
+#define FIFO_SIZE	(256)
+#else
 #define FIFO_SIZE	(201)
+#endif // BYTE_FIFO_POW2
 
-uint8_t buf[FIFO_SIZE];
-
-Byte_fifo bfifo = {
-	&buf[0],		// bf_fifo
-	0,				// bf_head
-	0,				// bf_tail
-	FIFO_SIZE,		// bf_count
-};
+BYTE_FIFO_DEFINE(bfifo, FIFO_SIZE);
 
 pthread_t read_thread, write_thread, cmdproc_thread;
 int program_running = 0;
 
+uint8_t write_buf[FIFO_SIZE];
+
 void *write_side(void *ptr)
 {
 	int done = 0;
@@ -126,7 +531,7 @@ void *write_side(void *ptr)
 	 * write the sequentially, eg, 1s, 2s, 3s
 	 */
 	while(!done) {
-		uint16_t avail_space, ii;
+		uint16_t avail_space;
 
 		if(!program_running) done = 1;
 
@@ -142,9 +547,8 @@ void *write_side(void *ptr)
 
 			avail_space = (uint16_t) fract;
 
-			for(ii = 0; ii < avail_space; ii++) {
-				bf_write(&bfifo, byte_to_write);
-			}
+			memset(write_buf, byte_to_write, avail_space);
+			avail_space = bf_write_block(&bfifo, write_buf, avail_space);
 			if(byte_to_write > 0x7f) byte_to_write = 0x21;
 			fprintf(stderr, "wrote %d of %c\r\n", avail_space, byte_to_write);
 			byte_to_write++;
@@ -184,9 +588,7 @@ void *read_side(void *ptr)
 		if(amount_avail) {
 			fprintf(stderr, "amount_avail: %d, ", amount_avail);
 			if(amount_avail > 40) amount_avail = 40;
-			for(ii = 0; ii < amount_avail; ii++) {
-				read_buf[ii] = bf_read(&bfifo);
-			}
+			amount_avail = (int) bf_read_block(&bfifo, read_buf, (uint16_t) amount_avail);
 			fprintf(stderr, "read %d, " , amount_avail);
 			for(ii = 0; ii < amount_avail; ii++) {
 				fprintf(stderr, "%c", read_buf[ii]);
@@ -227,6 +629,231 @@ void *cmd_proc(void *ptr)
 	do_shell_exit = 1;
 	return 0;
 }
+/*
+ * multi producer stress test
+ *
+ * console/byte_fifo -m [num_threads [num_messages]]
+ *
+ * each writer thread sends num_messages messages with bf_mp_write, as fast as
+ * it can.  A message is
+ *
+ * 	length, thread id, sequence low, sequence high, payload
+ *
+ * where the payload is a function of the thread id, sequence and position.
+ * The reader checks that every message is whole, that each thread's sequence
+ * numbers arrive in order with none missing and that the byte count adds up.
+ *
+ * returns 0 on success, -1 on failure
+ */
+
+#define MP_MAX_THREADS	(64)
+#define MP_MSG_HDR		(4)
+#define MP_MSG_MAX		(64)
+
+static int mp_threads = 8;
+static int mp_messages = 100000;
+
+static inline uint8_t mp_msg_len(int id, int seq)
+{
+	return (uint8_t) (MP_MSG_HDR + 1 + ((seq * 7 + id) % (MP_MSG_MAX - MP_MSG_HDR)));
+}
+
+static inline uint8_t mp_payload(int id, int seq, int ii)
+{
+	return (uint8_t) (id * 31 + seq + ii);
+}
+
+void *mp_write_side(void *ptr)
+{
+	int id = (int) (intptr_t) ptr;
+	int seq, ii;
+	uint8_t msg[MP_MSG_MAX];
+	uint8_t len;
+
+	for(seq = 0; seq < mp_messages; seq++) {
+		len = mp_msg_len(id, seq);
+		msg[0] = len;
+		msg[1] = (uint8_t) id;
+		msg[2] = (uint8_t) seq;
+		msg[3] = (uint8_t) (seq >> 8);
+		for(ii = MP_MSG_HDR; ii < len; ii++) msg[ii] = mp_payload(id, seq, ii);
+
+		while(bf_mp_write(&bfifo, msg, len) == 0) sched_yield();
+	}
+
+	return 0;
+}
+
+int mp_stress()
+{
+	pthread_t writers[MP_MAX_THREADS];
+	int next_seq[MP_MAX_THREADS];
+	uint8_t msg[MP_MSG_MAX];
+	uint64_t expected_bytes = 0, got_bytes = 0;
+	int got_msg = 0, msg_len = 0, id, seq, ii;
+	int idle = 0;
+
+	for(id = 0; id < mp_threads; id++) {
+		next_seq[id] = 0;
+		for(seq = 0; seq < mp_messages; seq++) expected_bytes += mp_msg_len(id, seq);
+	}
+
+	for(id = 0; id < mp_threads; id++) {
+		if(pthread_create(&writers[id], NULL, mp_write_side, (void*) (intptr_t) id) != 0) {
+			fprintf(stderr, "couldn't start writer %d\n", id);
+			return -1;
+		}
+	}
+
+	/*
+	 * read a length byte, then the rest of the message, then check it
+	 */
+
+	while(got_msg < mp_threads * mp_messages) {
+		uint16_t want, got;
+
+		want = (msg_len == 0) ? 1 : (msg[0] - msg_len);
+		got = bf_read_block(&bfifo, &msg[msg_len], want);
+
+		if(got == 0) {
+			if(++idle > 5000000) {
+				fprintf(stderr, "mp: stalled after %d messages\n", got_msg);
+				return -1;
+			}
+			sched_yield();
+			continue;
+		}
+		idle = 0;
+		got_bytes += got;
+		msg_len += got;
+
+		if(msg_len == 1 && (msg[0] <= MP_MSG_HDR || msg[0] > MP_MSG_MAX)) {
+			fprintf(stderr, "mp: bad length %d after %d messages\n", msg[0], got_msg);
+			return -1;
+		}
+		if(msg_len < MP_MSG_HDR || msg_len < msg[0]) continue;
+
+		id = msg[1];
+		seq = msg[2] | (msg[3] << 8);
+
+		if(id >= mp_threads || (seq & 0xffff) != (next_seq[id] & 0xffff)
+				|| msg[0] != mp_msg_len(id, next_seq[id])) {
+			fprintf(stderr, "mp: bad header, thread %d seq %d, expected seq %d\n",
+					id, seq, next_seq[id]);
+			return -1;
+		}
+		for(ii = MP_MSG_HDR; ii < msg[0]; ii++) {
+			if(msg[ii] != mp_payload(id, next_seq[id], ii)) {
+				fprintf(stderr, "mp: torn message, thread %d seq %d byte %d\n",
+						id, next_seq[id], ii);
+				return -1;
+			}
+		}
+		next_seq[id]++;
+		got_msg++;
+		msg_len = 0;
+	}
+
+	for(id = 0; id < mp_threads; id++) pthread_join(writers[id], NULL);
+
+	if(got_bytes != expected_bytes || bf_data_avail(&bfifo) != 0) {
+		fprintf(stderr, "mp: byte count off, %llu of %llu\n",
+				(unsigned long long) got_bytes, (unsigned long long) expected_bytes);
+		return -1;
+	}
+
+	printf("mp: %d threads, %d messages, %llu bytes, ok\n", mp_threads, got_msg,
+			(unsigned long long) got_bytes);
+
+	return 0;
+}
+
+/*
+ * overwrite stress test
+ *
+ * console/byte_fifo -o [num_bytes]
+ *
+ * the writer pushes a counting byte sequence into an overwrite fifo as fast as
+ * it can, mixing bf_write and bf_write_block, the reader pulls it out with
+ * bf_read_block.  Bytes go missing, but each block read must be a run of
+ * consecutive bytes, and at the end
+ * 	written == read + dropped + left in the fifo
+ */
+
+BYTE_FIFO_DEFINE_FLAGS(ofifo, FIFO_SIZE, BF_FLAG_OVERWRITE);
+
+static int ow_bytes = 4000000;
+static volatile int ow_writing;
+
+void *ow_write_side(void *ptr)
+{
+	uint8_t blk[32];
+	uint8_t val = 0;
+	int done = 0, ii, len;
+
+	while(done < ow_bytes) {
+		len = 1 + (done % (int) sizeof(blk));
+		if(len > ow_bytes - done) len = ow_bytes - done;
+
+		if(len == 1) {
+			bf_write(&ofifo, val++);
+		}
+		else {
+			for(ii = 0; ii < len; ii++) blk[ii] = val++;
+			bf_write_block(&ofifo, blk, (uint16_t) len);
+		}
+		done += len;
+		if((done & 0xfff) < len) sched_yield();
+	}
+
+	ow_writing = 0;
+	return 0;
+}
+
+int ow_stress()
+{
+	pthread_t writer;
+	uint8_t buf[48];
+	uint64_t got_bytes = 0;
+	Bf_stats stats;
+	uint16_t got, ii;
+
+	ow_writing = 1;
+	if(pthread_create(&writer, NULL, ow_write_side, 0) != 0) {
+		fprintf(stderr, "couldn't start writer\n");
+		return -1;
+	}
+
+	while(ow_writing) {
+		got = bf_read_block(&ofifo, buf, 1 + (uint16_t) (got_bytes % sizeof(buf)));
+		for(ii = 1; ii < got; ii++) {
+			if(buf[ii] != (uint8_t) (buf[ii - 1] + 1)) {
+				fprintf(stderr, "ow: broken run after %llu bytes\n",
+						(unsigned long long) got_bytes);
+				return -1;
+			}
+		}
+		got_bytes += got;
+		if(got == 0) sched_yield();
+	}
+
+	pthread_join(writer, NULL);
+
+	bf_get_stats(&ofifo, &stats);
+
+	if((uint64_t) ow_bytes != got_bytes + stats.bfs_dropped + stats.bfs_level) {
+		fprintf(stderr, "ow: %d written, %llu read, %u dropped, %u left\n", ow_bytes,
+				(unsigned long long) got_bytes, stats.bfs_dropped, stats.bfs_level);
+		return -1;
+	}
+
+	printf("ow: %d written, %llu read, %u dropped in %u overruns, high water %u, ok\n",
+			ow_bytes, (unsigned long long) got_bytes, stats.bfs_dropped,
+			stats.bfs_overruns, stats.bfs_high_water);
+
+	return 0;
+}
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -252,6 +879,18 @@ int main(int argc, char *argv[])
 
 	srand48(randseed);
 
+	if(argc >= 2 && *argv[1] == '-' && *(argv[1]+1) == 'm') {
+		if(argc >= 3) mp_threads = atoi(argv[2]);
+		if(argc >= 4) mp_messages = atoi(argv[3]);
+		if(mp_threads < 1 || mp_threads > MP_MAX_THREADS) mp_threads = MP_MAX_THREADS;
+		exit(mp_stress());
+	}
+
+	if(argc >= 2 && *argv[1] == '-' && *(argv[1]+1) == 'o') {
+		if(argc >= 3) ow_bytes = atoi(argv[2]);
+		exit(ow_stress());
+	}
+
 	program_running = 1;
 	
 	if((ret = pthread_create(&read_thread, NULL, read_side, 0)) != 0) {
@@ -290,3 +929,323 @@ read_didnt_launch:
 }
 
 #endif // SA_CONSOLE_BUILD
+
+/*
+ * throughput and latency benchmark
+ *
+ * console/byte_fifo_bench [-n total_bytes]
+ *
+ * a producer thread and a consumer thread, pinned to separate cpus when there
+ * are separate cpus, pass total_bytes through a fifo.  The sweep covers fifo sizes
+ * and block sizes for each way of moving data:
+ *
+ * 	byte - bf_space_avail / bf_write and bf_data_avail / bf_read, one byte at a time
+ * 	block - bf_write_block and bf_read_block
+ * 	span - bf_peek_span / bf_commit on both sides, the consumer doesn't copy
+ * 	mp - bf_mp_write for the producer, bf_read_block for the consumer
+ * 	memcpy - one thread copying each block in and out of a buffer, the floor
+ *
+ * a side that can't make progress calls sched_yield(), so the numbers mean
+ * something on a single cpu too.
+ *
+ * handoff latency is sampled every BENCH_STRIDE bytes: the producer stamps the
+ * time just before it writes the block starting at the sample point, the consumer
+ * takes the difference when it has read past it.
+ *
+ * output is CSV on stdout, one line per run, so it can be kept and compared
+ * from one commit to the next.
+ */
+
+#ifdef BENCH_BUILD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define BENCH_STRIDE		(1024)
+#define BENCH_MAX_BLOCK		(256)
+#define BENCH_DEFAULT_BYTES	(16 * 1024 * 1024)
+
+#ifdef BYTE_FIFO_POW2
+#define BENCH_FLAVOR	"pow2"
+#else
+#define BENCH_FLAVOR	"wrap"
+#endif // BYTE_FIFO_POW2
+
+enum bench_mode {
+	BENCH_BYTE = 0,
+	BENCH_BLOCK,
+	BENCH_SPAN,
+	BENCH_MP,
+	BENCH_MEMCPY,
+	BENCH_MODE_COUNT,
+};
+
+static const char *bench_mode_name[] = {"byte", "block", "span", "mp", "memcpy"};
+
+static const uint16_t bench_fifo_size[] = {64, 256, 1024, 4096, 16384};
+static const uint16_t bench_block_size[] = {1, 16, 64, 256};
+
+#define BENCH_COUNT(arr) (sizeof(arr)/sizeof(arr[0]))
+
+static Byte_fifo bench_fifo;
+static uint8_t bench_buf[16384];
+static uint8_t bench_src[256 + BENCH_MAX_BLOCK];
+static uint8_t bench_dst[BENCH_MAX_BLOCK];
+
+static uint64_t bench_total;
+static int bench_mode;
+static uint16_t bench_block;
+static uint64_t *bench_stamp;
+static uint64_t *bench_latency;
+static _Atomic int bench_go;
+static int bench_errors;
+
+static inline uint64_t bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void bench_pin(int cpu)
+{
+	cpu_set_t set;
+	long ncpu;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if(ncpu < 1) ncpu = 1;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu % ncpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// write one block, spin until all of it is in
+
+static inline void bench_put(const uint8_t *src, uint16_t len)
+{
+	Bf_span span;
+	uint16_t done, nn;
+
+	switch(bench_mode) {
+	case BENCH_BYTE:
+		for(done = 0; done < len; ) {
+			if(bf_space_avail(&bench_fifo)) bf_write(&bench_fifo, src[done++]);
+			else sched_yield();
+		}
+		break;
+	case BENCH_BLOCK:
+		for(done = 0; done < len; ) {
+			nn = bf_write_block(&bench_fifo, &src[done], len - done);
+			if(nn == 0) sched_yield();
+			done += nn;
+		}
+		break;
+	case BENCH_SPAN:
+		for(done = 0; done < len; ) {
+			if(bf_peek_span(&bench_fifo, BF_SPAN_WRITE, &span) == 0) {
+				sched_yield();
+				continue;
+			}
+			nn = len - done;
+			if(nn > span.bs_len[0]) nn = span.bs_len[0];
+			memcpy(span.bs_ptr[0], &src[done], nn);
+			bf_commit(&bench_fifo, BF_SPAN_WRITE, nn);
+			done += nn;
+		}
+		break;
+	case BENCH_MP:
+		while(bf_mp_write(&bench_fifo, src, len) == 0) sched_yield();
+		break;
+	}
+}
+
+// read up to len bytes, return the count, check the first byte against the pattern
+
+static inline uint16_t bench_get(uint64_t offset, uint16_t len)
+{
+	Bf_span span;
+	uint16_t got = 0;
+
+	switch(bench_mode) {
+	case BENCH_BYTE:
+		if(bf_data_avail(&bench_fifo)) {
+			while(got < len && bf_data_avail(&bench_fifo)) bench_dst[got++] = bf_read(&bench_fifo);
+		}
+		break;
+	case BENCH_BLOCK:
+	case BENCH_MP:
+		got = bf_read_block(&bench_fifo, bench_dst, len);
+		break;
+	case BENCH_SPAN:
+		if(bf_peek_span(&bench_fifo, BF_SPAN_READ, &span)) {
+			got = (span.bs_len[0] < len) ? span.bs_len[0] : len;
+			bench_dst[0] = span.bs_ptr[0][0];
+			bf_commit(&bench_fifo, BF_SPAN_READ, got);
+		}
+		break;
+	}
+
+	if(got && bench_dst[0] != (uint8_t) offset) bench_errors++;
+
+	return got;
+}
+
+void *bench_producer(void *ptr)
+{
+	uint64_t offset;
+
+	bench_pin(0);
+	while(!atomic_load(&bench_go));
+
+	for(offset = 0; offset < bench_total; offset += bench_block) {
+		if((offset % BENCH_STRIDE) == 0) bench_stamp[offset / BENCH_STRIDE] = bench_now();
+		bench_put(&bench_src[offset & 0xff], bench_block);
+	}
+
+	return 0;
+}
+
+void *bench_consumer(void *ptr)
+{
+	uint64_t offset = 0, sample = 0;
+	uint16_t got;
+
+	bench_pin(1);
+	while(!atomic_load(&bench_go));
+
+	while(offset < bench_total) {
+		got = bench_get(offset, bench_block);
+		if(got == 0) {
+			sched_yield();
+			continue;
+		}
+		offset += got;
+		if(sample * BENCH_STRIDE < offset) {
+			uint64_t now = bench_now();
+			while(sample * BENCH_STRIDE < offset) {
+				bench_latency[sample] = now - bench_stamp[sample];
+				sample++;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// single thread, copy each block in and out of the buffer
+
+static void bench_memcpy(uint16_t size)
+{
+	uint64_t offset;
+	uint16_t pos = 0;
+
+	for(offset = 0; offset < bench_total; offset += bench_block) {
+		uint64_t start = 0;
+
+		if((offset % BENCH_STRIDE) == 0) start = bench_now();
+		if(pos + bench_block > size) pos = 0;
+		memcpy(&bench_buf[pos], &bench_src[offset & 0xff], bench_block);
+		memcpy(bench_dst, &bench_buf[pos], bench_block);
+		pos += bench_block;
+		if(bench_dst[0] != (uint8_t) offset) bench_errors++;
+		if((offset % BENCH_STRIDE) == 0) bench_latency[offset / BENCH_STRIDE] = bench_now() - start;
+	}
+}
+
+static int bench_cmp(const void *aa, const void *bb)
+{
+	uint64_t a = *(const uint64_t*) aa, b = *(const uint64_t*) bb;
+
+	return (a > b) - (a < b);
+}
+
+static void bench_run(int mode, uint16_t size, uint16_t block)
+{
+	pthread_t prod, cons;
+	uint64_t start, elapsed, samples;
+
+	bench_mode = mode;
+	bench_block = block;
+	bench_errors = 0;
+	samples = bench_total / BENCH_STRIDE;
+
+	bench_fifo.bf_buf = &bench_buf[0];
+	bench_fifo.bf_count = size;
+	atomic_init(&bench_fifo.bf_head, 0);
+	atomic_init(&bench_fifo.bf_tail, 0);
+	atomic_init(&bench_fifo.bf_reserve, 0);
+	atomic_store(&bench_go, 0);
+
+	if(mode == BENCH_MEMCPY) {
+		start = bench_now();
+		bench_memcpy(size);
+		elapsed = bench_now() - start;
+	}
+	else {
+		pthread_create(&cons, NULL, bench_consumer, 0);
+		pthread_create(&prod, NULL, bench_producer, 0);
+		start = bench_now();
+		atomic_store(&bench_go, 1);
+		pthread_join(prod, NULL);
+		pthread_join(cons, NULL);
+		elapsed = bench_now() - start;
+	}
+
+	qsort(bench_latency, samples, sizeof(uint64_t), bench_cmp);
+
+	printf("%s,%s,%u,%u,%llu,%llu,%.0f,%llu,%llu,%llu,%d\n",
+			BENCH_FLAVOR, bench_mode_name[mode], size, block,
+			(unsigned long long) bench_total, (unsigned long long) elapsed,
+			(double) bench_total * 1e9 / (double) elapsed,
+			(unsigned long long) bench_latency[samples / 2],
+			(unsigned long long) bench_latency[(samples * 99) / 100],
+			(unsigned long long) bench_latency[(samples * 999) / 1000],
+			bench_errors);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	int mode, ii, jj;
+
+	bench_total = BENCH_DEFAULT_BYTES;
+
+	if(argc == 3 && *argv[1] == '-' && *(argv[1]+1) == 'n')
+		bench_total = strtoull(argv[2], 0, 0);
+
+	// whole strides and whole blocks
+	bench_total -= bench_total % BENCH_STRIDE;
+	if(bench_total < BENCH_STRIDE) bench_total = BENCH_STRIDE;
+
+	for(ii = 0; ii < sizeof(bench_src); ii++) bench_src[ii] = (uint8_t) ii;
+
+	bench_stamp = calloc(bench_total / BENCH_STRIDE, sizeof(uint64_t));
+	bench_latency = calloc(bench_total / BENCH_STRIDE, sizeof(uint64_t));
+	if(bench_stamp == 0 || bench_latency == 0) {
+		fprintf(stderr, "couldn't allocate sample buffers\n");
+		exit(-1);
+	}
+
+	printf("flavor,mode,fifo_size,block_size,bytes,ns,bytes_per_sec,p50_ns,p99_ns,p999_ns,errors\n");
+
+	for(mode = 0; mode < BENCH_MODE_COUNT; mode++) {
+		for(ii = 0; ii < BENCH_COUNT(bench_fifo_size); ii++) {
+			for(jj = 0; jj < BENCH_COUNT(bench_block_size); jj++) {
+				// a block has to fit, with room for the producer to get ahead
+				if(bench_block_size[jj] * 2 > bench_fifo_size[ii]) continue;
+				bench_run(mode, bench_fifo_size[ii], bench_block_size[jj]);
+			}
+		}
+	}
+
+	exit(0);
+}
+
+#endif // BENCH_BUILD
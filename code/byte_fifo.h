@@ -27,9 +27,17 @@
  *
  * Buffer size is fixed at compile time
  *
- * call bf_write only when there is space available
+ * call bf_write only when there is space available, a bf_write to a full fifo
+ * drops a byte and counts it, see below
  *
  * call bf_read only when there is data available.
+ *
+ * One producer and one consumer may use the fifo at the same time without
+ * turning off interrupts, e.g., main loop writing and an ISR reading.
+ * The producer is the only one to move bf_head, the consumer is the only one
+ * to move bf_tail.  The index updates are C11 release stores, the reads of the
+ * other side's index are acquire loads, so the data is in the buffer before the
+ * other side can see the index move.
  */
 
 #ifndef _BYTE_FIFO_H
@@ -37,14 +45,78 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * two flavors, picked at compile time, same bf_* calls for both
+ *
+ * default: 16 bit indexes that wrap at bf_count, any size, one slot is left
+ * empty to tell full from empty.
+ *
+ * BYTE_FIFO_POW2: bf_count must be a power of two.  The indexes are free running
+ * 32 bit counters, the buffer offset is index & (bf_count - 1).  Bytes in the fifo
+ * are head - tail, so every query is one subtraction, and all bf_count bytes
+ * can be used.
+ */
+
+#ifdef BYTE_FIFO_POW2
+typedef uint32_t bf_index_t;
+#else
+typedef uint16_t bf_index_t;
+#endif // BYTE_FIFO_POW2
 
 typedef struct _byte_fifo {
 	uint8_t *bf_buf;
-	uint16_t bf_head;		// index of head
-	uint16_t bf_tail;		// index of tail
+	_Atomic bf_index_t bf_head;		// index of head, moved by producer
+	_Atomic bf_index_t bf_tail;		// index of tail, moved by consumer
 	uint16_t bf_count;		// size of buf
+	_Atomic uint32_t bf_reserve;	// multi producer only, writers << 16 | reserve index
+	uint16_t bf_flags;		// BF_FLAG_*
+	_Atomic uint16_t bf_high_water;	// most bytes ever in the fifo
+	_Atomic uint32_t bf_dropped;	// bytes lost to a full fifo
+	_Atomic uint32_t bf_overruns;	// writes that found the fifo full
 } Byte_fifo;
 
+/*
+ * what happens when a byte is written to a full fifo
+ *
+ * default: the new byte is dropped.
+ *
+ * BF_FLAG_OVERWRITE: the oldest byte is dropped to make room, for telemetry where
+ * the newest data matters most.  bf_write and bf_write_block always take all of
+ * the data.  The producer moves bf_tail to drop bytes, so the consumer moves it
+ * with a compare and swap and reads again if the producer got there first.
+ * Overwrite is for single producer fifos, bf_mp_write and BF_SPAN_WRITE spans
+ * never overwrite.
+ *
+ * Either way bf_dropped and bf_overruns count the loss.
+ */
+
+#define BF_FLAG_OVERWRITE	(0x0001)
+
+/*
+ * define a fifo and its buffer in one go.  With BYTE_FIFO_POW2 a size that
+ * isn't a power of two fails to compile.
+ *
+ * BYTE_FIFO_DEFINE(usart1_rx_fifo, 256);
+ */
+
+#ifdef BYTE_FIFO_POW2
+#define BYTE_FIFO_SIZE_CHECK(name, size) \
+	_Static_assert((size) > 0 && (size) <= 0x8000 && ((size) & ((size) - 1)) == 0, \
+			#name " size must be a power of two")
+#else
+#define BYTE_FIFO_SIZE_CHECK(name, size) \
+	_Static_assert((size) > 1 && (size) <= 0xffff, #name " size out of range")
+#endif // BYTE_FIFO_POW2
+
+#define BYTE_FIFO_DEFINE_FLAGS(name, size, flags) \
+	BYTE_FIFO_SIZE_CHECK(name, size); \
+	static uint8_t name##_buf[(size)]; \
+	Byte_fifo name = { .bf_buf = &name##_buf[0], .bf_count = (size), .bf_flags = (flags) }
+
+#define BYTE_FIFO_DEFINE(name, size) BYTE_FIFO_DEFINE_FLAGS(name, size, 0)
+
 /*
  * to use:
  *
@@ -68,6 +140,11 @@ typedef struct _byte_fifo {
  *  byte_read = bf_read(&bfifo);
  * }
  *
+ * or, to get the size checked at compile time:
+ *
+ * BYTE_FIFO_DEFINE(bfifo, SOME_BUF_SIZE);
+ * BYTE_FIFO_DEFINE_FLAGS(telemetry_fifo, SOME_BUF_SIZE, BF_FLAG_OVERWRITE);
+ *
  */
 
 extern uint16_t bf_space_avail(Byte_fifo *bf);
@@ -80,4 +157,104 @@ extern int bf_is_full(Byte_fifo *bf);
 extern void bf_write(Byte_fifo *bf, uint8_t val);
 extern uint8_t bf_read(Byte_fifo *bf);
 
+/*
+ * bulk access
+ *
+ * bf_write_block and bf_read_block move as much as they can, up to len, with one
+ * or two memcpy calls and one index update.  They return the number of bytes moved,
+ * which may be 0.  No need to check space or data first.
+ *
+ * uint16_t sent = 0;
+ *
+ * while(sent < len) {
+ * 	sent += bf_write_block(&bfifo, &msg[sent], len - sent);
+ * }
+ */
+
+extern uint16_t bf_write_block(Byte_fifo *bf, const uint8_t *src, uint16_t len);
+extern uint16_t bf_read_block(Byte_fifo *bf, uint8_t *dst, uint16_t len);
+
+/*
+ * zero copy access
+ *
+ * the data in the fifo, or the free space in the fifo, is at most two contiguous
+ * regions, the second one starting at the beginning of bf_buf after a wrap.
+ *
+ * bf_peek_span fills in the regions and returns the total length.  The caller
+ * reads from, or writes into, the regions directly and then calls bf_commit with
+ * the number of bytes used, which may be less than what was handed out.
+ * bf_commit returns -1 if, in an overwrite fifo, the producer dropped the bytes
+ * while the consumer was looking at them, else 0.
+ *
+ * BF_SPAN_READ is for the consumer, the regions hold data.
+ * BF_SPAN_WRITE is for the producer, the regions are free space.
+ *
+ * Bf_span span;
+ *
+ * if(bf_peek_span(&bfifo, BF_SPAN_READ, &span)) {
+ * 	dma_start(span.bs_ptr[0], span.bs_len[0]);
+ * 	...
+ * 	bf_commit(&bfifo, BF_SPAN_READ, span.bs_len[0]);
+ * }
+ */
+
+enum {
+	BF_SPAN_READ = 0,
+	BF_SPAN_WRITE = 1,
+};
+
+typedef struct _bf_span {
+	uint8_t *bs_ptr[2];		// start of each region
+	uint16_t bs_len[2];		// length of each region, bs_len[1] is 0 if no wrap
+} Bf_span;
+
+extern uint16_t bf_peek_span(Byte_fifo *bf, int dir, Bf_span *span);
+extern int bf_commit(Byte_fifo *bf, int dir, uint16_t len);
+
+/*
+ * multiple producers, single consumer
+ *
+ * bf_mp_write can be called from the main loop, from ISRs and from other threads
+ * at the same time.  A message is all or nothing: bf_mp_write returns len when the
+ * whole message went in, 0 when there wasn't room for all of it.  Messages from
+ * different writers never interleave.
+ *
+ * Space is reserved by a compare and swap on bf_reserve, which holds the reserve
+ * index and a count of writers still copying.  The writer that brings the count to
+ * zero moves bf_head up to the reserve index, so the consumer only sees whole
+ * messages.  Nothing is published while any writer is copying, a writer that is
+ * interrupted holds back everything reserved after it until it finishes.
+ *
+ * so a producer in an ISR must not wait for room.  The room it waits for may be
+ * held by the writer it interrupted, which can't go on until the ISR returns.  It
+ * tries a bounded number of times, then drops the message and counts it with
+ * bf_count_dropped().  The main loop can wait,
+ *
+ * while(bf_mp_write(&bfifo, msg, len) == 0);
+ *
+ * and messages well below the fifo size, a quarter say, still fit while another
+ * writer's are unpublished.  Messages longer than the fifo never fit.
+ *
+ * Once a fifo is written with bf_mp_write, all of its producers must use
+ * bf_mp_write.  The consumer side is unchanged.
+ */
+
+extern uint16_t bf_mp_write(Byte_fifo *bf, const uint8_t *src, uint16_t len);
+extern void bf_count_dropped(Byte_fifo *bf, uint16_t bytes);
+
+/*
+ * statistics, can be read while the fifo is in use
+ */
+
+typedef struct _bf_stats {
+	uint16_t bfs_level;		// bytes in the fifo now
+	uint16_t bfs_capacity;		// most bytes the fifo can hold
+	uint16_t bfs_high_water;	// most bytes ever in the fifo
+	uint32_t bfs_dropped;		// bytes lost to a full fifo
+	uint32_t bfs_overruns;		// writes that found the fifo full
+} Bf_stats;
+
+extern void bf_get_stats(Byte_fifo *bf, Bf_stats *stats);
+extern void bf_clear_stats(Byte_fifo *bf);
+
 #endif // _BYTE_FIFO_H
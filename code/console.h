@@ -41,20 +41,49 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <poll.h>
 #else 
 #include "micro_console.h"
 #endif
 
+/*
+ * output is buffered, PUTSS() and PUTCC() don't write until a line ends, the
+ * buffer fills or FLUSHCC().  The shell flushes at the prompt, after the echo
+ * of the keys, when a command returns and before it waits for input.
+ *
+ * on the host stdout is line buffered in CONSOLE_OBUF_LEN bytes, set up by
+ * stdio_obuf() from shell_init() before anything is printed.  A line at a
+ * time still gets a printf() from another thread out without the shell.  On
+ * the target micro_puts() goes to the transmit fifo, micro_flush() is for a
+ * port that holds it anywhere else.
+ */
+
 #ifdef CONSOLE_BUILD
-// need to do this got flush output, can't just use fput function
+
+#ifndef CONSOLE_OBUF_LEN
+#define CONSOLE_OBUF_LEN (4096)
+#endif
+
+static inline void stdio_obuf()
+{
+	static char obuf[CONSOLE_OBUF_LEN];
+
+	setvbuf(stdout, obuf, _IOLBF, sizeof(obuf));
+}
 static inline void stdio_puts(const char *ss)
 {
 	fputs(ss, stdout);
-	fflush(stdout);
 }
 static inline void stdio_putc(char cc)
 {
 	fputc(cc, stdout);
+}
+static inline void stdio_putb(const void *buf, int len)
+{
+	fwrite(buf, 1, len, stdout);
+}
+static inline void stdio_flush()
+{
 	fflush(stdout);
 }
 #endif	// CONSOLE_BUILD
@@ -71,6 +100,20 @@ static inline void stdio_putc(char cc)
 #define PUTSS(ss) micro_puts((ss))
 #endif
 
+// NB: bytes that can be zero, e.g., a binary frame
+
+#ifdef CONSOLE_BUILD
+#define PUTBB(buf,len) stdio_putb((buf),(len))
+#else 
+#define PUTBB(buf,len) micro_putb((buf),(len))
+#endif
+
+#ifdef CONSOLE_BUILD
+#define FLUSHCC() stdio_flush()
+#else 
+#define FLUSHCC() micro_flush()
+#endif
+
 // NB: this is used to return type int
 //
 #ifdef CONSOLE_BUILD
@@ -79,6 +122,28 @@ static inline void stdio_putc(char cc)
 #define GETCC() micro_getc()
 #endif
 
+// NB: non zero if GETCC() won't wait, stdin must be unbuffered, see shell_init()
+
+#ifdef CONSOLE_BUILD
+static inline int stdio_avail()
+{
+	struct pollfd pfd = { .fd = 0, .events = POLLIN };
+
+	return poll(&pfd, 1, 0) > 0;
+}
+#define AVAILCC() stdio_avail()
+#else 
+#define AVAILCC() micro_avail()
+#endif
+
+// NB: input bytes lost so far, a full receive fifo, 0 where nothing is lost
+
+#ifdef CONSOLE_BUILD
+#define LOSTCC() ((uint32_t) 0)
+#else 
+#define LOSTCC() micro_lost()
+#endif
+
 // NB: this is used to return type *char
 
 #ifdef CONSOLE_BUILD
@@ -29,242 +29,2238 @@
 #include "micro_stdio.h"
 #include "format.h"
 #include "shell.h"
+#include "frame.h"
+#include "byte_fifo.h"
+#include "result.h"
 #include <ctype.h>
+#include <string.h>
 
 #ifdef CONSOLE_BUILD
 #include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #else
+#include "stm32f3xx.h"
 #endif // CONSOLE_BUILD
 
-#define DBT_LOG_SIZE	(128)
-#define DBT_LOG_MASK	(DBT_LOG_SIZE-1)
+/*
+ * the log is DBT_RINGS rings, one per context so writers don't contend, merged
+ * by time when it is printed.
+ *
+ * target: ring 0 for thread mode, the rest split the interrupt priorities,
+ * 4 rings.  host: a ring per thread, 8 rings, the ninth thread shares with the
+ * first.  Sharing is safe, only slower.
+ *
+ * dbt_init() puts the rings in any memory, until then they are DBT_RING_SIZE
+ * words each of static storage, 256 on the target and 512 on the host.
+ * Building with DBT_RING_SIZE 0 leaves that out and drops records until
+ * dbt_init() is called.
+ */
+
+#ifndef DBT_RINGS
+#ifdef CONSOLE_BUILD
+#define DBT_RINGS	(8)
+#else
+#define DBT_RINGS	(4)
+#endif // CONSOLE_BUILD
+#endif // DBT_RINGS
+
+#ifndef DBT_RING_SIZE
+#ifdef CONSOLE_BUILD
+#define DBT_RING_SIZE	(512)
+#else
+#define DBT_RING_SIZE	(256)
+#endif // CONSOLE_BUILD
+#endif // DBT_RING_SIZE
+
+_Static_assert(DBT_RINGS >= 2 && DBT_RINGS <= 8, "DBT_RINGS is 2 to 8");
+_Static_assert(DBT_RING_SIZE == 0 || (DBT_RING_SIZE >= DBT_RING_MIN && DBT_RING_SIZE <= DBT_RING_MAX
+			&& (DBT_RING_SIZE & (DBT_RING_SIZE - 1)) == 0),
+		"DBT_RING_SIZE is 0 or a power of two from DBT_RING_MIN to DBT_RING_MAX");
+
+#if DBT_RING_SIZE
+
+uint32_t dbt_log_buf[DBT_RINGS][DBT_RING_SIZE];
+
+#define DBT_RING_INIT(nn)	{ .dr_buf = dbt_log_buf[nn], .dr_size = DBT_RING_SIZE }
+
+static DBT_ring dbt_ring_set[DBT_RINGS] = {
+	DBT_RING_INIT(0), DBT_RING_INIT(1),
+#if DBT_RINGS > 2
+	DBT_RING_INIT(2),
+#endif
+#if DBT_RINGS > 3
+	DBT_RING_INIT(3),
+#endif
+#if DBT_RINGS > 4
+	DBT_RING_INIT(4),
+#endif
+#if DBT_RINGS > 5
+	DBT_RING_INIT(5),
+#endif
+#if DBT_RINGS > 6
+	DBT_RING_INIT(6),
+#endif
+#if DBT_RINGS > 7
+	DBT_RING_INIT(7),
+#endif
+};
+
+#else
+
+static DBT_ring dbt_ring_set[DBT_RINGS];
+
+#endif // DBT_RING_SIZE
+
+DBT_ring *dbt_rings = dbt_ring_set;
+DBT_ring *dbt_prev_rings = 0;		// the run before's, see dbt_init_persist()
+
+const int dbt_num_rings = DBT_RINGS;
+
+/*
+ * ring state, one word so one compare and swap reserves space
+ *
+ * 	free running insertion index, 16 bits
+ * 	length of the newest record, 8 bits, 0 while the ring is empty
+ * 	low byte of the newest record's timestamp high word, 8 bits
+ *
+ * The index runs to 0x10000 so a reader can tell, from how far it has moved,
+ * whether the record it copied was written over, hence dr_size <= 0x8000.
+ */
+
+#define DBT_STATE(idx, len, hi8) \
+	((uint32_t) (uint16_t) (idx) | (((uint32_t) (len)) << 16) | (((uint32_t) (hi8)) << 24))
+#define DBT_STATE_INDEX(st)	((uint16_t) (st))
+#define DBT_STATE_LEN(st)	(((st) >> 16) & 0xff)
+#define DBT_STATE_HI8(st)	((st) >> 24)
+
+#define DBT_WORD(ring, idx)	((ring)->dr_buf[(idx) & ((ring)->dr_size - 1)])
+#define DBT_LAP(ring, idx)	((uint8_t) ((uint16_t) (idx) / (ring)->dr_size))
+
+_Static_assert(DBT_REC_MAX <= 0xf, "record length must fit the header");
+
+uint32_t dbt_global_mask = 0;
+
+/*
+ * built in descriptors for dbt_write and the DBT_4_U32 family
+ */
+
+DBT_DESC(dbt_desc_raw, 0,
+	DBT_FIELD(DBT_FT_X32, "w0"), DBT_FIELD(DBT_FT_X32, "w1"),
+	DBT_FIELD(DBT_FT_X32, "w2"), DBT_FIELD(DBT_FT_X32, "w3"));
+DBT_DESC(dbt_desc_tag_3xu32, 0,
+	DBT_FIELD(DBT_FT_TAG, "tag"), DBT_FIELD(DBT_FT_X32, "a"),
+	DBT_FIELD(DBT_FT_X32, "b"), DBT_FIELD(DBT_FT_X32, "c"));
+DBT_DESC(dbt_desc_tag_3xs32, 0,
+	DBT_FIELD(DBT_FT_TAG, "tag"), DBT_FIELD(DBT_FT_S32, "a"),
+	DBT_FIELD(DBT_FT_S32, "b"), DBT_FIELD(DBT_FT_S32, "c"));
+DBT_DESC(dbt_desc_4_u32, 0,
+	DBT_FIELD(DBT_FT_X32, "a"), DBT_FIELD(DBT_FT_X32, "b"),
+	DBT_FIELD(DBT_FT_X32, "c"), DBT_FIELD(DBT_FT_X32, "d"));
+DBT_DESC(dbt_desc_2_u32, 0,
+	DBT_FIELD(DBT_FT_X32, "a"), DBT_FIELD(DBT_FT_X32, "b"));
+DBT_DESC(dbt_desc_2_u64, 0,
+	DBT_FIELD(DBT_FT_X64, "a"), DBT_FIELD(DBT_FT_X64, "b"));
+DBT_DESC(dbt_desc_1_u64, 0,
+	DBT_FIELD(DBT_FT_X64, "a"));
+DBT_DESC(dbt_desc_time, DBT_MAKE_TAG(0, '-', 'T', '-'),
+	DBT_FIELD(DBT_FT_X64, "now"), DBT_FIELD(DBT_FT_X32, "prev_hi8"));
+DBT_DESC(dbt_desc_span_begin, DBT_MAKE_TAG(0, '-', '{', '-'),
+	DBT_FIELD(DBT_FT_TAG, "span"), DBT_FIELD(DBT_FT_U32, "depth"));
+DBT_DESC(dbt_desc_span_end, DBT_MAKE_TAG(0, '-', '}', '-'),
+	DBT_FIELD(DBT_FT_TAG, "span"), DBT_FIELD(DBT_FT_U32, "depth"));
+
+/*
+ * 64 bit time
+ */
+
+#ifdef CONSOLE_BUILD
+
+uint64_t dbt_time_skew = 0;		// lets the console test move the clock
+
+uint64_t dbt_time()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec + dbt_time_skew;
+}
+
+void dbt_time_init()
+{
+}
+
+#else
+
+/*
+ * extend the 32 bit cycle counter without locking, so any interrupt can ask
+ * dbt_cyc_state is the high word << 1 | the top bit of the last count seen,
+ * the top bit going from 1 to 0 is a wrap
+ */
+
+static _Atomic uint32_t dbt_cyc_state = 0;
+
+uint64_t dbt_time()
+{
+	uint32_t now, state, next, high;
+
+	state = atomic_load_explicit(&dbt_cyc_state, memory_order_relaxed);
+	do {
+		now = DWT->CYCCNT;
+		high = state >> 1;
+		if((state & 1) && !(now >> 31)) high++;
+		next = (high << 1) | (now >> 31);
+	} while(next != state && !atomic_compare_exchange_weak_explicit(&dbt_cyc_state,
+				&state, next, memory_order_relaxed, memory_order_relaxed));
+
+	return (((uint64_t) high) << 32) | now;
+}
+
+void dbt_time_init()
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+#endif // CONSOLE_BUILD
+
+const DBT_desc *dbt_desc_lookup(uint16_t id)
+{
+	if(id >= (uint16_t) (__stop_dbt_desc - __start_dbt_desc)) return 0;
+
+	return &__start_dbt_desc[id];
+}
+
+/*
+ * capture triggers, see dbt.h
+ *
+ * a program is run on a bit stack, each compare pushes a bit, and, or and
+ * not work on the top bits, the answer is the top bit at DBT_OP_END.  The
+ * stack starts with a 1 so an empty program matches.
+ */
+
+DBT_trig dbt_trig = { .dt_state = DBT_TRIG_OFF };
+
+static int dbt_prog_eval(const uint32_t *prog, uint16_t id, const uint32_t *words, int nwords)
+{
+	const DBT_desc *desc;
+	uint32_t op, imm, word, stack = 1, bit;
+	int field;
+
+	for(;;) {
+		op = *prog++;
+		switch(DBT_OP_CODE(op)) {
+		case DBT_OP_END:
+			return stack & 1;
+		case DBT_OP_AND:
+			bit = stack & 1;
+			stack >>= 1;
+			stack &= ~(uint32_t) 1 | bit;
+			break;
+		case DBT_OP_OR:
+			bit = stack & 1;
+			stack >>= 1;
+			stack |= bit;
+			break;
+		case DBT_OP_NOT:
+			stack ^= 1;
+			break;
+		case DBT_OP_ID:
+			stack = (stack << 1) | (id == *prog++);
+			break;
+		case DBT_OP_TAG:
+			desc = dbt_desc_lookup(id);
+			imm = *prog++;
+			stack = (stack << 1) | (desc && (desc->dd_tag & DBT_TAG_MASK) == (imm & DBT_TAG_MASK));
+			break;
+		default:			// compare a field
+			imm = *prog++;
+			field = DBT_OP_FIELD(op);
+			if(field >= nwords) {
+				stack <<= 1;
+				break;
+			}
+			word = words[field];
+			if(op & DBT_OP_SIGNED) {
+				word ^= 0x80000000;
+				imm ^= 0x80000000;
+			}
+			switch(DBT_OP_CODE(op)) {
+			case DBT_OP_EQ: bit = word == imm; break;
+			case DBT_OP_NE: bit = word != imm; break;
+			case DBT_OP_LT: bit = word < imm; break;
+			case DBT_OP_LE: bit = word <= imm; break;
+			case DBT_OP_GT: bit = word > imm; break;
+			case DBT_OP_GE: bit = word >= imm; break;
+			default: bit = 0; break;
+			}
+			stack = (stack << 1) | bit;
+			break;
+		}
+	}
+}
+
+/*
+ * should a record be kept, the state moves on as records go by
+ *
+ * contexts race through the transitions, a record or two from another one
+ * can land either side of the start or the freeze
+ */
+
+static int dbt_trig_pass(uint16_t id, const uint32_t *words, int nwords)
+{
+	DBT_trig *dt = &dbt_trig;
+	uint32_t state = atomic_load_explicit(&dt->dt_state, memory_order_acquire);
+
+	switch(state) {
+	case DBT_TRIG_WAIT:
+		if(!dbt_prog_eval(dt->dt_start, id, words, nwords)) break;
+		atomic_compare_exchange_strong(&dt->dt_state, &state, DBT_TRIG_RUN);
+		state = DBT_TRIG_RUN;
+		// fall through, the start record is kept
+	case DBT_TRIG_RUN:
+		if(!dbt_prog_eval(dt->dt_filter, id, words, nwords)) break;
+		if(atomic_fetch_add_explicit(&dt->dt_count, 1, memory_order_relaxed) >= dt->dt_pre
+				&& dt->dt_stop[0] != DBT_OP_END
+				&& dbt_prog_eval(dt->dt_stop, id, words, nwords)) {
+			atomic_store_explicit(&dt->dt_left, dt->dt_post, memory_order_relaxed);
+			atomic_compare_exchange_strong(&dt->dt_state, &state, DBT_TRIG_POST);
+		}
+		return 1;
+	case DBT_TRIG_POST:
+		if(!dbt_prog_eval(dt->dt_filter, id, words, nwords)) break;
+		if(atomic_fetch_sub_explicit(&dt->dt_left, 1, memory_order_relaxed) > 0) {
+			atomic_fetch_add_explicit(&dt->dt_count, 1, memory_order_relaxed);
+			return 1;
+		}
+		atomic_store_explicit(&dt->dt_state, DBT_TRIG_FROZEN, memory_order_release);
+		break;
+	case DBT_TRIG_FROZEN:
+		break;
+	default:
+		return 1;
+	}
+
+	atomic_fetch_add_explicit(&dt->dt_dropped, 1, memory_order_relaxed);
+
+	return 0;
+}
+
+/*
+ * start capturing: with a start program, nothing is kept until it matches.
+ * After that the filter program picks the records kept, and once pre of them
+ * are in, a match of the stop program keeps post more and freezes the rings.
+ * An empty program, DBT_OP_END alone, always matches, except for stop, where
+ * it never does.
+ */
+
+void dbt_trig_arm()
+{
+	DBT_trig *dt = &dbt_trig;
+
+	atomic_store_explicit(&dt->dt_state, DBT_TRIG_OFF, memory_order_relaxed);
+	atomic_store(&dt->dt_count, 0);
+	atomic_store(&dt->dt_dropped, 0);
+	atomic_store_explicit(&dt->dt_state,
+			dt->dt_start[0] == DBT_OP_END ? DBT_TRIG_RUN : DBT_TRIG_WAIT, memory_order_release);
+}
+
+void dbt_trig_off()
+{
+	atomic_store_explicit(&dbt_trig.dt_state, DBT_TRIG_OFF, memory_order_release);
+}
+
+// change a program while off, -1 if it doesn't fit
+
+int dbt_trig_set(uint32_t *which, const uint32_t *prog, int len)
+{
+	if(len >= DBT_PROG_MAX) return -1;
+
+	memcpy(which, prog, len * sizeof(uint32_t));
+	which[len] = DBT_OP_END;
+
+	return 0;
+}
+
+/*
+ * write a record, safe from any number of threads and nested interrupts
+ *
+ * reserve: the time is read after the state, so a successful compare and swap
+ * means no record went in between, the ring stays in time order.  A sync
+ * record is reserved with the record when the high word moved, the ring is
+ * empty or the record crosses a half ring.
+ *
+ * write: the release fence keeps the words from showing before the
+ * reservation, a reader checks dr_state after copying a record to see whether
+ * it was written over.  The header goes in busy first, with the lengths so
+ * the chain holds, and the real one is stored, release, last.
+ *
+ * a writer stalled for a whole lap of the ring, only possible on the host, can
+ * tear the record that laps it.
+ */
+
+int dbt_ring_write(DBT_ring *ring, uint16_t id, const uint32_t *words, int nwords)
+{
+	uint32_t state, next, len, total, prev, hi8;
+	uint16_t start;
+	uint64_t now;
+	int ii, sync;
+
+	if(ring->dr_size == 0) return -1;
+	if(nwords > DBT_MAX_WORDS) nwords = DBT_MAX_WORDS;
+	if(atomic_load_explicit(&dbt_trig.dt_state, memory_order_relaxed) != DBT_TRIG_OFF
+			&& !dbt_trig_pass(id, words, nwords)) return -1;
+	len = nwords + DBT_REC_ARGS;
+
+	state = atomic_load_explicit(&ring->dr_state, memory_order_relaxed);
+	do {
+		now = dbt_time();
+		hi8 = (uint8_t) (now >> 32);
+		start = DBT_STATE_INDEX(state);
+		sync = DBT_STATE_LEN(state) == 0 || hi8 != DBT_STATE_HI8(state)
+			|| ((start ^ (start + len)) & (ring->dr_size >> 1));
+		total = len + (sync ? DBT_SYNC_LEN : 0);
+		next = DBT_STATE(start + total, len, hi8);
+	} while(!atomic_compare_exchange_weak_explicit(&ring->dr_state, &state, next,
+				memory_order_relaxed, memory_order_relaxed));
+
+	atomic_thread_fence(memory_order_release);
+
+	prev = DBT_STATE_LEN(state);
+
+	if(sync) {
+		DBT_WORD(ring, start + DBT_REC_TS) = (uint32_t) now;
+		DBT_WORD(ring, start + DBT_REC_ARGS) = (uint32_t) now;
+		DBT_WORD(ring, start + DBT_REC_ARGS + 1) = (uint32_t) (now >> 32);
+		DBT_WORD(ring, start + DBT_REC_ARGS + 2) = DBT_STATE_HI8(state);
+		__atomic_store_n(&DBT_WORD(ring, start), DBT_HDR(DBT_DESC_ID(dbt_desc_time),
+					DBT_SYNC_LEN, prev, DBT_LAP(ring, start)), __ATOMIC_RELEASE);
+		start += DBT_SYNC_LEN;
+		prev = DBT_SYNC_LEN;
+	}
+
+	__atomic_store_n(&DBT_WORD(ring, start),
+			DBT_HDR(DBT_ID_BUSY, len, prev, DBT_LAP(ring, start)), __ATOMIC_RELAXED);
+	DBT_WORD(ring, start + DBT_REC_TS) = (uint32_t) now;
+	for(ii = 0; ii < nwords; ii++) DBT_WORD(ring, start + DBT_REC_ARGS + ii) = words[ii];
+	__atomic_store_n(&DBT_WORD(ring, start),
+			DBT_HDR(id, len, prev, DBT_LAP(ring, start)), __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * split bytes of arena into DBT_RINGS rings, each the largest power of two
+ * number of words that fits, up to DBT_RING_MAX.  What doesn't divide evenly
+ * is left over.  Nothing may be tracing while the rings move, call it before
+ * the interrupts that trace are enabled.
+ *
+ * returns the words in each ring, -1 if the arena isn't word aligned or
+ * can't hold DBT_RINGS rings of DBT_RING_MIN words
+ */
+
+static size_t dbt_ring_words(size_t bytes, int nrings)
+{
+	size_t words = bytes / sizeof(uint32_t) / nrings;
+
+	if(words < DBT_RING_MIN) return 0;
+	if(words > DBT_RING_MAX) words = DBT_RING_MAX;
+	while(words & (words - 1)) words &= words - 1;
+
+	return words;
+}
+
+static void dbt_ring_setup(DBT_ring *rings, uint32_t *buf, size_t words)
+{
+	int rr;
+
+	for(rr = 0; rr < DBT_RINGS; rr++) {
+		rings[rr].dr_buf = buf + rr * words;
+		rings[rr].dr_size = (uint16_t) words;
+		atomic_store_explicit(&rings[rr].dr_state, 0, memory_order_release);
+	}
+}
+
+int dbt_init(void *arena, size_t bytes)
+{
+	size_t words;
+
+	if(arena == 0 || ((uintptr_t) arena & 3)) return -1;
+	if((words = dbt_ring_words(bytes, DBT_RINGS)) == 0) return -1;
+
+	dbt_ring_setup(dbt_ring_set, (uint32_t*) arena, words);
+	dbt_rings = dbt_ring_set;
+
+	return (int) words;
+}
+
+/*
+ * rings that outlive a reset
+ *
+ * the arena, in memory the startup code doesn't clear, holds a header and two
+ * banks of rings.  A run writes one bank, the header says which, and the next
+ * run takes the other, leaving the last run's in dbt_prev_rings.  The ring
+ * structs are in the header so their insertion points survive too.
+ *
+ * the magic number and a CRC of the geometry tell a header from what was in
+ * the RAM at power up.  The CRC can't cover the records, they change on
+ * every write, but the walk checks every record it reads.
+ */
+
+#define DBT_PERSIST_MAGIC	DBT_U8_TO_U32('D', 'B', 'T', 'P')
+
+typedef struct _dbt_persist {
+	uint32_t dp_magic;
+	uint16_t dp_rings;
+	uint16_t dp_words;		// in each ring
+	uint16_t dp_bank;		// the bank this run writes
+	uint16_t dp_crc;		// of the fields above
+	DBT_ring dp_ring[2][DBT_RINGS];
+} DBT_persist;
+
+static uint16_t dbt_persist_crc(DBT_persist *dp)
+{
+	return frame_crc16(FRAME_CRC_INIT, (const uint8_t*) dp, offsetof(DBT_persist, dp_crc));
+}
+
+/*
+ * returns the words in each ring, -1 for an arena that is misaligned or can't
+ * hold two banks of DBT_RINGS rings of DBT_RING_MIN words
+ */
+
+int dbt_init_persist(void *arena, size_t bytes)
+{
+	DBT_persist *dp = (DBT_persist*) arena;
+	uint32_t *buf = (uint32_t*) (dp + 1);
+	size_t words;
+	int bank, rr;
+
+	if(arena == 0 || ((uintptr_t) arena % _Alignof(DBT_persist)) || bytes < sizeof(DBT_persist))
+		return -1;
+	if((words = dbt_ring_words(bytes - sizeof(DBT_persist), 2 * DBT_RINGS)) == 0) return -1;
+
+	dbt_prev_rings = 0;
+	bank = 0;
+	if(dp->dp_magic == DBT_PERSIST_MAGIC && dp->dp_rings == DBT_RINGS && dp->dp_words == words
+			&& dp->dp_bank < 2 && dp->dp_crc == dbt_persist_crc(dp)) {
+		bank = dp->dp_bank ^ 1;
+		dbt_prev_rings = dp->dp_ring[dp->dp_bank];
+
+		// the arena may be mapped somewhere else this time
+
+		for(rr = 0; rr < DBT_RINGS; rr++)
+			dbt_prev_rings[rr].dr_buf = buf + (dp->dp_bank * DBT_RINGS + rr) * words;
+	}
+
+	dbt_ring_setup(dp->dp_ring[bank], buf + bank * DBT_RINGS * words, words);
+
+	dp->dp_magic = DBT_PERSIST_MAGIC;
+	dp->dp_rings = DBT_RINGS;
+	dp->dp_words = (uint16_t) words;
+	dp->dp_bank = bank;
+	dp->dp_crc = dbt_persist_crc(dp);
+
+	dbt_rings = dp->dp_ring[bank];
+
+	return (int) words;
+}
+
+#ifdef CONSOLE_BUILD
+
+/*
+ * the host has no RAM that survives, a file mapped shared stands in for it,
+ * what was written is there for the next process that maps it
+ */
+
+int dbt_init_file(const char *path, size_t bytes)
+{
+	void *arena;
+	int fd;
+
+	if((fd = open(path, O_RDWR | O_CREAT, 0666)) < 0) return -1;
+	if(ftruncate(fd, bytes) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	arena = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(arena == MAP_FAILED) return -1;
+
+	return dbt_init_persist(arena, bytes);
+}
+
+#endif // CONSOLE_BUILD
+
+/*
+ * the calling context's ring
+ *
+ * target: thread mode, ring 0, or the active exception's priority band.  NMI
+ * and hard fault have fixed priorities above every band and take the last
+ * ring.  Exceptions at the same priority can't preempt each other, so a ring
+ * only sees contention when a band holds more than one priority.
+ *
+ * host: handed out round robin the first time a thread writes
+ */
+
+#ifdef CONSOLE_BUILD
+
+static _Atomic uint32_t dbt_next_ring = 0;
+static _Thread_local int dbt_thread_ring = -1;
+
+DBT_ring *dbt_ring_select()
+{
+	if(dbt_thread_ring < 0)
+		dbt_thread_ring = atomic_fetch_add_explicit(&dbt_next_ring, 1,
+				memory_order_relaxed) % DBT_RINGS;
+
+	return &dbt_rings[dbt_thread_ring];
+}
+
+#else
+
+DBT_ring *dbt_ring_select()
+{
+	uint32_t ipsr = __get_IPSR(), prio;
+
+	if(ipsr == 0) return &dbt_rings[0];
+	if(ipsr < 4) return &dbt_rings[DBT_RINGS - 1];
+
+	prio = NVIC_GetPriority((IRQn_Type) ((int32_t) ipsr - 16));
+
+	return &dbt_rings[DBT_RINGS - 1 - ((prio * (DBT_RINGS - 1)) >> __NVIC_PRIO_BITS)];
+}
+
+#endif // CONSOLE_BUILD
+
+int dbt_write_words(uint16_t id, const uint32_t *words, int nwords)
+{
+	return dbt_ring_write(dbt_ring_select(), id, words, nwords);
+}
+
+/*
+ * spans, see dbt.h
+ *
+ * the depth is the calling context's, only it writes it.  On the target
+ * that is the ring's, a context preempting another in the same band ends its
+ * spans before it returns, so the depths stack.  Host threads share rings
+ * round robin and don't nest, each has its own.  An end with the mask turned
+ * on since the begin finds depth 0 and leaves it there.
+ */
+
+#ifdef CONSOLE_BUILD
+static _Thread_local uint8_t dbt_span_depth;
+#define DBT_DEPTH_OF(ring)	(&dbt_span_depth)
+#else
+static uint8_t dbt_span_depth[DBT_RINGS];
+#define DBT_DEPTH_OF(ring)	(&dbt_span_depth[(ring) - dbt_rings])
+#endif // CONSOLE_BUILD
+
+void dbt_span_begin(uint32_t tag)
+{
+	DBT_ring *ring = dbt_ring_select();
+	uint8_t *depth = DBT_DEPTH_OF(ring);
+	uint32_t words[2] = { tag, *depth };
+
+	if(*depth < 0xff) (*depth)++;
+	dbt_ring_write(ring, DBT_DESC_ID(dbt_desc_span_begin), words, 2);
+}
+
+void dbt_span_end(uint32_t tag)
+{
+	DBT_ring *ring = dbt_ring_select();
+	uint8_t *depth = DBT_DEPTH_OF(ring);
+	uint32_t words[2];
+
+	if(*depth) (*depth)--;
+	words[0] = tag;
+	words[1] = *depth;
+	dbt_ring_write(ring, DBT_DESC_ID(dbt_desc_span_end), words, 2);
+}
+
+int dbt_write(DBT_log_entry *dbt)
+{
+	const DBT_desc *desc;
+
+	switch(dbt->u8[0]) {
+	case DBT_DUMP_FORMAT_TAG_3xU32:
+		desc = &dbt_desc_tag_3xu32;
+		break;
+	case DBT_DUMP_FORMAT_TAG_3xS32:
+		desc = &dbt_desc_tag_3xs32;
+		break;
+	default:
+		desc = &dbt_desc_raw;
+		break;
+	}
+
+	return dbt_write_words(DBT_DESC_ID(*desc), dbt->u32, 4);
+}
+
+void dbt_write_4_u32(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+	uint32_t words[4] = { a, b, c, d };
+
+	dbt_write_words(DBT_DESC_ID(dbt_desc_4_u32), words, 4);
+}
+
+void dbt_write_2_u32(uint32_t a, uint32_t b)
+{
+	uint32_t words[2] = { a, b };
+
+	dbt_write_words(DBT_DESC_ID(dbt_desc_2_u32), words, 2);
+}
+
+void dbt_write_2_u64(uint64_t a, uint64_t b)
+{
+	uint32_t words[4] = { DBT_U64_WORDS(a), DBT_U64_WORDS(b) };
+
+	dbt_write_words(DBT_DESC_ID(dbt_desc_2_u64), words, 4);
+}
+
+void dbt_write_1_u64(uint64_t a)
+{
+	uint32_t words[2] = { DBT_U64_WORDS(a) };
+
+	dbt_write_words(DBT_DESC_ID(dbt_desc_1_u64), words, 2);
+}
+
+void dbt_set_mask(uint32_t new_mask)
+{
+	dbt_global_mask = new_mask;
+}
+
+void dbt_enable_mask_bit(uint32_t mask_bit)
+{
+	dbt_global_mask |= mask_bit;
+}
+
+void dbt_disable_mask_bit(uint32_t mask_bit)
+{
+	dbt_global_mask &= ~mask_bit;
+}
+
+/*
+ * statistics, see dbt.h
+ */
+
+static inline void dbt_stat_min(_Atomic uint32_t *where, uint32_t val)
+{
+	uint32_t old = atomic_load_explicit(where, memory_order_relaxed);
+
+	while(val < old && !atomic_compare_exchange_weak_explicit(where, &old, val,
+				memory_order_relaxed, memory_order_relaxed));
+}
+
+static inline void dbt_stat_max(_Atomic uint32_t *where, uint32_t val)
+{
+	uint32_t old = atomic_load_explicit(where, memory_order_relaxed);
+
+	while(val > old && !atomic_compare_exchange_weak_explicit(where, &old, val,
+				memory_order_relaxed, memory_order_relaxed));
+}
+
+void dbt_stat_value(DBT_stat *stat, uint32_t val)
+{
+	uint32_t old;
+
+	atomic_fetch_add_explicit(&stat->ds_count, 1, memory_order_relaxed);
+	dbt_stat_min(&stat->ds_min, val);
+	dbt_stat_max(&stat->ds_max, val);
+
+	old = atomic_fetch_add_explicit(&stat->ds_sum_lo, val, memory_order_relaxed);
+	if(old + val < old) atomic_fetch_add_explicit(&stat->ds_sum_hi, 1, memory_order_relaxed);
+
+	atomic_fetch_add_explicit(&stat->ds_hist[val ? 32 - __builtin_clz(val) : 0], 1,
+			memory_order_relaxed);
+}
+
+void dbt_stat_clear(DBT_stat *stat)
+{
+	int ii;
+
+	atomic_store_explicit(&stat->ds_count, 0, memory_order_relaxed);
+	atomic_store_explicit(&stat->ds_min, ~(uint32_t) 0, memory_order_relaxed);
+	atomic_store_explicit(&stat->ds_max, 0, memory_order_relaxed);
+	atomic_store_explicit(&stat->ds_sum_lo, 0, memory_order_relaxed);
+	atomic_store_explicit(&stat->ds_sum_hi, 0, memory_order_relaxed);
+	for(ii = 0; ii < DBT_STAT_BUCKETS; ii++)
+		atomic_store_explicit(&stat->ds_hist[ii], 0, memory_order_relaxed);
+}
+
+// print the 3 ASCII bytes of a DBT_MAKE_TAG word
+
+static void dbt_print_tag(uint32_t tag)
+{
+	int ii;
+	char cc;
+
+	for(ii = 1; ii < 4; ii++) {
+		cc = (char) (tag >> (ii * 8));
+		PUTCC(ISPRINT(cc) ? cc : '.');
+	}
+}
+
+/*
+ * print val / 10^places with places decimals, right justified in width
+ */
+
+static void dbt_print_fixed(uint64_t val, int places, int width)
+{
+	uint64_t scale = 1;
+	uint32_t frac;
+	char obuf[12], digits[12];
+	int ii, len;
+
+	for(ii = 0; ii < places; ii++) scale *= 10;
+
+	format_u((uint32_t) (val / scale), obuf);
+	len = strlen(obuf) + 1 + places;
+	for(; len < width; len++) PUTCC(' ');
+	PUTSS(obuf);
+	PUTCC('.');
+
+	frac = (uint32_t) (val % scale);
+	for(ii = places - 1; ii >= 0; ii--) {
+		digits[ii] = '0' + (frac % 10);
+		frac /= 10;
+	}
+	digits[places] = 0;
+	PUTSS(digits);
+}
+
+/*
+ * decode one record by its descriptor
+ *
+ * 000003:      1.234567 +   120.125 TM2 count=42 sr=00000001
+ * 000004:      1.234600 +    33.000 US1 {
+ * 000005:      1.234610 +    10.000   TM2 count=43 sr=00000001
+ * 000006:      1.234700 +    90.000 US1 } 100.000
+ *
+ * absolute time in seconds, the time since the record before in microseconds.
+ * words the descriptor doesn't cover are printed in hex, a record with an
+ * unknown id is all hex.  Records are indented by depth, span ends and
+ * begins by their own, a span's time in microseconds is span.
+ */
+
+#define DBT_NO_DELTA	(~(uint64_t) 0)
+
+static inline int dbt_rec_is_span(const uint32_t *rec)
+{
+	uint16_t id = DBT_HDR_ID(rec[0]);
+
+	return DBT_HDR_LEN(rec[0]) == DBT_REC_ARGS + 2 && (id == DBT_DESC_ID(dbt_desc_span_begin)
+			|| id == DBT_DESC_ID(dbt_desc_span_end));
+}
+
+/*
+ * a record as a result for "mode json" or "bin", the times in nanoseconds and
+ * the fields by their names, words the descriptor doesn't cover as bytes
+ */
+
+static void dbt_result_chars(uint32_t word, int first, char *str)
+{
+	char cc;
+	int ii;
+
+	for(ii = first; ii < 4; ii++) {
+		cc = (char) (word >> (ii * 8));
+		*str++ = ISPRINT(cc) ? cc : '.';
+	}
+	*str = 0;
+}
+
+static void dbt_result_record(const uint32_t *rec, int rec_num, uint64_t time, uint64_t delta,
+		int depth, uint64_t span)
+{
+	const uint32_t *words = &rec[DBT_REC_ARGS];
+	uint32_t hdr = rec[0];
+	const DBT_desc *desc;
+	const DBT_field *field;
+	int nwords, ww, ff;
+	char str[5];
+
+	nwords = DBT_HDR_LEN(hdr) - DBT_REC_ARGS;
+
+	res_begin("trace");
+	res_u32("rec", rec_num);
+	res_u64("time_ns", time * 1000 / DBT_TICKS_PER_US);
+	if(delta != DBT_NO_DELTA) res_u64("delta_ns", delta * 1000 / DBT_TICKS_PER_US);
+
+	if(DBT_HDR_ID(hdr) == DBT_ID_BUSY) {
+		res_str("state", "busy");
+		res_end();
+		return;
+	}
+	res_u32("depth", depth);
+
+	if(dbt_rec_is_span(rec)) {
+		dbt_result_chars(words[0], 1, str);
+		res_str(DBT_HDR_ID(hdr) == DBT_DESC_ID(dbt_desc_span_begin) ? "begin" : "end", str);
+		if(span != DBT_NO_DELTA) res_u64("span_ns", span * 1000 / DBT_TICKS_PER_US);
+		res_end();
+		return;
+	}
+
+	res_u32("id", DBT_HDR_ID(hdr));
+	desc = dbt_desc_lookup(DBT_HDR_ID(hdr));
+	if(desc && desc->dd_tag) {
+		dbt_result_chars(desc->dd_tag, 1, str);
+		res_str("tag", str);
+	}
+
+	ww = 0;
+	for(ff = 0; desc && ff < DBT_MAX_FIELDS && desc->dd_fields[ff].df_type != DBT_FT_NONE; ff++) {
+		field = &desc->dd_fields[ff];
+		if(ww + (field->df_type == DBT_FT_X64 ? 2 : 1) > nwords) break;
+
+		switch(field->df_type) {
+		case DBT_FT_S32:
+			res_i32(field->df_name, (int32_t) words[ww++]);
+			break;
+		case DBT_FT_X64:
+			res_u64(field->df_name, ((uint64_t) words[ww + 1] << 32) | words[ww]);
+			ww += 2;
+			break;
+		case DBT_FT_TAG:
+		case DBT_FT_CHR4:
+			dbt_result_chars(words[ww++], field->df_type == DBT_FT_TAG ? 1 : 0, str);
+			res_str(field->df_name, str);
+			break;
+		default:
+			res_u32(field->df_name, words[ww++]);
+			break;
+		}
+	}
+	if(ww < nwords) res_bytes("extra", (const uint8_t*) &words[ww], (nwords - ww) * sizeof(uint32_t));
+
+	res_end();
+}
+
+void dbt_print_record(const uint32_t *rec, int rec_num, uint64_t time, uint64_t delta,
+		int depth, uint64_t span)
+{
+	const uint32_t *words = &rec[DBT_REC_ARGS];
+	uint32_t hdr = rec[0];
+	const DBT_desc *desc;
+	const DBT_field *field;
+	int nwords, ww, ff, ii;
+	char obuf[12];
+
+	if(!RES_TEXT()) {
+		dbt_result_record(rec, rec_num, time, delta, depth, span);
+		return;
+	}
+
+	nwords = DBT_HDR_LEN(hdr) - DBT_REC_ARGS;
+
+	PUTSS(format_x((uint32_t) rec_num, 6, obuf));
+	PUTSS(": ");
+
+	dbt_print_fixed(time / DBT_TICKS_PER_US, 6, 13);
+	PUTSS(" +");
+	if(delta == DBT_NO_DELTA) PUTSS("          ");
+	else dbt_print_fixed(delta * 1000 / DBT_TICKS_PER_US, 3, 10);
+	PUTCC(' ');
+
+	if(DBT_HDR_ID(hdr) == DBT_ID_BUSY) {
+		PUTSS("    being written");
+		PUTSS(newline);
+		return;
+	}
+
+	for(ii = 0; ii < depth && ii < DBT_SPAN_DEPTH; ii++) PUTSS("  ");
+
+	if(dbt_rec_is_span(rec)) {
+		dbt_print_tag(words[0]);
+		PUTSS(DBT_HDR_ID(hdr) == DBT_DESC_ID(dbt_desc_span_begin) ? " {" : " }");
+		if(span != DBT_NO_DELTA) {
+			PUTCC(' ');
+			dbt_print_fixed(span * 1000 / DBT_TICKS_PER_US, 3, 0);
+		}
+		PUTSS(newline);
+		return;
+	}
+
+	desc = dbt_desc_lookup(DBT_HDR_ID(hdr));
+	if(desc && desc->dd_tag) dbt_print_tag(desc->dd_tag);
+	else PUTSS("   ");
+
+	ww = 0;
+	for(ff = 0; desc && ff < DBT_MAX_FIELDS && desc->dd_fields[ff].df_type != DBT_FT_NONE; ff++) {
+		field = &desc->dd_fields[ff];
+		if(ww + (field->df_type == DBT_FT_X64 ? 2 : 1) > nwords) break;
+
+		PUTCC(' ');
+		PUTSS(field->df_name);
+		PUTCC('=');
+
+		switch(field->df_type) {
+		case DBT_FT_U32:
+			PUTSS(format_u(words[ww++], obuf));
+			break;
+		case DBT_FT_S32:
+			PUTSS(format_d((int32_t) words[ww++], obuf));
+			break;
+		case DBT_FT_X64:
+			PUTSS(format_x(words[ww + 1], 8, obuf));
+			PUTSS(format_x(words[ww], 8, obuf));
+			ww += 2;
+			break;
+		case DBT_FT_TAG:
+			dbt_print_tag(words[ww++]);
+			break;
+		case DBT_FT_CHR4:
+			for(ii = 0; ii < 4; ii++) {
+				char cc = (char) (words[ww] >> (ii * 8));
+				PUTCC(ISPRINT(cc) ? cc : '.');
+			}
+			ww++;
+			break;
+		default:
+			PUTSS(format_x(words[ww++], 8, obuf));
+			break;
+		}
+	}
+
+	for(; ww < nwords; ww++) {
+		PUTCC(' ');
+		PUTSS(format_x(words[ww], 8, obuf));
+	}
+	PUTSS(newline);
+}
+
+/*
+ * reading the ring, a walk copies one record at a time out of it and checks
+ * the copy is whole, so it works with writers going
+ */
+
+typedef struct _dbt_walk {
+	DBT_ring *dw_ring;
+	uint16_t dw_end;		// insertion point when the walk started
+	uint16_t dw_start;		// start of the current record
+	uint16_t dw_prev_len;		// length of the record before it, 0 for none
+	uint32_t dw_high;		// high word of the current record's time
+	uint32_t dw_rec[DBT_REC_MAX];	// the current record, dw_rec[0] == 0 for none
+} DBT_walk;
+
+/*
+ * copy the record at start, expect_len is its length if known.
+ * -1 if it isn't there: outside the walk, written over while it was copied, or
+ * a header not yet stored, which shows as the wrong lap or length.
+ */
+
+static int dbt_walk_copy(DBT_walk *walk, uint16_t start, uint32_t expect_len)
+{
+	DBT_ring *ring = walk->dw_ring;
+	uint32_t hdr, len, state, ii;
+
+	if((uint16_t) (walk->dw_end - start) > ring->dr_size) return -1;
+
+	hdr = __atomic_load_n(&DBT_WORD(ring, start), __ATOMIC_ACQUIRE);
+	len = DBT_HDR_LEN(hdr);
+	if(DBT_HDR_LAP(hdr) != DBT_LAP(ring, start)) return -1;
+	if(len < DBT_REC_ARGS || len > DBT_REC_MAX) return -1;
+	if(expect_len && len != expect_len) return -1;
+
+	for(ii = 1; ii < len; ii++) walk->dw_rec[ii] = DBT_WORD(ring, start + ii);
+
+	atomic_thread_fence(memory_order_acquire);
+	state = atomic_load_explicit(&ring->dr_state, memory_order_relaxed);
+	if((uint16_t) (DBT_STATE_INDEX(state) - start) > ring->dr_size) return -1;
+
+	walk->dw_rec[0] = hdr;
+	walk->dw_start = start;
+
+	return 0;
+}
+
+/*
+ * timestamps, see dbt.h
+ *
+ * dw_high is the high word of the current record.  Going back past a sync
+ * record the high word is the one whose low byte it saved, going forward onto
+ * one it is its own.
+ */
+
+static inline int dbt_rec_is_sync(const uint32_t *rec)
+{
+	return DBT_HDR_LEN(rec[0]) && DBT_HDR_ID(rec[0]) == DBT_DESC_ID(dbt_desc_time);
+}
+
+static inline uint32_t dbt_sync_high(const uint32_t *rec)
+{
+	return rec[DBT_REC_ARGS + 1];
+}
+
+static uint32_t dbt_sync_older_high(const uint32_t *rec)
+{
+	uint32_t high, now_high = dbt_sync_high(rec);
+
+	high = (now_high & ~(uint32_t) 0xff) | (rec[DBT_REC_ARGS + 2] & 0xff);
+	if(high > now_high) high -= 0x100;
+
+	return high;
+}
+
+static inline uint64_t dbt_walk_time(DBT_walk *walk)
+{
+	return (((uint64_t) walk->dw_high) << 32) | walk->dw_rec[DBT_REC_TS];
+}
+
+// step back a record, -1 when there are no more whole ones
+
+static int dbt_walk_prev(DBT_walk *walk)
+{
+	uint32_t high = walk->dw_high;
+
+	if(walk->dw_prev_len == 0) return -1;
+	if(dbt_rec_is_sync(walk->dw_rec)) high = dbt_sync_older_high(walk->dw_rec);
+
+	if(dbt_walk_copy(walk, walk->dw_start - walk->dw_prev_len, walk->dw_prev_len) < 0)
+		return -1;
+
+	walk->dw_prev_len = DBT_HDR_PREV(walk->dw_rec[0]);
+	walk->dw_high = high;
+
+	return 0;
+}
+
+// step forward a record, -1 at the end of the walk
+
+static int dbt_walk_next(DBT_walk *walk)
+{
+	uint16_t start;
+
+	start = walk->dw_start + DBT_HDR_LEN(walk->dw_rec[0]);
+	if(start == walk->dw_end) return -1;
+
+	if(dbt_walk_copy(walk, start, 0) < 0) return -1;
+	walk->dw_prev_len = DBT_HDR_PREV(walk->dw_rec[0]);
+	if(dbt_rec_is_sync(walk->dw_rec)) walk->dw_high = dbt_sync_high(walk->dw_rec);
+
+	return 0;
+}
+
+/*
+ * start a walk at the insertion point
+ *
+ * the high word of the newest records is the newest sync record's, a probe
+ * walks back to it.  A record still being reserved stops the probe, so it
+ * tries again, on the target only a reader on the host can see that.
+ * If the probe never gets there the walk is empty and -1 is returned.
+ */
+
+#define DBT_WALK_TRIES	(16)
+
+static int dbt_walk_init(DBT_walk *walk, DBT_ring *ring)
+{
+	DBT_walk probe;
+	uint32_t state;
+	int tries;
+
+	for(tries = 0; tries < DBT_WALK_TRIES; tries++) {
+		state = atomic_load_explicit(&ring->dr_state, memory_order_acquire);
+
+		walk->dw_ring = ring;
+		walk->dw_end = walk->dw_start = DBT_STATE_INDEX(state);
+		walk->dw_prev_len = DBT_STATE_LEN(state);
+		walk->dw_high = 0;
+		walk->dw_rec[0] = 0;
+
+		probe = *walk;
+		while(dbt_walk_prev(&probe) == 0) {
+			if(dbt_rec_is_sync(probe.dw_rec)) {
+				walk->dw_high = dbt_sync_high(probe.dw_rec);
+				return 0;
+			}
+		}
+		if(probe.dw_prev_len == 0) return 0;		// empty
+	}
+
+	walk->dw_prev_len = 0;
+	return -1;
+}
+
+/*
+ * merging the rings into one timeline
+ *
+ * a merge holds a walk per ring, each on its next record to hand out, or
+ * dw_rec[0] == 0 when the ring has no more.  Going back it hands out the
+ * newest of them, going forward the oldest.  Time ties go by ring number, so
+ * both directions agree on the order.
+ */
+
+typedef struct _dbt_merge {
+	DBT_walk dm_walk[DBT_RINGS];
+} DBT_merge;
+
+static inline int dbt_merge_later(DBT_merge *merge, int aa, int bb)
+{
+	uint64_t ta = dbt_walk_time(&merge->dm_walk[aa]);
+	uint64_t tb = dbt_walk_time(&merge->dm_walk[bb]);
+
+	return ta > tb || (ta == tb && aa > bb);
+}
+
+// the ring with the next record in direction, -1 when they are all done
+
+static int dbt_merge_pick(DBT_merge *merge, int backward)
+{
+	int rr, pick = -1;
+
+	for(rr = 0; rr < DBT_RINGS; rr++) {
+		if(merge->dm_walk[rr].dw_rec[0] == 0) continue;
+		if(pick < 0 || dbt_merge_later(merge, rr, pick) == backward) pick = rr;
+	}
+
+	return pick;
+}
+
+static void dbt_merge_step(DBT_merge *merge, int rr, int backward)
+{
+	DBT_walk *walk = &merge->dm_walk[rr];
+
+	if((backward ? dbt_walk_prev(walk) : dbt_walk_next(walk)) < 0) walk->dw_rec[0] = 0;
+}
+
+// start on the newest record of every ring
+
+static void dbt_merge_init(DBT_merge *merge, DBT_ring *rings)
+{
+	int rr;
+
+	for(rr = 0; rr < DBT_RINGS; rr++) {
+		dbt_walk_init(&merge->dm_walk[rr], &rings[rr]);
+		dbt_merge_step(merge, rr, 1);
+	}
+}
+
+static inline uint64_t dbt_merge_time(DBT_merge *merge, int rr)
+{
+	return dbt_walk_time(&merge->dm_walk[rr]);
+}
+
+// from the current insertion point, print the last num_records in forward sequence
+//
+
+enum print_direction {
+	PRINT_DIRECTION_FORWARD = 0,
+	PRINT_DIRECTION_BACKWARD = 1,
+};
+
+/*
+ * back over the newest num_records, counting them and leaving in oldest the
+ * walk on each ring's oldest record handed out, then print them in direction
+ * from the same snapshot.  The delta is the time since the record before it
+ * in the merged timeline.
+ */
+
+/*
+ * pairing spans as they are printed, each ring has its own depth.  The first
+ * of a pair printed leaves its time at its depth, the second takes it.  The
+ * depth before the first span seen is taken to be 0.
+ */
+
+typedef struct _dbt_span_view {
+	uint8_t sv_depth[DBT_RINGS];
+	uint32_t sv_tag[DBT_RINGS][DBT_SPAN_DEPTH];	// 0 for none
+	uint64_t sv_time[DBT_RINGS][DBT_SPAN_DEPTH];
+} DBT_span_view;
+
+// the depth to indent rec by, the span's time into span
+
+static int dbt_span_view(DBT_span_view *view, int rr, const uint32_t *rec, uint64_t time,
+		int backward, uint64_t *span)
+{
+	uint32_t tag, depth;
+	int opens;
+
+	*span = DBT_NO_DELTA;
+	if(!dbt_rec_is_span(rec)) return view->sv_depth[rr];
+
+	tag = rec[DBT_REC_ARGS];
+	depth = rec[DBT_REC_ARGS + 1];
+	opens = (DBT_HDR_ID(rec[0]) == DBT_DESC_ID(dbt_desc_span_begin)) != backward;
+
+	view->sv_depth[rr] = opens ? depth + 1 : depth;
+	if(depth >= DBT_SPAN_DEPTH) return depth;
+
+	if(opens) {
+		view->sv_tag[rr][depth] = tag;
+		view->sv_time[rr][depth] = time;
+	}
+	else if(view->sv_tag[rr][depth] == tag) {
+		*span = backward ? view->sv_time[rr][depth] - time : time - view->sv_time[rr][depth];
+		view->sv_tag[rr][depth] = 0;
+	}
+
+	return depth;
+}
+
+/*
+ * the merges, the walk and the span view are static, well over 1 KB on the
+ * target where the stack is 0x400.  A dump only runs from the shell, one at
+ * a time.
+ */
+
+static int dbt_print_rings(DBT_ring *rings, int num_records, int direction)
+{
+	static DBT_merge newest, merge, oldest;
+	static DBT_walk walk;
+	static DBT_span_view view;
+	uint64_t time, prev_time = DBT_NO_DELTA, span;
+	int rec_num, count, rr, next, depth;
+
+	memset(&view, 0, sizeof(view));
+
+	dbt_merge_init(&newest, rings);
+	merge = newest;
+	for(rr = 0; rr < DBT_RINGS; rr++) oldest.dm_walk[rr].dw_rec[0] = 0;
+
+	for(count = 0; count < num_records; count++) {
+		if((rr = dbt_merge_pick(&merge, 1)) < 0) break;
+		oldest.dm_walk[rr] = merge.dm_walk[rr];
+		dbt_merge_step(&merge, rr, 1);
+	}
+
+	/*
+	 * foward is increasing in time, the record before the first is the
+	 * newest one left over
+	 */
+	if(direction == PRINT_DIRECTION_FORWARD) {	
+		if((rr = dbt_merge_pick(&merge, 1)) >= 0) prev_time = dbt_merge_time(&merge, rr);
+
+		for(rec_num = 0; rec_num < count; rec_num++) {
+			if((rr = dbt_merge_pick(&oldest, 0)) < 0) break;
+			time = dbt_merge_time(&oldest, rr);
+			depth = dbt_span_view(&view, rr, oldest.dm_walk[rr].dw_rec, time, 0, &span);
+			dbt_print_record(oldest.dm_walk[rr].dw_rec, rec_num, time,
+					prev_time == DBT_NO_DELTA ? DBT_NO_DELTA : time - prev_time, depth, span);
+			prev_time = time;
+			dbt_merge_step(&oldest, rr, 0);
+		}
+	}
+	/*
+	 * reverse is backward in time
+	 * start at current point and work backward
+	 */
+	else {						// reverse
+		merge = newest;
+		rr = dbt_merge_pick(&merge, 1);
+		for(rec_num = count - 1; rec_num >= 0 && rr >= 0; rec_num--) {
+			walk = merge.dm_walk[rr];
+			dbt_merge_step(&merge, rr, 1);
+			next = dbt_merge_pick(&merge, 1);
+			time = dbt_walk_time(&walk);
+			depth = dbt_span_view(&view, rr, walk.dw_rec, time, 1, &span);
+			dbt_print_record(walk.dw_rec, rec_num, time,
+					next < 0 ? DBT_NO_DELTA : time - dbt_merge_time(&merge, next), depth, span);
+			rr = next;
+		}
+	}
+
+	return 0;
+}
+
+int dbt_print(int num_records, int direction)
+{
+	return dbt_print_rings(dbt_rings, num_records, direction);
+}
+
+// the same from the run before the last reset, -1 if there is none
+
+int dbt_print_prev(int num_records, int direction)
+{
+	if(dbt_prev_rings == 0) return -1;
+
+	return dbt_print_rings(dbt_prev_rings, num_records, direction);
+}
+
+/*
+ * streaming, see dbt.h for the frames
+ *
+ * each ring is drained from dd_next, the start of the next record to send,
+ * forward to the insertion point.  Sync records aren't sent, the frame
+ * carries the high word, so a frame ends where the high word changes.
+ * A ring that laps dd_next is picked up again at its oldest whole record and
+ * the words skipped are sent as lost in the next frame.
+ */
+
+typedef struct _dbt_drain {
+	uint16_t dd_next;		// start of the next record to send
+	uint32_t dd_high;		// high word of its time
+	uint32_t dd_lost;		// words written over before they were sent
+} DBT_drain;
+
+typedef struct _dbt_stream {
+	int (*ds_sink)(const uint8_t *buf, uint16_t len);
+	uint16_t ds_seq;
+	uint16_t ds_desc;		// next descriptor to send
+	uint8_t ds_info;		// info frame still to send
+	DBT_drain ds_drain[DBT_RINGS];
+	uint32_t ds_frames;
+	uint32_t ds_records;
+	uint32_t ds_bytes;
+	uint32_t ds_lost;
+	uint32_t ds_stalls;		// sink full
+} DBT_stream;
+
+static DBT_stream dbt_stream;
+
+static uint8_t dbt_frame[DBT_FRAME_MAX + 2];
+static uint8_t dbt_wire[FRAME_WIRE_MAX(DBT_FRAME_MAX)];
+
+#ifndef CONSOLE_BUILD
+
+extern Byte_fifo usart1_tx_fifo;
+extern void usart1_transmit_interrupt_enable();
+
+// a frame goes in whole or not at all, the console shares the fifo
+
+static int dbt_stream_uart(const uint8_t *buf, uint16_t len)
+{
+	if(bf_mp_write(&usart1_tx_fifo, buf, len) == 0) return -1;
+	usart1_transmit_interrupt_enable();
+
+	return 0;
+}
+
+#endif // CONSOLE_BUILD
+
+static inline void dbt_put16(uint8_t *dst, uint16_t val)
+{
+	dst[0] = (uint8_t) val;
+	dst[1] = (uint8_t) (val >> 8);
+}
+
+static inline void dbt_put32(uint8_t *dst, uint32_t val)
+{
+	dbt_put16(dst, (uint16_t) val);
+	dbt_put16(dst + 2, (uint16_t) (val >> 16));
+}
+
+// fill in type, ring and sequence, frame and send, -1 if the sink is full
+
+static int dbt_stream_send(uint8_t type, uint8_t ring, uint16_t len)
+{
+	DBT_stream *ds = &dbt_stream;
+	uint16_t wlen;
+
+	dbt_frame[0] = type;
+	dbt_frame[1] = ring;
+	dbt_put16(&dbt_frame[2], ds->ds_seq);
+
+	wlen = frame_encode(dbt_frame, len, dbt_wire);
+	if(ds->ds_sink(dbt_wire, wlen) < 0) {
+		ds->ds_stalls++;
+		return -1;
+	}
+
+	ds->ds_seq++;
+	ds->ds_frames++;
+	ds->ds_bytes += wlen;
+
+	return 0;
+}
+
+static int dbt_stream_desc(uint16_t id)
+{
+	const DBT_desc *desc = dbt_desc_lookup(id);
+	uint16_t len = DBT_FRAME_HDR;
+	int ff, nn;
+
+	dbt_put16(&dbt_frame[len], id);
+	dbt_put32(&dbt_frame[len + 2], desc->dd_tag);
+	len += 6;
+
+	for(ff = 0; ff < DBT_MAX_FIELDS && desc->dd_fields[ff].df_type != DBT_FT_NONE; ff++) {
+		nn = strlen(desc->dd_fields[ff].df_name) + 1;
+		if(len + 1 + nn > DBT_FRAME_MAX) break;
+		dbt_frame[len++] = desc->dd_fields[ff].df_type;
+		memcpy(&dbt_frame[len], desc->dd_fields[ff].df_name, nn);
+		len += nn;
+	}
+
+	return dbt_stream_send(DBT_FRAME_DESC, 0, len);
+}
+
+// point the drain at the oldest whole record, -1 if a record in flight hides it
+
+static int dbt_drain_resync(DBT_drain *drain, DBT_ring *ring)
+{
+	DBT_walk walk;
+	uint16_t oldest;
+	uint32_t high;
+
+	if(dbt_walk_init(&walk, ring) < 0) return -1;
+
+	oldest = walk.dw_end;
+	high = walk.dw_high;
+	while(dbt_walk_prev(&walk) == 0) {
+		oldest = walk.dw_start;
+		high = walk.dw_high;
+	}
+
+	drain->dd_next = oldest;
+	drain->dd_high = high;
+
+	return 0;
+}
+
+/*
+ * send a frame of records from ring rr
+ *
+ * returns 1 for a frame sent, 0 for nothing to send yet, -1 if the sink is full
+ */
+
+static int dbt_drain_ring(int rr)
+{
+	DBT_drain *drain = &dbt_stream.ds_drain[rr];
+	DBT_ring *ring = &dbt_rings[rr];
+	DBT_walk walk;
+	uint16_t next = drain->dd_next, len = DBT_FRAME_RECS, rec_len;
+	uint32_t state, high = drain->dd_high, lost;
+	int ii, nrecs = 0;
+
+	walk.dw_ring = ring;
+	for(;;) {
+		state = atomic_load_explicit(&ring->dr_state, memory_order_acquire);
+		walk.dw_end = DBT_STATE_INDEX(state);
+		if(next == walk.dw_end) break;
+
+		if(dbt_walk_copy(&walk, next, 0) < 0) {
+			state = atomic_load_explicit(&ring->dr_state, memory_order_acquire);
+			if((uint16_t) (DBT_STATE_INDEX(state) - next) <= ring->dr_size) break;
+
+			// lapped, send what is in hand first
+
+			if(nrecs) break;
+			if(dbt_drain_resync(drain, ring) < 0) break;
+			drain->dd_lost += (uint16_t) (drain->dd_next - next);
+			next = drain->dd_next;
+			high = drain->dd_high;
+			continue;
+		}
+
+		if(DBT_HDR_ID(walk.dw_rec[0]) == DBT_ID_BUSY) break;
+		rec_len = DBT_HDR_LEN(walk.dw_rec[0]);
+
+		if(dbt_rec_is_sync(walk.dw_rec)) {
+			if(nrecs && dbt_sync_high(walk.dw_rec) != high) break;
+			high = dbt_sync_high(walk.dw_rec);
+			next += rec_len;
+			if(nrecs == 0) {
+				drain->dd_next = next;
+				drain->dd_high = high;
+			}
+			continue;
+		}
+
+		if(len + rec_len * 4 > DBT_FRAME_MAX) break;
+		for(ii = 0; ii < rec_len; ii++, len += 4) dbt_put32(&dbt_frame[len], walk.dw_rec[ii]);
+		next += rec_len;
+		nrecs++;
+	}
+
+	if(nrecs == 0) return 0;
+
+	lost = drain->dd_lost > 0xffff ? 0xffff : drain->dd_lost;
+	dbt_put16(&dbt_frame[4], (uint16_t) lost);
+	dbt_put32(&dbt_frame[6], high);
+	if(dbt_stream_send(DBT_FRAME_RECORDS, rr, len) < 0) return -1;
+
+	dbt_stream.ds_records += nrecs;
+	dbt_stream.ds_lost += drain->dd_lost;
+	drain->dd_lost = 0;
+	drain->dd_next = next;
+	drain->dd_high = high;
+
+	return 1;
+}
+
+/*
+ * start streaming to sink, 0 for the UART.  The info frame and the
+ * descriptors go first, then every ring from its oldest whole record.
+ */
+
+int dbt_stream_start(int (*sink)(const uint8_t *buf, uint16_t len))
+{
+	DBT_stream *ds = &dbt_stream;
+	int rr;
+
+#ifndef CONSOLE_BUILD
+	if(sink == 0) sink = dbt_stream_uart;
+#endif // CONSOLE_BUILD
+	if(sink == 0) return -1;
+
+	memset(ds, 0, sizeof(*ds));
+	for(rr = 0; rr < DBT_RINGS; rr++) {
+		if(dbt_drain_resync(&ds->ds_drain[rr], &dbt_rings[rr]) < 0)
+			ds->ds_drain[rr].dd_next = DBT_STATE_INDEX(dbt_rings[rr].dr_state);
+	}
+	ds->ds_info = 1;
+	ds->ds_sink = sink;
+
+	return 0;
+}
+
+void dbt_stream_stop()
+{
+	dbt_stream.ds_sink = 0;
+}
+
+/*
+ * call from the main loop, sends until the sink is full or there is
+ * nothing left.  returns the frames sent.
+ */
+
+int dbt_stream_poll()
+{
+	DBT_stream *ds = &dbt_stream;
+	uint16_t num_desc = (uint16_t) (__stop_dbt_desc - __start_dbt_desc);
+	int rr, ret, frames = 0;
+
+	if(ds->ds_sink == 0) return 0;
+
+	if(ds->ds_info) {
+		dbt_frame[4] = DBT_FRAME_VERSION;
+		dbt_frame[5] = DBT_RINGS;
+		dbt_put32(&dbt_frame[6], DBT_TICKS_PER_US);
+		if(dbt_stream_send(DBT_FRAME_INFO, 0, DBT_FRAME_HDR + 6) < 0) return frames;
+		ds->ds_info = 0;
+		frames++;
+	}
+
+	for(; ds->ds_desc < num_desc; ds->ds_desc++, frames++)
+		if(dbt_stream_desc(ds->ds_desc) < 0) return frames;
+
+	for(rr = 0; rr < DBT_RINGS; rr++) {
+		while((ret = dbt_drain_ring(rr)) > 0) frames++;
+		if(ret < 0) break;
+	}
+
+	return frames;
+}
+
+SHELL_POLL(dbt_stream_hook, dbt_stream_poll);
+
+static void dbt_stream_print_stats()
+{
+	DBT_stream *ds = &dbt_stream;
+	char obuf[12];
+
+	PUTSS(ds->ds_sink ? "stream on" : "stream off");
+	PUTSS(newline);
+	PUTSS("frames: ");
+	PUTSS(format_u(ds->ds_frames, obuf));
+	PUTSS(" records: ");
+	PUTSS(format_u(ds->ds_records, obuf));
+	PUTSS(" bytes: ");
+	PUTSS(format_u(ds->ds_bytes, obuf));
+	PUTSS(newline);
+	PUTSS("lost words: ");
+	PUTSS(format_u(ds->ds_lost, obuf));
+	PUTSS(" stalls: ");
+	PUTSS(format_u(ds->ds_stalls, obuf));
+	PUTSS(newline);
+}
+
+/*
+ * compile a trigger expression from the shell's words
+ *
+ * 	expr := and_expr { or and_expr }
+ * 	and_expr := term { and term }
+ * 	term := [!] tag=ABC | id=N | fN<op>V | sN<op>V
+ *
+ * fN is field N unsigned, sN signed, op is one of == != < <= > >=.  Terms
+ * are one word each.  Returns the program's length, DBT_OP_END not counted,
+ * -1 for a bad expression or one that doesn't fit.
+ */
+
+typedef struct _dbt_compile {
+	int dc_argc;
+	char **dc_argv;
+	int dc_pos;
+	uint32_t *dc_prog;
+	int dc_len;
+} DBT_compile;
+
+static int dbt_compile_emit(DBT_compile *dc, uint32_t op, int nimm, uint32_t imm)
+{
+	if(dc->dc_len + 1 + nimm >= DBT_PROG_MAX) return -1;
+
+	dc->dc_prog[dc->dc_len++] = op;
+	if(nimm) dc->dc_prog[dc->dc_len++] = imm;
+
+	return 0;
+}
+
+static int dbt_compile_term(DBT_compile *dc)
+{
+	static const struct { char name[3]; uint8_t code; } cmps[] = {
+		{ "==", DBT_OP_EQ }, { "!=", DBT_OP_NE }, { "<=", DBT_OP_LE },
+		{ ">=", DBT_OP_GE }, { "<", DBT_OP_LT }, { ">", DBT_OP_GT },
+	};
+	char *tt;
+	uint32_t op;
+	int ii, nn, field, neg = 0, ret;
+
+	if(dc->dc_pos >= dc->dc_argc) return -1;
+	tt = dc->dc_argv[dc->dc_pos++];
+
+	if(*tt == '!') {
+		neg = 1;
+		tt++;
+	}
+
+	if(strncmp(tt, "tag=", 4) == 0) {
+		if(strlen(tt) != 7) return -1;
+		ret = dbt_compile_emit(dc, DBT_OP_TAG, 1, DBT_MAKE_TAG(0, tt[4], tt[5], tt[6]));
+	}
+	else if(strncmp(tt, "id=", 3) == 0 && tt[3]) {
+		ret = dbt_compile_emit(dc, DBT_OP_ID, 1, (uint32_t) STRTOL(&tt[3]));
+	}
+	else if((*tt == 'f' || *tt == 's') && tt[1] >= '0' && tt[1] <= '9') {
+		op = (*tt++ == 's') ? DBT_OP_SIGNED : 0;
+		for(field = 0; *tt >= '0' && *tt <= '9'; tt++) field = field * 10 + (*tt - '0');
+		if(field >= DBT_MAX_WORDS) return -1;
+
+		for(ii = 0; ii < sizeof(cmps) / sizeof(cmps[0]); ii++) {
+			nn = strlen(cmps[ii].name);
+			if(strncmp(tt, cmps[ii].name, nn) == 0) break;
+		}
+		if(ii == sizeof(cmps) / sizeof(cmps[0]) || tt[nn] == 0) return -1;
+
+		op |= cmps[ii].code | (field << 8);
+		ret = dbt_compile_emit(dc, op, 1, (uint32_t) STRTOL(&tt[nn]));
+	}
+	else return -1;
+
+	if(ret == 0 && neg) ret = dbt_compile_emit(dc, DBT_OP_NOT, 0, 0);
+
+	return ret;
+}
+
+static int dbt_compile_and(DBT_compile *dc)
+{
+	if(dbt_compile_term(dc) < 0) return -1;
+
+	while(dc->dc_pos < dc->dc_argc && strcmp(dc->dc_argv[dc->dc_pos], "and") == 0) {
+		dc->dc_pos++;
+		if(dbt_compile_term(dc) < 0 || dbt_compile_emit(dc, DBT_OP_AND, 0, 0) < 0) return -1;
+	}
+
+	return 0;
+}
+
+int dbt_trig_compile(int argc, char *argv[], uint32_t *prog)
+{
+	DBT_compile dc = { .dc_argc = argc, .dc_argv = argv, .dc_prog = prog };
+
+	if(argc > 0) {
+		if(dbt_compile_and(&dc) < 0) return -1;
+
+		while(dc.dc_pos < argc && strcmp(argv[dc.dc_pos], "or") == 0) {
+			dc.dc_pos++;
+			if(dbt_compile_and(&dc) < 0 || dbt_compile_emit(&dc, DBT_OP_OR, 0, 0) < 0) return -1;
+		}
+		if(dc.dc_pos != argc) return -1;
+	}
+	prog[dc.dc_len] = DBT_OP_END;
+
+	return dc.dc_len;
+}
+
+static const char *dbt_trig_state_name[] = { "off", "waiting", "running", "post trigger", "frozen" };
+
+/*
+ * dbtrace trig [start | stop | filter expr | pre num | post num | arm | off]
+ * a new program turns the engine off until it is armed again
+ */
+
+static void dbt_trig_cmd(int argc, char *argv[])
+{
+	DBT_trig *dt = &dbt_trig;
+	uint32_t prog[DBT_PROG_MAX], *which = 0;
+	char obuf[12];
+	int len;
+
+	if(argc >= 1) {
+		if(strcmp(argv[0], "start") == 0) which = dt->dt_start;
+		else if(strcmp(argv[0], "stop") == 0) which = dt->dt_stop;
+		else if(strcmp(argv[0], "filter") == 0) which = dt->dt_filter;
+		else if(strcmp(argv[0], "pre") == 0 && argc == 2) dt->dt_pre = STRTOL(argv[1]);
+		else if(strcmp(argv[0], "post") == 0 && argc == 2) dt->dt_post = STRTOL(argv[1]);
+		else if(strcmp(argv[0], "arm") == 0) dbt_trig_arm();
+		else if(strcmp(argv[0], "off") == 0) dbt_trig_off();
+		else {
+			PUTSS("unknown trig option\r\n");
+			return;
+		}
+	}
+
+	if(which) {
+		if((len = dbt_trig_compile(argc - 1, &argv[1], prog)) < 0) {
+			PUTSS("bad expression\r\n");
+			return;
+		}
+		dbt_trig_off();
+		dbt_trig_set(which, prog, len);
+	}
+
+	PUTSS("trig ");
+	PUTSS(dbt_trig_state_name[atomic_load(&dt->dt_state)]);
+	PUTSS(" pre: ");
+	PUTSS(format_u(dt->dt_pre, obuf));
+	PUTSS(" post: ");
+	PUTSS(format_u(dt->dt_post, obuf));
+	PUTSS(" kept: ");
+	PUTSS(format_u(atomic_load(&dt->dt_count), obuf));
+	PUTSS(" dropped: ");
+	PUTSS(format_u(atomic_load(&dt->dt_dropped), obuf));
+	PUTSS(newline);
+}
+
+/*
+ * print and clear every statistics entry
+ *
+ * TM2 ticks count=1000 min=12 max=4010 avg=96
+ *     0:2 1:0 ... >=64:700 >=2048:30
+ *
+ * only the buckets with hits, each by the least value it holds
+ */
+
+static void dbt_stats_print()
+{
+	DBT_stat *stat;
+	uint64_t sum;
+	uint32_t count, hits;
+	char obuf[12];
+	int bb;
+
+	for(stat = __start_dbt_stat; stat < __stop_dbt_stat; stat++) {
+		count = atomic_load(&stat->ds_count);
+		sum = ((uint64_t) atomic_load(&stat->ds_sum_hi) << 32) | atomic_load(&stat->ds_sum_lo);
+
+		dbt_print_tag(stat->ds_tag);
+		PUTCC(' ');
+		PUTSS(stat->ds_unit);
+		PUTSS(" count=");
+		PUTSS(format_u(count, obuf));
+		if(sum || atomic_load(&stat->ds_hist[0])) {
+			PUTSS(" min=");
+			PUTSS(format_u(atomic_load(&stat->ds_min), obuf));
+			PUTSS(" max=");
+			PUTSS(format_u(atomic_load(&stat->ds_max), obuf));
+			PUTSS(" avg=");
+			PUTSS(format_u(count ? (uint32_t) (sum / count) : 0, obuf));
+			PUTSS(newline);
+			PUTSS("   ");
+			for(bb = 0; bb < DBT_STAT_BUCKETS; bb++) {
+				if((hits = atomic_load(&stat->ds_hist[bb])) == 0) continue;
+				PUTSS(bb ? " >=" : " ");
+				PUTSS(format_u(bb ? (uint32_t) 1 << (bb - 1) : 0, obuf));
+				PUTCC(':');
+				PUTSS(format_u(hits, obuf));
+			}
+		}
+		PUTSS(newline);
+
+		dbt_stat_clear(stat);
+	}
+}
+
+/*
+ * the sub commands, any can be typed as a prefix only it starts with
+ */
+
+enum {
+	DBT_SUB_MASK,
+	DBT_SUB_DUMP,
+	DBT_SUB_PREV,
+	DBT_SUB_TRIG,
+	DBT_SUB_STREAM,
+	DBT_SUB_STATS,
+};
+
+static const Shell_sub_cmd dbt_sub_cmds[] = {
+	{ DBT_SUB_MASK, 2, 3, "mask", "m", "mask [value]" },
+	{ DBT_SUB_DUMP, 3, 4, "dump", "d", "dump num_records [forward | backward]" },
+	{ DBT_SUB_PREV, 3, 4, "prev", "p", "prev num_records [forward | backward]" },
+	{ DBT_SUB_TRIG, 2, 10, "trig", "t", "trig [start | stop | filter expr | pre num | post num | arm | off]" },
+	{ DBT_SUB_STREAM, 2, 3, "stream", "s", "stream [on | off]" },
+	{ DBT_SUB_STATS, 2, 2, "stats", "sta", "stats" },
+};
+
+int dbt_shell_cmd(int sargc, char *sargv[])
+{
+	const Shell_sub_cmd *sub;
+	char obuf[9];
+	int ii;
 
-static uint64_t bars = DBT_U8_TO_U64( '=', '=', '=', '=', '=', '=', '=', '=');
+	if((ii = shell_sub_cmd_list_search(sargv[1], dbt_sub_cmds, SUB_CMD_LIST_LEN(dbt_sub_cmds))) < 0) {
+		PUTSS("unknown option\n\r");
+		return 1;
+	}
+	sub = &dbt_sub_cmds[ii];
+	if(sargc < sub->ssc_min || sargc > sub->ssc_max) {
+		PUTSS("dbtrace ");
+		PUTSS(sub->ssc_help);
+		PUTSS(newline);
+		return 1;
+	}
 
-uint64_t dbt_log_buf[(DBT_LOG_SIZE+2) * 2];		// leave space to handle overage for writes 
-											// during interrupts
+	switch(sub->ssc_cmd_num) {
+	case DBT_SUB_MASK:
+		if(sargc == 3) {
+			dbt_global_mask = STRTOL(sargv[2]);
+			PUTSS(newline);
+		}
+		PUTSS("mask: ");
+		PUTSS(format_x((uint32_t) dbt_global_mask, 8, obuf));
+		PUTSS(newline);
+		break;
+	case DBT_SUB_DUMP:				// default is backward
+		if(sargc == 4 && *sargv[3] == 'f')
+			dbt_print(STRTOL(sargv[2]), PRINT_DIRECTION_FORWARD);
+		else dbt_print(STRTOL(sargv[2]), PRINT_DIRECTION_BACKWARD);
+		break;
+	case DBT_SUB_PREV:
+		if(dbt_print_prev(STRTOL(sargv[2]), (sargc == 4 && *sargv[3] == 'f')
+					? PRINT_DIRECTION_FORWARD : PRINT_DIRECTION_BACKWARD) < 0)
+			PUTSS("no trace from before the last reset\r\n");
+		break;
+	case DBT_SUB_TRIG:
+		dbt_trig_cmd(sargc - 2, &sargv[2]);
+		break;
+	case DBT_SUB_STREAM:
+		if(sargc == 3 && sargv[2][1] == 'n') dbt_stream_start(0);
+		else if(sargc == 3 && sargv[2][1] == 'f') dbt_stream_stop();
+		dbt_stream_print_stats();
+		break;
+	case DBT_SUB_STATS:
+		dbt_stats_print();
+		break;
+	}
+	return 1;			// primt prompt
+}
 
-uint32_t dbt_log_index = 0;
+SHELL_COMMAND_SUBS(dbt_cmd, "dbtrace", "db",
+		"dbtrace mask [value] | dump | prev num_records [forwward | backward] | stream [on | off] | stats"
+		" | trig [start | stop | filter expr | pre num | post num | arm | off]",
+		dbt_shell_cmd, 2, 10, dbt_sub_cmds);
 
-uint32_t dbt_global_mask = 0;
+/*
+ * build with DBT_NOINIT_WORDS to keep the trace across a reset in that many
+ * words of .noinit, the linker script needs
+ *
+ * 	.noinit (NOLOAD) : { *(.noinit) } > RAM
+ *
+ * and DBT_RING_SIZE=0 saves the static rings it replaces
+ */
 
+#ifdef DBT_NOINIT_WORDS
+uint32_t dbt_noinit_arena[DBT_NOINIT_WORDS] __attribute__((section(".noinit"), aligned(8)));
+#endif // DBT_NOINIT_WORDS
 
-int dbt_write(DBT_log_entry *dbt)
+int dbt_cmd_init()
 {
-	dbt_log_buf[dbt_log_index] = dbt -> u64[0];
-	dbt_log_buf[dbt_log_index+1] = dbt -> u64[1];
-	dbt_log_index += 2;
-	dbt_log_index &= DBT_LOG_MASK;
-
-	dbt_log_buf[dbt_log_index] = bars;
-	dbt_log_buf[dbt_log_index+1] = bars;
+	dbt_time_init();
+#ifdef DBT_NOINIT_WORDS
+	dbt_init_persist(dbt_noinit_arena, sizeof(dbt_noinit_arena));
+#endif // DBT_NOINIT_WORDS
 
 	return 0;
 }
 
-void dbt_set_mask(uint32_t new_mask)
-{
-	dbt_global_mask = new_mask;
-}
 
-void dbt_enable_mask_bit(uint32_t mask_bit)
-{
-	dbt_global_mask |= mask_bit;
-}
+#ifdef SA_CONSOLE_BUILD
 
-void dbt_disable_mask_bit(uint32_t mask_bit)
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * torture test
+ *
+ * console/dbt -t [num_threads [num_records]]
+ *
+ * writer threads trace records of 1 to 6 words as fast as they can
+ * 	thread, sequence, check words ...
+ * where each check word is a function of thread, sequence and position.
+ * a reader thread walks the rings back, merged, over and over while they
+ * write.  Every record it sees must be whole, or busy, and in time order, and
+ * each thread's sequence numbers must go down.  More threads than rings
+ * share them.  The same holds for the log left
+ * when the writers are done.
+ *
+ * returns 0 on success, -1 on failure
+ */
+
+#define TT_MAX_THREADS	(32)
+
+static DBT_DESC(tt_desc, DBT_MAKE_TAG(0, 'T', 'T', 'T'),
+	DBT_FIELD(DBT_FT_U32, "thread"), DBT_FIELD(DBT_FT_U32, "seq"));
+
+static int tt_threads = 4;
+static int tt_records = 200000;
+static volatile int tt_writing;
+static int tt_failed;
+
+static inline uint32_t tt_check(uint32_t thread, uint32_t seq, int ii)
 {
-	dbt_global_mask &= ~mask_bit;
+	return (thread * 0x9e3779b9) ^ (seq * 0x85ebca6b) ^ ii;
 }
 
-void dbt_print_ascii(DBT_log_entry *record_to_print, int line_num)
+void *tt_write_side(void *ptr)
 {
-	char *ss;
-	int ii;
-	char obuf[9];
+	uint32_t thread = (uint32_t) (intptr_t) ptr;
+	uint32_t words[6];
+	int seq, ii, nwords;
 
-	ss = (char*) record_to_print;
-
-	PUTSS(format_x((uint32_t) line_num, 6, obuf));
-	PUTSS(": ");
-	for(ii = 0; ii < 16; ii++) {
-		PUTCC(ISPRINT(ss[ii]) ? ss[ii] : '.');
-		if(ii == 7) PUTCC(' ');
+	for(seq = 0; seq < tt_records; seq++) {
+		nwords = 2 + (seq + thread) % 5;
+		words[0] = thread;
+		words[1] = seq;
+		for(ii = 2; ii < nwords; ii++) words[ii] = tt_check(thread, seq, ii);
+		dbt_write_words(DBT_DESC_ID(tt_desc), words, nwords);
+		if((seq & 0xff) == 0) sched_yield();
 	}
+
+	return 0;
 }
 
-void dbt_print_record(DBT_log_entry *record_to_print, int rec_num)
+/*
+ * walk the whole log back, returns the number of whole records, -1 on a bad one
+ */
+
+static int tt_check_log()
 {
-	char *ss;
-	ss = (char*) record_to_print;
-	int ii;
-	char obuf[9];
+	DBT_merge merge;
+	uint32_t last_seq[TT_MAX_THREADS];
+	uint32_t thread, seq, rec[DBT_REC_MAX];
+	uint64_t time, last_time = ~(uint64_t) 0;
+	int ii, rr, nwords, count = 0;
 
-	dbt_print_ascii(record_to_print, rec_num);
-	PUTCC(' ');
+	for(ii = 0; ii < TT_MAX_THREADS; ii++) last_seq[ii] = ~(uint32_t) 0;
 
-	switch(ss[0]) {
-	case DBT_DUMP_FORMAT_NONE:
-		{
-			for(ii = 0; ii < 16; ii++) {
-				PUTSS(format_x((uint32_t) ss[ii], 2, obuf));
-				if(ii == 7) PUTSS("  ");
-				else PUTCC(' ');
-			}
-			PUTSS(newline);
+	dbt_merge_init(&merge, dbt_rings);
+	while((rr = dbt_merge_pick(&merge, 1)) >= 0) {
+		memcpy(rec, merge.dm_walk[rr].dw_rec, sizeof(rec));
+		time = dbt_merge_time(&merge, rr);
+		dbt_merge_step(&merge, rr, 1);
+
+		if(DBT_HDR_ID(rec[0]) == DBT_ID_BUSY) continue;
+
+		if(time > last_time) {
+			fprintf(stderr, "tt: record out of time order\n");
+			return -1;
 		}
+		last_time = time;
 
-		break;
-	case DBT_DUMP_FORMAT_TAG_3xU32:
-		{
-			uint32_t *u32 = (uint32_t*) ss;
-			PUTCC('.');
-			PUTSS(format_x((uint32_t) u32[1], 8, obuf));
-			PUTCC(' ');
-			PUTSS(format_x((uint32_t) u32[2], 8, obuf));
-			PUTCC(' ');
-			PUTSS(format_x((uint32_t) u32[3], 8, obuf));
-			PUTSS(newline);
+		if(DBT_HDR_ID(rec[0]) != DBT_DESC_ID(tt_desc)) continue;
+
+		nwords = DBT_HDR_LEN(rec[0]) - DBT_REC_ARGS;
+		thread = rec[DBT_REC_ARGS];
+		seq = rec[DBT_REC_ARGS + 1];
+
+		if(thread >= tt_threads || nwords != 2 + (seq + thread) % 5) {
+			fprintf(stderr, "tt: bad record, thread %u seq %u words %d\n", thread, seq, nwords);
+			return -1;
 		}
-		break;
-	default:
-		{
-			uint32_t *u32 = (uint32_t*) ss;
-			PUTSS(format_x((uint32_t) u32[0], 8, obuf));
-			PUTCC(' ');
-			PUTSS(format_x((uint32_t) u32[1], 8, obuf));
-			PUTCC(' ');
-			PUTSS(format_x((uint32_t) u32[2], 8, obuf));
-			PUTCC(' ');
-			PUTSS(format_x((uint32_t) u32[3], 8, obuf));
-			PUTSS(newline);
+		for(ii = 2; ii < nwords; ii++) {
+			if(rec[DBT_REC_ARGS + ii] != tt_check(thread, seq, ii)) {
+				fprintf(stderr, "tt: torn record, thread %u seq %u\n", thread, seq);
+				return -1;
+			}
 		}
-		break;
+		if(seq >= last_seq[thread]) {
+			fprintf(stderr, "tt: thread %u seq %u after %u\n", thread, seq, last_seq[thread]);
+			return -1;
+		}
+		last_seq[thread] = seq;
+		count++;
 	}
-}
-
-// from the current insertion point, print the last num_records in forward sequence
-//
 
-enum print_direction {
-	PRINT_DIRECTION_FORWARD = 0,
-	PRINT_DIRECTION_BACKWARD = 1,
-};
+	return count;
+}
 
-int dbt_print(int num_records, int direction)
+void *tt_read_side(void *ptr)
 {
-	DBT_log_entry *dbt;
-	int rec_num;
-	DBT_log_entry *begin = (DBT_log_entry*) &dbt_log_buf[0];
-	DBT_log_entry *end = (DBT_log_entry*) &dbt_log_buf[DBT_LOG_SIZE];
-	int start_index;
+	int *walks = (int*) ptr;
 
-	/*
-	 * foward is increasing in time
-	 * back the start point up
-	 */
-	if(direction == PRINT_DIRECTION_FORWARD) {	
-		
-		start_index = dbt_log_index - (num_records * 2);	// back it up
-		if(start_index < 0) start_index += DBT_LOG_SIZE;	// maybe wrap it
-		
-		rec_num = 0;
-
-		dbt = (DBT_log_entry*) &dbt_log_buf[start_index];
-
-		for(rec_num = 0; rec_num < num_records; rec_num++) {
-			dbt_print_record(dbt, rec_num);
-			dbt++;
-			if(dbt > end) dbt = begin;
+	while(tt_writing) {
+		if(tt_check_log() < 0) {
+			tt_failed = 1;
+			break;
 		}
+		(*walks)++;
 	}
-	/*
-	 * reverse is backward in time
-	 * start at current point and work backward
-	 */
-	else {						// reverse
-		start_index = dbt_log_index - 2;			// currently points at bars
-		if(start_index < 0) start_index += DBT_LOG_SIZE;
 
-		rec_num = num_records;
-		dbt = (DBT_log_entry*) &dbt_log_buf[dbt_log_index-2];
+	return 0;
+}
+
+int tt_torture()
+{
+	pthread_t writers[TT_MAX_THREADS], reader;
+	int id, walks = 0, count;
 
-		for(rec_num = num_records -1; rec_num >= 0; rec_num--) {
-			dbt_print_record(dbt, rec_num);
-			dbt--;
-			if(dbt < begin) dbt = end;
+	tt_writing = 1;
+	if(pthread_create(&reader, NULL, tt_read_side, &walks) != 0) {
+		fprintf(stderr, "couldn't start reader\n");
+		return -1;
+	}
+	for(id = 0; id < tt_threads; id++) {
+		if(pthread_create(&writers[id], NULL, tt_write_side, (void*) (intptr_t) id) != 0) {
+			fprintf(stderr, "couldn't start writer %d\n", id);
+			return -1;
 		}
 	}
 
+	for(id = 0; id < tt_threads; id++) pthread_join(writers[id], NULL);
+	tt_writing = 0;
+	pthread_join(reader, NULL);
+
+	if(tt_failed || (count = tt_check_log()) <= 0) return -1;
+
+	printf("tt: %d threads, %d records each, %d walks while writing, %d whole at the end, ok\n",
+			tt_threads, tt_records, walks, count);
+
 	return 0;
 }
 
-int dbt_shell_cmd(int sargc, char *sargv[])
+void *stat_side(void *ptr)
 {
-	char obuf[9];
+	DBT_stat *stat = (DBT_stat*) ptr;
+	int ii;
 
-	if(*sargv[1] == 'm') {			// mask set
-		if(sargc == 2) {
-			PUTSS("mask: ");
-			PUTSS(format_x((uint32_t) dbt_global_mask, 8, obuf));
-			PUTSS(newline);
-		}
-		else if(sargc == 3) {
-			dbt_global_mask = STRTOL(sargv[2]);
-			PUTSS("\r\nmask: ");
-			PUTSS(format_x((uint32_t) dbt_global_mask, 8, obuf));
-			PUTSS(newline);
-		}
-		else {
-			PUTSS("bad command\r\n");
-		}
-	}
-	else if(*sargv[1] == 'd') {			// dump num_records [forward | backward]
-		if(sargc >= 3) {
-			uint32_t num_records;
+	for(ii = 0; ii < 100000; ii++) DBT_STAT_VALUE(DBT_BIT_TIMER, *stat, ii);
 
-			num_records = STRTOL(sargv[2]);
-			if(sargc == 4 && *sargv[3] == 'f')		// default is backward
-				dbt_print(num_records, PRINT_DIRECTION_FORWARD);
-			else dbt_print(num_records, PRINT_DIRECTION_BACKWARD);
-		}
-		else {
-			PUTSS("not enough args to dump trace command\n\r");
-		}
-	}
-	else {
-		PUTSS("unknown option\n\r");
-	}
-	return 1;			// primt prompt
+	return 0;
 }
 
-Shell_cmd dbt_cmd = {
-	.list = {0, 0},
-	.sc_name = "dbtrace",
-	.sc_abrev = "db",
-	.sc_help = "dbtrace mask [value] | dump num_records [forwward | backward]",
-	.sc_func = dbt_shell_cmd,
-	.sc_min = 2,
-	.sc_max = 4,
-};
+void *demo_other_thread(void *ptr)
+{
+	DBT_2_U32(DBT_BIT_TIMER, 0xee, 2);
 
-int dbt_cmd_init()
+	return 0;
+}
+
+/*
+ * stream test
+ *
+ * console/dbt -s [num_threads [num_records [drop]]] | tools/dbt_decode
+ *
+ * the torture test's writers trace while the main thread streams to stdout.
+ * The sink turns away every 7th frame, as a full fifo would, throws away
+ * every drop'th frame it takes, as a noisy line would, and puts console
+ * text between frames now and then.  The decoder should show the timeline
+ * with the dropped frames and any words the writers lapped as gaps.
+ */
+
+static int st_drop = 0;
+static int st_calls = 0;
+static int st_taken = 0;
+static _Atomic int st_running;
+
+void *st_write_side(void *ptr)
 {
-	shell_add_cmd(&dbt_cmd);
-	dbt_log_buf[0] = dbt_log_buf[1] = bars;
+	dbt_span_begin(DBT_MAKE_TAG(0, 'S', 'T', 'W'));
+	tt_write_side(ptr);
+	dbt_span_end(DBT_MAKE_TAG(0, 'S', 'T', 'W'));
+	atomic_fetch_sub(&st_running, 1);
 
 	return 0;
 }
 
+static int st_sink(const uint8_t *buf, uint16_t len)
+{
+	if(++st_calls % 7 == 0) return -1;
+	if(st_calls % 50 == 0) fputs("console text\r\n", stdout);
+	if(st_drop && ++st_taken % st_drop == 0) return 0;
 
-#ifdef SA_CONSOLE_BUILD
+	fwrite(buf, 1, len, stdout);
 
-#include <stdio.h>
+	return 0;
+}
+
+int st_stream()
+{
+	pthread_t writers[TT_MAX_THREADS];
+	int id;
+
+	dbt_stream_start(st_sink);
+
+	st_running = tt_threads;
+	for(id = 0; id < tt_threads; id++) {
+		if(pthread_create(&writers[id], NULL, st_write_side, (void*) (intptr_t) id) != 0) {
+			fprintf(stderr, "couldn't start writer %d\n", id);
+			return -1;
+		}
+	}
+
+	while(st_running) {
+		dbt_stream_poll();
+		sched_yield();
+	}
+	for(id = 0; id < tt_threads; id++) pthread_join(writers[id], NULL);
+	while(dbt_stream_poll() > 0);
+
+	fflush(stdout);
+	fprintf(stderr, "st: %u frames, %u records, %u bytes, %.1f bytes a record, %u words lost, %u stalls\n",
+			dbt_stream.ds_frames, dbt_stream.ds_records, dbt_stream.ds_bytes,
+			(double) dbt_stream.ds_bytes / dbt_stream.ds_records, dbt_stream.ds_lost,
+			dbt_stream.ds_stalls);
+
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
 	DBT_log_entry dbt;
 
+	if(argc >= 2 && *argv[1] == '-' && *(argv[1]+1) == 't') {
+		if(argc >= 3) tt_threads = atoi(argv[2]);
+		if(argc >= 4) tt_records = atoi(argv[3]);
+		if(tt_threads < 1 || tt_threads > TT_MAX_THREADS) tt_threads = TT_MAX_THREADS;
+		exit(tt_torture());
+	}
+
+	/*
+	 * console/dbt -p file, the trace the last run left in file, then some of
+	 * this run's, run it twice
+	 */
+
+	if(argc >= 3 && *argv[1] == '-' && *(argv[1]+1) == 'p') {
+		int run = 0;
+
+		if(dbt_init_file(argv[2], 0x10000) < 0) {
+			perror(argv[2]);
+			exit(-1);
+		}
+		if(dbt_print_prev(5, PRINT_DIRECTION_FORWARD) < 0) printf("no run before\n");
+		else printf("\n");
+
+		dbt_set_mask(DBT_BIT_TIMER);
+		for(run = 0; run < 5; run++) DBT_2_U32(DBT_BIT_TIMER, getpid(), run);
+		exit(0);
+	}
+
+	if(argc >= 2 && *argv[1] == '-' && *(argv[1]+1) == 's') {
+		tt_threads = 2;
+		tt_records = 2000;
+		if(argc >= 3) tt_threads = atoi(argv[2]);
+		if(argc >= 4) tt_records = atoi(argv[3]);
+		if(argc >= 5) st_drop = atoi(argv[4]);
+		if(tt_threads < 1 || tt_threads > TT_MAX_THREADS) tt_threads = TT_MAX_THREADS;
+		exit(st_stream());
+	}
+
 	dbt.u32[0] = 0xdeadbeef;
 	dbt.u32[1] = 0xdeadbeef;
 	dbt.u32[2] = 0xdeadbeef;
@@ -324,6 +2320,296 @@ int main(int argc, char *argv[])
 	dbt_print(5, PRINT_DIRECTION_BACKWARD);
 	printf("\n");
 
+	/*
+	 * descriptor trace points, the legacy macros and enough records to wrap
+	 */
+
+	static DBT_DESC(test_desc, DBT_MAKE_TAG(0, 'T', 'S', 'T'),
+		DBT_FIELD(DBT_FT_U32, "count"), DBT_FIELD(DBT_FT_S32, "delta"),
+		DBT_FIELD(DBT_FT_X64, "addr"), DBT_FIELD(DBT_FT_CHR4, "name"));
+	static DBT_DESC(event_desc, DBT_MAKE_TAG(0, 'E', 'V', 'T'));
+	int ii;
+
+	dbt_set_mask(DBT_BIT_TIMER);
+
+	DBT_TRACE(DBT_BIT_TIMER, test_desc, 42, (uint32_t) -7, DBT_U64_WORDS(0x123456789abcdef0ULL),
+			DBT_U8_TO_U32('a', 'b', 'c', 'd'));
+	DBT_TRACE(DBT_BIT_0x01, test_desc, 1, 2, 3, 4, 5);		// masked off
+	DBT_EVENT(DBT_BIT_TIMER, event_desc);
+	DBT_4_U32(DBT_BIT_TIMER, 1, 2, 3, 4);
+	DBT_2_U32(DBT_BIT_TIMER, 5, 6);
+	DBT_2_U64(DBT_BIT_TIMER, 0x1111111122222222ULL, 7);
+	DBT_1_U64(DBT_BIT_TIMER, 8);
+
+	dbt_print(7, PRINT_DIRECTION_FORWARD);
+	dbt_print(7, PRINT_DIRECTION_BACKWARD);
+	printf("\n");
+
+	for(ii = 0; ii < 1000; ii++)
+		DBT_TRACE(DBT_BIT_TIMER, test_desc, ii, -ii, DBT_U64_WORDS(ii), DBT_U8_TO_U32('w', 'r', 'a', 'p'));
+	DBT_2_U32(DBT_BIT_TIMER, 0xaa, 0xbb);
+
+	dbt_print(3, PRINT_DIRECTION_FORWARD);
+	dbt_print(3, PRINT_DIRECTION_BACKWARD);
+	printf("\n");
+
+	// jump the clock more than a high word, a sync record goes in and the
+	// times on both sides of it still come out right
+
+	extern uint64_t dbt_time_skew;
+
+	dbt_time_skew += (3ULL << 32) + 5000;
+	DBT_2_U32(DBT_BIT_TIMER, 0xcc, 0xdd);
+
+	dbt_print(4, PRINT_DIRECTION_FORWARD);
+	dbt_print(4, PRINT_DIRECTION_BACKWARD);
+	printf("\n");
+
+	// a record from another thread goes in its own ring, the dump merges it
+	// in between the main thread's
+
+	pthread_t other;
+
+	DBT_2_U32(DBT_BIT_TIMER, 0xee, 1);
+	pthread_create(&other, NULL, demo_other_thread, NULL);
+	pthread_join(other, NULL);
+	DBT_2_U32(DBT_BIT_TIMER, 0xee, 3);
+
+	dbt_print(3, PRINT_DIRECTION_FORWARD);
+	dbt_print(3, PRINT_DIRECTION_BACKWARD);
+	printf("\n");
+
+	// asking for more than the log holds prints what is whole
+
+	dbt_print(1000, PRINT_DIRECTION_FORWARD);
+	printf("\n");
+
+	/*
+	 * the rings in a caller's arena: too small and unaligned are refused,
+	 * an odd size rounds down to a power of two, and a bigger ring keeps
+	 * more history
+	 */
+
+	static uint32_t arena[DBT_RINGS * 1024];
+	int words;
+
+	if(dbt_init(arena, DBT_RINGS * DBT_RING_MIN * 4 - 4) != -1
+			|| dbt_init((char*) arena + 2, sizeof(arena) - 4) != -1) {
+		printf("dbt_init took a bad arena\n");
+		return -1;
+	}
+
+	words = dbt_init(arena, DBT_RINGS * 100 * 4);
+	printf("arena of %d words a ring\n", words);
+	for(ii = 0; ii < 100; ii++) DBT_2_U32(DBT_BIT_TIMER, 0x64, ii);
+	dbt_print(2, PRINT_DIRECTION_FORWARD);
+
+	words = dbt_init(arena, sizeof(arena));
+	printf("arena of %d words a ring\n", words);
+	for(ii = 0; ii < 100; ii++) DBT_2_U32(DBT_BIT_TIMER, 0x400, ii);
+	dbt_print(1000, PRINT_DIRECTION_FORWARD);
+	printf("\n");
+
+	/*
+	 * triggers: expressions compile or are refused, then capture starts at
+	 * a == 10, and the stop at a == 50, with 5 kept before it, keeps 3 more
+	 * and freezes, so 10 to 53 are in the rings and no more
+	 */
+
+	static char *good_expr[] = { "tag=TST", "and", "!f0>=5", "or", "s1<-3", "and", "id=7" };
+	static char *bad_exprs[][2] = {
+		{ "tag=TS", 0 }, { "f0", 0 }, { "f0>", 0 }, { "f99==1", 0 }, { "x1==2", 0 },
+		{ "f0==1", "and" }, { "f0==1", "f1==2" },
+	};
+	uint32_t prog[DBT_PROG_MAX], tst_words[2] = { 4, (uint32_t) -4 };
+	uint32_t no_words[2] = { 6, (uint32_t) -2 }, id7_words[2] = { 6, (uint32_t) -4 };
+	DBT_merge merge;
+	int rr, first = -1, last = -1, kept = 0;
+
+	if(dbt_trig_compile(7, good_expr, prog) != 12
+			|| !dbt_prog_eval(prog, DBT_DESC_ID(test_desc), tst_words, 2)
+			|| dbt_prog_eval(prog, DBT_DESC_ID(event_desc), tst_words, 2)
+			|| dbt_prog_eval(prog, DBT_DESC_ID(test_desc), no_words, 2)
+			|| dbt_prog_eval(prog, 7, no_words, 2)
+			|| !dbt_prog_eval(prog, 7, id7_words, 2)) {
+		printf("good expression wrong\n");
+		return -1;
+	}
+	for(ii = 0; ii < sizeof(bad_exprs) / sizeof(bad_exprs[0]); ii++) {
+		if(dbt_trig_compile(bad_exprs[ii][1] ? 2 : 1, bad_exprs[ii], prog) >= 0) {
+			printf("bad expression %d taken\n", ii);
+			return -1;
+		}
+	}
+
+	uint32_t start[] = { DBT_P_CMP(DBT_OP_EQ, 0, 10) };
+	uint32_t stop[] = { DBT_P_CMP(DBT_OP_EQ, 0, 50) };
+
+	dbt_init(arena, sizeof(arena));
+	dbt_trig_set(dbt_trig.dt_start, start, 2);
+	dbt_trig_set(dbt_trig.dt_stop, stop, 2);
+	dbt_trig_set(dbt_trig.dt_filter, 0, 0);
+	dbt_trig.dt_pre = 5;
+	dbt_trig.dt_post = 3;
+	dbt_trig_arm();
+	for(ii = 0; ii < 100; ii++) DBT_2_U32(DBT_BIT_TIMER, ii, 0);
+
+	dbt_merge_init(&merge, dbt_rings);
+	while((rr = dbt_merge_pick(&merge, 1)) >= 0) {
+		if(last < 0) last = merge.dm_walk[rr].dw_rec[DBT_REC_ARGS];
+		if(DBT_HDR_ID(merge.dm_walk[rr].dw_rec[0]) != DBT_DESC_ID(dbt_desc_time)) {
+			first = merge.dm_walk[rr].dw_rec[DBT_REC_ARGS];
+			kept++;
+		}
+		dbt_merge_step(&merge, rr, 1);
+	}
+	if(first != 10 || last != 53 || kept != 44 || dbt_trig.dt_count != 44
+			|| dbt_trig.dt_state != DBT_TRIG_FROZEN) {
+		printf("trigger kept %d, %d to %d\n", kept, first, last);
+		return -1;
+	}
+	dbt_trig_cmd(0, 0);
+	dbt_print(3, PRINT_DIRECTION_FORWARD);
+	dbt_trig_off();
+	printf("\n");
+
+	/*
+	 * spans: two nested and an end without a begin.  The depths and times
+	 * must come out the same printed forward and backward.
+	 */
+
+	static const int span_depth[7] = { 0, 1, 1, 2, 1, 0, 0 };
+	uint32_t span_recs[7][DBT_REC_MAX];
+	uint64_t span_times[7], span_fwd[7], span_bwd[7];
+	DBT_span_view view;
+
+	DBT_SPAN_BEGIN(DBT_BIT_TIMER, DBT_MAKE_TAG(0, 'O', 'U', 'T'));
+	DBT_2_U32(DBT_BIT_TIMER, 0x5a, 1);
+	DBT_SPAN_BEGIN(DBT_BIT_TIMER, DBT_MAKE_TAG(0, 'I', 'N', ' '));
+	DBT_2_U32(DBT_BIT_TIMER, 0x5a, 2);
+	DBT_SPAN_END(DBT_BIT_TIMER, DBT_MAKE_TAG(0, 'I', 'N', ' '));
+	DBT_SPAN_END(DBT_BIT_TIMER, DBT_MAKE_TAG(0, 'O', 'U', 'T'));
+	DBT_SPAN_END(DBT_BIT_TIMER, DBT_MAKE_TAG(0, 'O', 'U', 'T'));
+
+	dbt_merge_init(&merge, dbt_rings);
+	for(ii = 6; ii >= 0; ii--) {
+		if((rr = dbt_merge_pick(&merge, 1)) < 0) break;
+		memcpy(span_recs[ii], merge.dm_walk[rr].dw_rec, sizeof(span_recs[ii]));
+		span_times[ii] = dbt_merge_time(&merge, rr);
+		dbt_merge_step(&merge, rr, 1);
+	}
+
+	memset(&view, 0, sizeof(view));
+	for(ii = 0; ii < 7; ii++)
+		if(dbt_span_view(&view, 0, span_recs[ii], span_times[ii], 0, &span_fwd[ii]) != span_depth[ii])
+			break;
+	memset(&view, 0, sizeof(view));
+	for(rr = 6; rr >= 0 && ii == 7; rr--)
+		if(dbt_span_view(&view, 0, span_recs[rr], span_times[rr], 1, &span_bwd[rr]) != span_depth[rr])
+			ii = -1;
+
+	if(ii != 7 || span_fwd[4] != span_times[4] - span_times[2] || span_fwd[5] != span_times[5] - span_times[0]
+			|| span_fwd[6] != DBT_NO_DELTA || span_bwd[2] != span_fwd[4] || span_bwd[0] != span_fwd[5]
+			|| span_bwd[4] != DBT_NO_DELTA || span_bwd[6] != DBT_NO_DELTA) {
+		printf("spans paired wrong\n");
+		return -1;
+	}
+	dbt_print(7, PRINT_DIRECTION_FORWARD);
+	dbt_print(7, PRINT_DIRECTION_BACKWARD);
+	printf("\n");
+
+	/*
+	 * statistics: counts, values, a timed section and the histogram, then
+	 * threads adding at once must come out exact.  Nothing goes in the rings.
+	 */
+
+	static DBT_STAT(hit_stat, DBT_MAKE_TAG(0, 'H', 'I', 'T'), "hits");
+	static DBT_STAT(len_stat, DBT_MAKE_TAG(0, 'L', 'E', 'N'), "bytes");
+	static DBT_STAT(time_stat, DBT_MAKE_TAG(0, 'T', 'I', 'M'), "ns");
+	uint32_t state_before = dbt_rings[0].dr_state;
+
+	for(ii = 0; ii < 5; ii++) DBT_STAT_COUNT(DBT_BIT_TIMER, hit_stat);
+	DBT_STAT_COUNT(DBT_BIT_0x01, hit_stat);			// masked off
+	DBT_STAT_VALUE(DBT_BIT_TIMER, len_stat, 0);
+	DBT_STAT_VALUE(DBT_BIT_TIMER, len_stat, 1);
+	DBT_STAT_VALUE(DBT_BIT_TIMER, len_stat, 3);
+	DBT_STAT_VALUE(DBT_BIT_TIMER, len_stat, 4);
+	DBT_STAT_VALUE(DBT_BIT_TIMER, len_stat, 0xffffffff);
+	DBT_STAT_VALUE(DBT_BIT_TIMER, len_stat, 0xffffffff);
+	{
+		DBT_STAT_BEGIN(DBT_BIT_TIMER, start);
+		DBT_STAT_END(DBT_BIT_TIMER, time_stat, start);
+	}
+
+	if(hit_stat.ds_count != 5 || len_stat.ds_count != 6 || len_stat.ds_min != 0
+			|| len_stat.ds_max != 0xffffffff || len_stat.ds_sum_hi != 2
+			|| len_stat.ds_sum_lo != 6 || len_stat.ds_hist[0] != 1 || len_stat.ds_hist[1] != 1
+			|| len_stat.ds_hist[2] != 1 || len_stat.ds_hist[3] != 1 || len_stat.ds_hist[32] != 2
+			|| time_stat.ds_count != 1 || dbt_rings[0].dr_state != state_before) {
+		printf("statistics wrong\n");
+		return -1;
+	}
+	dbt_stats_print();
+	if(len_stat.ds_count || len_stat.ds_hist[32] || len_stat.ds_min != 0xffffffff) {
+		printf("statistics not cleared\n");
+		return -1;
+	}
+
+	pthread_t stat_threads[4];
+
+	for(ii = 0; ii < 4; ii++) pthread_create(&stat_threads[ii], NULL, stat_side, &len_stat);
+	for(ii = 0; ii < 4; ii++) pthread_join(stat_threads[ii], NULL);
+	if(len_stat.ds_count != 400000 || len_stat.ds_sum_lo != 4 * 100000 * 99999ULL / 2 % 0x100000000ULL
+			|| len_stat.ds_sum_hi != 4 * 100000 * 99999ULL / 2 / 0x100000000ULL
+			|| len_stat.ds_max != 99999 || len_stat.ds_min != 0) {
+		printf("statistics from threads wrong\n");
+		return -1;
+	}
+	dbt_stats_print();
+	printf("\n");
+
+	/*
+	 * resets with the rings in a file: what was traced before one is
+	 * dbt_prev_rings after it, the run after writes the other bank, and a
+	 * spoiled header means there was no run before
+	 */
+
+	char path[] = "/tmp/dbt_persistXXXXXX";
+	int fd;
+
+	if((fd = mkstemp(path)) < 0) return -1;
+	close(fd);
+
+	if(dbt_init_file(path, 0x10000) < 0 || dbt_prev_rings) {
+		printf("new file has a run before\n");
+		return -1;
+	}
+	for(ii = 0; ii < 10; ii++) DBT_2_U32(DBT_BIT_TIMER, 0x9e, ii);
+
+	if(dbt_init_file(path, 0x10000) < 0 || dbt_prev_rings == 0) {
+		printf("trace lost in the reset\n");
+		return -1;
+	}
+	printf("before the reset\n");
+	dbt_print_prev(3, PRINT_DIRECTION_FORWARD);
+	printf("after\n");
+	dbt_print(3, PRINT_DIRECTION_FORWARD);
+	DBT_2_U32(DBT_BIT_TIMER, 0x9e, 100);
+
+	dbt_init_file(path, 0x10000);
+	printf("before the second reset\n");
+	dbt_print_prev(3, PRINT_DIRECTION_FORWARD);
+
+	fd = open(path, O_RDWR);
+	if(fd < 0 || pwrite(fd, "x", 1, 5) != 1) return -1;
+	close(fd);
+	if(dbt_init_file(path, 0x10000) < 0 || dbt_prev_rings) {
+		printf("spoiled header taken\n");
+		return -1;
+	}
+	unlink(path);
+
+	return 0;
 
 }
 
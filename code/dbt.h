@@ -28,21 +28,24 @@
 #define _DBT_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include "micro_types.h"
 
 typedef Type128 DBT_log_entry;
 
 /**
- * the debug trace log is a rolling log of 16 byte records.
+ * the debug trace log is a rolling log of variable length records.
  * the log forms a time sequential record of events.
- * by convention, the first 4 bytes are a "tag", a 3 byte ASCII identifier and
- * a formatting indicator.
+ * each trace point has a descriptor, built at compile time and kept in the
+ * dbt_desc linker section, that gives its tag and the type and name of each
+ * field.  By convention the tag is a 3 byte ASCII identifier and a formatting
+ * indicator, see DBT_MAKE_TAG.
  * the tag is assigned to a module or functional area, eg, TCP for a piece of a 
  * TCP / IP stack or U_A for a UART A or TM1 for timer 1, etc.
- * the next twelve bytes can be formatted in many ways.
- * the idea is to do this formatting, as much as possible, at compile time.
- * That way a small number of values can be added to the debug record and
- * the whole thing written to memory in as efficient a way as possible.
+ * a record in the log is a header word, holding the descriptor's index in the
+ * section, a timestamp word and the raw argument words.  Nothing is formatted until the
+ * log is dumped, dbt_print decodes each record by its descriptor.
  * The conents of the rolling log can be dumped out in reverse or forward 
  * order.
  * The log contains a stop record to show the current insertion point.
@@ -51,7 +54,6 @@ typedef Type128 DBT_log_entry;
  * tracing with minimal impact.
  */
 
-
 // macros for encoding four ascii bytes into a word
 
 // little endian, reverse order for big endian
@@ -112,12 +114,401 @@ typedef Type128 DBT_log_entry;
 #define DBT_BIT_0x1f		(((uint32_t)1)<<0x1f)
 
 
+/**
+ * trace point descriptors
+ *
+ * static DBT_DESC(tim2_desc, DBT_MAKE_TAG(0, 'T', 'M', '2'),
+ * 	DBT_FIELD(DBT_FT_U32, "count"), DBT_FIELD(DBT_FT_X32, "sr"));
+ *
+ * DBT_TRACE(DBT_BIT_TIMER, tim2_desc, count, TIM2->SR);
+ *
+ * DBT_TRACE takes one 32 bit word per 32 bit field, a 64 bit field takes
+ * DBT_U64_WORDS(val), which uses val twice.  DBT_EVENT is a trace point with
+ * no fields.
+ *
+ * The descriptor's index in the dbt_desc section is its id, the section must
+ * be kept together and in order.  GNU ld defines __start_dbt_desc and
+ * __stop_dbt_desc for it on the host and on the target.  With --gc-sections, or
+ * to place it, the STM32 linker script wants, next to .rodata,
+ *
+ * 	.dbt_desc : ALIGN(32)
+ * 	{
+ * 		__start_dbt_desc = .;
+ * 		KEEP(*(dbt_desc))
+ * 		__stop_dbt_desc = .;
+ * 	} >FLASH
+ */
+
+enum {
+	DBT_FT_NONE = 0,		// end of the field list
+	DBT_FT_X32,			// hex
+	DBT_FT_U32,			// unsigned decimal
+	DBT_FT_S32,			// signed decimal
+	DBT_FT_X64,			// hex, two words, low word first
+	DBT_FT_TAG,			// a DBT_MAKE_TAG word, printed as its 3 ASCII bytes
+	DBT_FT_CHR4,			// 4 ASCII bytes
+};
+
+#define DBT_MAX_FIELDS		(6)
+#define DBT_MAX_WORDS		(12)		// argument words in one record
+
+typedef struct _dbt_field {
+	uint8_t df_type;		// DBT_FT_*
+	const char *df_name;
+} DBT_field;
+
+// aligned so every descriptor in the section is the same size, no padding between
+
+typedef struct __attribute__((aligned(32))) _dbt_desc {
+	uint32_t dd_tag;		// DBT_MAKE_TAG, 0 for none
+	DBT_field dd_fields[DBT_MAX_FIELDS];
+} DBT_desc;
+
+#define DBT_DESC_SECTION __attribute__((section("dbt_desc"), used))
+
+#define DBT_FIELD(type, name) { (type), (name) }
+#define DBT_DESC(name, tag, ...) \
+	const DBT_desc name DBT_DESC_SECTION = { (tag), { __VA_ARGS__ } }
+
+extern const DBT_desc __start_dbt_desc[];
+extern const DBT_desc __stop_dbt_desc[];
+
+#define DBT_DESC_ID(desc) ((uint16_t) (&(desc) - __start_dbt_desc))
+
+#define DBT_U64_WORDS(val) ((uint32_t) (val)), ((uint32_t) (((uint64_t) (val)) >> 32))
+
+#define DBT_TRACE(dbtbit, desc, ...) do { \
+	if(dbt_global_mask & (dbtbit)) { \
+		const uint32_t _dbt_words[] = { __VA_ARGS__ }; \
+		dbt_write_words(DBT_DESC_ID(desc), _dbt_words, \
+				sizeof(_dbt_words) / sizeof(_dbt_words[0])); \
+	} \
+} while(0)
+
+#define DBT_EVENT(dbtbit, desc) do { \
+	if(dbt_global_mask & (dbtbit)) dbt_write_words(DBT_DESC_ID(desc), 0, 0); \
+} while(0)
+
+/**
+ * spans, a pair of records around a stretch of code
+ *
+ * DBT_SPAN_BEGIN(DBT_BIT_TIMER, DBT_MAKE_TAG(0, 'U', 'S', '1'));
+ * ...
+ * DBT_SPAN_END(DBT_BIT_TIMER, DBT_MAKE_TAG(0, 'U', 'S', '1'));
+ *
+ * each record holds the tag and the depth, spans nest in each context.
+ * dbt_print indents a context's records by its depth and gives a span's
+ * time on the one of the pair it prints second, up to DBT_SPAN_DEPTH deep.
+ * A return between the two wants its own DBT_SPAN_END.  On the host the
+ * depth is each thread's, but the printer pairs by ring, so with more
+ * threads than rings the indents and times of spans that overlap in a
+ * shared ring can be off.
+ */
+
+#define DBT_SPAN_DEPTH		(8)
+
+#define DBT_SPAN_BEGIN(dbtbit, tag) do { \
+	if(dbt_global_mask & (dbtbit)) dbt_span_begin(tag); \
+} while(0)
+
+#define DBT_SPAN_END(dbtbit, tag) do { \
+	if(dbt_global_mask & (dbtbit)) dbt_span_end(tag); \
+} while(0)
+
+extern void dbt_span_begin(uint32_t tag);
+extern void dbt_span_end(uint32_t tag);
+
+/**
+ * statistics, counted in place of a record
+ *
+ * static DBT_STAT(isr_stat, DBT_MAKE_TAG(0, 'T', 'M', '2'), "ticks");
+ *
+ * DBT_STAT_COUNT(DBT_BIT_TIMER, isr_stat);		// a hit, no value
+ * DBT_STAT_VALUE(DBT_BIT_TIMER, isr_stat, len);		// a hit and its value
+ *
+ * DBT_STAT_BEGIN(DBT_BIT_TIMER, start);		// how long it takes
+ * ...
+ * DBT_STAT_END(DBT_BIT_TIMER, isr_stat, start);		// in dbt_time() ticks
+ *
+ * each entry keeps the hits and the min, max, sum and a log2 histogram of
+ * the values: bucket 0 counts zeros, bucket n values from 2^(n-1) to
+ * 2^n - 1.  Nothing goes in the rings.  Updates are lock-free, a reader
+ * can catch the sum between its words, "dbtrace stats" prints the table
+ * and clears it.
+ *
+ * the entries live in the dbt_stat section and are initialized data, the
+ * tag, the unit and ds_min = ~0.  The STM32 startup code only copies .data
+ * from flash, so the section has to go inside .data, between _sdata and
+ * _edata, in the linker script,
+ *
+ * 	.data :
+ * 	{
+ * 		_sdata = .;
+ * 		*(.data)
+ * 		*(.data*)
+ * 		. = ALIGN(32);
+ * 		__start_dbt_stat = .;
+ * 		KEEP(*(dbt_stat))
+ * 		__stop_dbt_stat = .;
+ * 		. = ALIGN(4);
+ * 		_edata = .;
+ * 	} >RAM AT> FLASH
+ *
+ * an orphan dbt_stat section gets no copy and starts as garbage.
+ */
+
+#define DBT_STAT_BUCKETS	(33)
+
+typedef struct __attribute__((aligned(32))) _dbt_stat {
+	uint32_t ds_tag;		// DBT_MAKE_TAG
+	const char *ds_unit;		// what the value is
+	_Atomic uint32_t ds_count;
+	_Atomic uint32_t ds_min;
+	_Atomic uint32_t ds_max;
+	_Atomic uint32_t ds_sum_lo;
+	_Atomic uint32_t ds_sum_hi;
+	_Atomic uint32_t ds_hist[DBT_STAT_BUCKETS];
+} DBT_stat;
+
+#define DBT_STAT_SECTION __attribute__((section("dbt_stat"), used))
+
+#define DBT_STAT(name, tag, unit) \
+	DBT_stat name DBT_STAT_SECTION = { .ds_tag = (tag), .ds_unit = (unit), .ds_min = ~(uint32_t) 0 }
+
+// weak, a program without a DBT_STAT has no section
+
+extern DBT_stat __start_dbt_stat[] __attribute__((weak));
+extern DBT_stat __stop_dbt_stat[] __attribute__((weak));
+
+extern void dbt_stat_value(DBT_stat *stat, uint32_t val);
+extern void dbt_stat_clear(DBT_stat *stat);
+
+#define DBT_STAT_COUNT(dbtbit, stat) do { \
+	if(dbt_global_mask & (dbtbit)) \
+		atomic_fetch_add_explicit(&(stat).ds_count, 1, memory_order_relaxed); \
+} while(0)
+
+#define DBT_STAT_VALUE(dbtbit, stat, val) do { \
+	if(dbt_global_mask & (dbtbit)) dbt_stat_value(&(stat), (uint32_t) (val)); \
+} while(0)
+
+#define DBT_STAT_BEGIN(dbtbit, start) \
+	uint32_t start = (dbt_global_mask & (dbtbit)) ? (uint32_t) dbt_time() : 0
+
+#define DBT_STAT_END(dbtbit, stat, start) \
+	DBT_STAT_VALUE(dbtbit, stat, (uint32_t) dbt_time() - (start))
+
+/**
+ * ring format, a power of two number of 32 bit words
+ *
+ * header: id in the low 16 bits, record length in words, header included, in
+ * the next 4, the length of the record before it in the next 4 and the lap,
+ * the low 8 bits of the ring's free running index / ring size, in the top 8.
+ * The previous length chains the records backward from the insertion point,
+ * the lap tells a header from whatever the last lap left in that word.
+ *
+ * timestamp: the low 32 bits of dbt_time() when the record was written.
+ * A sync record, dbt_desc_time, with the full time and the low byte of the
+ * previous record's high word goes in ahead of a record when the high word
+ * moves, when the ring is empty and at every half ring.  Between syncs the high
+ * word doesn't change, so every time is rebuilt from the newest sync, exactly
+ * unless two records are more than 256 high words apart, about 18 minutes on
+ * the host and 4 hours at 72 MHz.
+ *
+ * dbt_time() counts DWT cycles on the target, CLOCK_MONOTONIC nanoseconds on
+ * the host, DBT_TICKS_PER_US converts.  On the target it must be called at
+ * least once per half CYCCNT wrap, about 30 seconds at 72 MHz, to keep the
+ * high word.
+ *
+ * writers, from any thread or interrupt, reserve with a compare and swap on
+ * dr_state, see dbt.c, then write the record under a DBT_ID_BUSY header and
+ * store the real header last.  A reader sees a record whole, busy, or not at
+ * all.
+ */
+
+#define DBT_HDR(id, len, prev, lap) \
+	((uint32_t) (id) | (((uint32_t) (len)) << 16) | (((uint32_t) (prev)) << 20) \
+	 | (((uint32_t) (uint8_t) (lap)) << 24))
+#define DBT_HDR_ID(hdr)		((uint16_t) ((hdr) & 0xffff))
+#define DBT_HDR_LEN(hdr)	(((hdr) >> 16) & 0xf)
+#define DBT_HDR_PREV(hdr)	(((hdr) >> 20) & 0xf)
+#define DBT_HDR_LAP(hdr)	((uint8_t) ((hdr) >> 24))
+
+#define DBT_ID_BUSY		(0xfffe)
+
+#define DBT_REC_TS		(1)		// timestamp word offset
+#define DBT_REC_ARGS		(2)		// first argument word offset
+#define DBT_REC_MAX		(DBT_REC_ARGS + DBT_MAX_WORDS)
+
+extern const DBT_desc dbt_desc_time;		// sync: now lo, now hi, previous hi8
+#define DBT_SYNC_LEN		(DBT_REC_ARGS + 3)
+
+typedef struct _dbt_ring {
+	uint32_t *dr_buf;
+	uint16_t dr_size;		// words, a power of two, 0 for no ring
+	_Atomic uint32_t dr_state;	// insertion index, newest length, newest hi8
+} DBT_ring;
+
+// a half ring holds the biggest record and its sync, the index wraps at 0x10000
+
+#define DBT_RING_MIN		(64)
+#define DBT_RING_MAX		(0x8000)
+
+/**
+ * one ring per context, thread mode and interrupt priority bands on the
+ * target, threads on the host.  dbt_write_words() writes the caller's,
+ * dbt_print() merges them by time.
+ */
+
+extern DBT_ring *dbt_rings;
+extern const int dbt_num_rings;
+extern DBT_ring *dbt_ring_select();
+extern int dbt_init(void *arena, size_t bytes);
+
+/**
+ * rings that survive a reset, the arena in memory startup doesn't clear,
+ * see DBT_NOINIT_WORDS in dbt.c.  dbt_prev_rings is the run before's, 0 if
+ * the arena held none, "dbtrace prev" prints it.  On the host
+ * dbt_init_file() maps a file for the arena.  tools/dbt_decode -r reads
+ * an image of the arena, read out by the debugger after a crash.
+ */
+
+extern DBT_ring *dbt_prev_rings;
+extern int dbt_init_persist(void *arena, size_t bytes);
+extern int dbt_init_file(const char *path, size_t bytes);
+
+#ifdef CONSOLE_BUILD
+#define DBT_TICKS_PER_US	(1000)
+#else
+#define DBT_TICKS_PER_US	(SystemCoreClock / 1000000)
+#endif // CONSOLE_BUILD
+
+extern uint64_t dbt_time();
+extern void dbt_time_init();
+
+/**
+ * capture triggers, a logic analyzer on the trace
+ *
+ * 	start	nothing is kept until a record matches
+ * 	filter	after that only matching records are kept
+ * 	stop	once pre records are kept, a match keeps post more, then the
+ * 		rings freeze and later records are dropped
+ *
+ * the programs are run by the writer on the record's id and words, before it
+ * takes any space.  They are reverse polish, a compare pushes a bit, e.g.,
+ *
+ * 	tag TM2 and field 1 > 100
+ * 	uint32_t prog[] = { DBT_P_TAG('T', 'M', '2'), DBT_P_CMP(DBT_OP_GT, 1, 100), DBT_OP_AND };
+ *
+ * A field past the end of the record compares false.  From the shell,
+ * "dbtrace trig stop tag=TM2 and f1>100" compiles the same.  Programs are
+ * changed with dbt_trig_set() while the engine is off, then dbt_trig_arm().
+ */
+
+enum {
+	DBT_OP_END = 0,
+	DBT_OP_AND,
+	DBT_OP_OR,
+	DBT_OP_NOT,
+	DBT_OP_ID,		// next word is the id
+	DBT_OP_TAG,		// next word is a DBT_MAKE_TAG, the print option ignored
+	DBT_OP_EQ = 8,		// compares, field in bits 8-15, next word the value
+	DBT_OP_NE,
+	DBT_OP_LT,
+	DBT_OP_LE,
+	DBT_OP_GT,
+	DBT_OP_GE,
+};
+
+#define DBT_OP_SIGNED		(0x10)
+#define DBT_OP_CODE(op)		((op) & 0xf)
+#define DBT_OP_FIELD(op)	(((op) >> 8) & 0xff)
+#define DBT_TAG_MASK		(0xffffff00)
+
+#define DBT_P_ID(desc)			DBT_OP_ID, DBT_DESC_ID(desc)
+#define DBT_P_TAG(a, b, c)		DBT_OP_TAG, DBT_MAKE_TAG(0, (a), (b), (c))
+#define DBT_P_CMP(code, field, val)	((code) | ((field) << 8)), ((uint32_t) (val))
+#define DBT_P_SCMP(code, field, val)	((code) | DBT_OP_SIGNED | ((field) << 8)), ((uint32_t) (val))
+
+#define DBT_PROG_MAX		(24)		// words, DBT_OP_END included
+
+enum {
+	DBT_TRIG_OFF = 0,	// everything is kept
+	DBT_TRIG_WAIT,		// for start
+	DBT_TRIG_RUN,		// filtering, for stop
+	DBT_TRIG_POST,		// keeping post records
+	DBT_TRIG_FROZEN,
+};
+
+typedef struct _dbt_trig {
+	_Atomic uint32_t dt_state;
+	uint32_t dt_start[DBT_PROG_MAX];
+	uint32_t dt_filter[DBT_PROG_MAX];
+	uint32_t dt_stop[DBT_PROG_MAX];
+	uint32_t dt_pre;
+	int32_t dt_post;
+	_Atomic uint32_t dt_count;	// kept since start
+	_Atomic int32_t dt_left;	// of post
+	_Atomic uint32_t dt_dropped;
+} DBT_trig;
+
+extern DBT_trig dbt_trig;
+extern void dbt_trig_arm();
+extern void dbt_trig_off();
+extern int dbt_trig_set(uint32_t *which, const uint32_t *prog, int len);
+extern int dbt_trig_compile(int argc, char *argv[], uint32_t *prog);
+
+/**
+ * streaming, the rings drained in binary in the background
+ *
+ * dbt_stream_start(0) sends to usart1_tx_fifo, then dbt_stream_poll(), a
+ * shell poll hook, sends what it can each time round.  Frames, see frame.h,
+ * have a payload of at most DBT_FRAME_MAX bytes, little endian:
+ *
+ * 	type, ring, sequence (16 bits, every frame)
+ * 	'I' info: version, number of rings, ticks per microsecond (32 bits)
+ * 	'D' descriptor: id (16), tag (32), per field: type, name, 0
+ * 	'R' records: words lost (16), time high word (32), whole records
+ *
+ * Records go as they are in the ring, header word first, the header's length
+ * finds the next one.  Sync records aren't sent, every record in a frame has
+ * the frame's high word.  Lost counts the words a ring wrote over before
+ * they were sent, a jump in the sequence is frames lost on the way.
+ * tools/dbt_decode reads the stream back.
+ */
+
+#define DBT_FRAME_MAX		(128)
+#define DBT_FRAME_VERSION	(1)
+
+#define DBT_FRAME_INFO		('I')
+#define DBT_FRAME_DESC		('D')
+#define DBT_FRAME_RECORDS	('R')
+
+#define DBT_FRAME_HDR		(4)		// type, ring, sequence
+#define DBT_FRAME_RECS		(10)		// records start after lost and high
+
+extern int dbt_stream_start(int (*sink)(const uint8_t *buf, uint16_t len));
+extern void dbt_stream_stop();
+extern int dbt_stream_poll();
+
+/**
+ * the original fixed layouts, written through built in descriptors
+ */
+
 #define DBT_4_U32(dbtbit, a, b, c, d) if(dbt_global_mask &(dbtbit)) dbt_write_4_u32((a), (b), (c), (d))
 #define DBT_2_U32(dbtbit, a, b) if(dbt_global_mask &(dbtbit)) dbt_write_2_u32((a), (b))
 #define DBT_2_U64(dbtbit, a, b) if(dbt_global_mask &(dbtbit)) dbt_write_2_u64((a), (b))
 #define DBT_1_U64(dbtbit, a) if(dbt_global_mask &(dbtbit)) dbt_write_1_u64((a))
 
 extern int dbt_write(DBT_log_entry *);
+extern int dbt_write_words(uint16_t id, const uint32_t *words, int nwords);
+extern int dbt_ring_write(DBT_ring *ring, uint16_t id, const uint32_t *words, int nwords);
+extern void dbt_write_4_u32(uint32_t a, uint32_t b, uint32_t c, uint32_t d);
+extern void dbt_write_2_u32(uint32_t a, uint32_t b);
+extern void dbt_write_2_u64(uint64_t a, uint64_t b);
+extern void dbt_write_1_u64(uint64_t a);
+
+extern const DBT_desc *dbt_desc_lookup(uint16_t id);
 
 extern void dbt_set_mask(uint32_t);
 extern void dbt_enable_mask_bit(uint32_t);
@@ -126,21 +517,14 @@ extern void dbt_disable_mask_bit(uint32_t);
 extern uint32_t dbt_global_mask;
 
 /**
- * a tag is used to mark a 
- */
-
-/**
- * for printing, some crude formatting is available
- *
- * if the first byte in a row is zero, then a normal hexdump is done
- * else, the first character is taken as a format key
+ * dbt_write takes a 16 byte record, the first byte picks the layout
  *
  * This is a start, at to it as needed
  */
 
 enum {
-	DBT_DUMP_FORMAT_NONE = 0,		// 16 %c, 16 0x02%x
-	DBT_DUMP_FORMAT_TAG_3xU32,		// 3 ASCII bytes, 3 0x8x, 16 0x02
+	DBT_DUMP_FORMAT_NONE = 0,		// 4 0x%08x
+	DBT_DUMP_FORMAT_TAG_3xU32,		// 3 ASCII bytes, 3 0x8x
 	DBT_DUMP_FORMAT_TAG_3xS32,		// 3 byte tag, 3 signed ints
 };
 
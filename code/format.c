@@ -55,50 +55,44 @@ char* format_x(uint32_t val, int len, char *output_buf)
 }
 
 /*
- * decimal format an integer for output
+ * decimal format an unsigned integer for output
  *
- * responsibility of caller to make sure output_buf is large enough
- * 	to hold output
+ * output_buf must hold at least 11 bytes
  */
 
-char* format_d(int32_t val, char *output_buf)
+char* format_u(uint32_t val, char *output_buf)
 {
-	char *ss;
-	int32_t power;
-
-	ss = output_buf;
-
-	if(val == 0) {
-		*ss++ = '0';
-		*ss = 0;
-		return output_buf;
-	}
-
-	if(val < 0) {
-		val = -val;
-		*ss++ = '-';
-	}
-
-	power = 1;
-
-	while((power * 10) < val) power *= 10;
+	char digits[10];
+	char *ss = output_buf;
+	int nn = 0;
 
 	do {
-		int32_t digit;
-		int32_t remain;
+		digits[nn++] = '0' + (val % 10);
+		val /= 10;
+	} while(val);
 
-		digit = val / power;
-		remain = val % power;
+	while(nn) *ss++ = digits[--nn];
+	*ss = 0;
 
-		*ss++ = '0' + digit;
+	return output_buf;
+}
 
-		power /= 10;
-		val = remain;
-	} while(power > 0);
+/*
+ * decimal format an integer for output
+ *
+ * responsibility of caller to make sure output_buf is large enough
+ * 	to hold output, 12 bytes covers any value
+ */
 
-	*ss = 0;
+char* format_d(int32_t val, char *output_buf)
+{
+	if(val < 0) {
+		output_buf[0] = '-';
+		format_u(-((uint32_t) val), &output_buf[1]);
+		return output_buf;
+	}
 
-	return output_buf;
+	return format_u((uint32_t) val, output_buf);
 }
 
 #ifdef CONSOLE_BUILD
@@ -108,7 +102,7 @@ char* format_d(int32_t val, char *output_buf)
 int main(int argc, char *argv[])
 {
 	uint32_t val;
-	char buf[9];
+	char buf[12];
 
 	val = 0xdeadbeef;
 
@@ -130,5 +124,17 @@ int main(int argc, char *argv[])
 	val = -9123;
 
 	printf("%d: %s\n", val, format_d(val, buf));
+
+	val = 100;
+
+	printf("%d: %s\n", val, format_d(val, buf));
+
+	val = 0x80000000;
+
+	printf("%d: %s\n", val, format_d(val, buf));
+
+	val = 0xffffffff;
+
+	printf("%u: %s\n", val, format_u(val, buf));
 }
 #endif
@@ -25,3 +25,4 @@
 
 extern char* format_x(uint32_t val, int len, char *output_buf);
 extern char *format_d(int32_t val, char *output_buf);
+extern char *format_u(uint32_t val, char *output_buf);
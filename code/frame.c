@@ -0,0 +1,219 @@
+/*
+ * Copyright 2018 Daniel G. Robinson
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software. 
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+/**
+ * @file frame.c
+ * @brief frames binary streams, COBS byte stuffing and a CRC-16, see frame.h
+ * @author Daniel G. Robinson
+ * @date 16 Oct 26
+ */
+
+#include <stdint.h>
+#include "frame.h"
+
+/*
+ * CRC-16/CCITT-FALSE, polynomial 0x1021, start with FRAME_CRC_INIT.
+ * Bitwise, a table costs 512 bytes of flash for speed the UART can't use.
+ */
+
+uint16_t frame_crc16(uint16_t crc, const uint8_t *buf, uint16_t len)
+{
+	int ii;
+
+	while(len--) {
+		crc ^= ((uint16_t) *buf++) << 8;
+		for(ii = 0; ii < 8; ii++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+/*
+ * consistent overhead byte stuffing, each run of up to 254 non zero bytes
+ * goes out behind a code byte, its length + 1, and a code under 0xff stands
+ * for a zero after the run
+ *
+ * returns the bytes put in dst, at most FRAME_COBS_MAX(len)
+ */
+
+uint16_t frame_cobs_encode(const uint8_t *src, uint16_t len, uint8_t *dst)
+{
+	uint8_t *code = dst, *out = dst + 1;
+	uint8_t run = 1;
+
+	while(len--) {
+		if(*src) {
+			*out++ = *src;
+			run++;
+		}
+		src++;
+		if(src[-1] == 0 || run == 0xff) {
+			*code = run;
+			code = out++;
+			run = 1;
+		}
+	}
+	*code = run;
+
+	return (uint16_t) (out - dst);
+}
+
+/*
+ * undo frame_cobs_encode, dst holds len bytes
+ *
+ * returns the bytes put in dst, -1 for a zero byte or a run past the end
+ */
+
+int frame_cobs_decode(const uint8_t *src, uint16_t len, uint8_t *dst)
+{
+	const uint8_t *end = src + len;
+	uint8_t *out = dst;
+	uint8_t code, ii;
+
+	while(src < end) {
+		code = *src++;
+		if(code == 0 || src + code - 1 > end) return -1;
+		for(ii = 1; ii < code; ii++) {
+			if(*src == 0) return -1;
+			*out++ = *src++;
+		}
+		if(code != 0xff && src < end) *out++ = 0;
+	}
+
+	return (int) (out - dst);
+}
+
+/*
+ * payload to wire, payload must have 2 bytes spare after len for the CRC and
+ * wire room for FRAME_WIRE_MAX(len)
+ *
+ * returns the bytes on the wire
+ */
+
+uint16_t frame_encode(uint8_t *payload, uint16_t len, uint8_t *wire)
+{
+	uint16_t crc, wlen;
+
+	crc = frame_crc16(FRAME_CRC_INIT, payload, len);
+	payload[len] = (uint8_t) crc;
+	payload[len + 1] = (uint8_t) (crc >> 8);
+
+	wire[0] = 0;
+	wlen = frame_cobs_encode(payload, len + 2, &wire[1]) + 1;
+	wire[wlen++] = 0;
+
+	return wlen;
+}
+
+/*
+ * the bytes between two zeros to payload, payload holds len bytes
+ *
+ * returns the payload length, CRC off, -1 if it isn't a good frame
+ */
+
+int frame_decode(const uint8_t *src, uint16_t len, uint8_t *payload)
+{
+	int plen;
+	uint16_t crc;
+
+	plen = frame_cobs_decode(src, len, payload);
+	if(plen < 2) return -1;
+
+	plen -= 2;
+	crc = frame_crc16(FRAME_CRC_INIT, payload, plen);
+	if(payload[plen] != (uint8_t) crc || payload[plen + 1] != (uint8_t) (crc >> 8)) return -1;
+
+	return plen;
+}
+
+#ifdef SA_CONSOLE_BUILD
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * the CRC check value, COBS examples and random round trips, including runs
+ * of 254 and 255 non zero bytes and all zeros, and a flipped bit is caught
+ *
+ * returns 0 on success, -1 on failure
+ */
+
+static int round_trip(uint8_t *buf, uint16_t len)
+{
+	uint8_t payload[600], wire[FRAME_WIRE_MAX(600)], back[600];
+	int ii, wlen, plen;
+
+	memcpy(payload, buf, len);
+	wlen = frame_encode(payload, len, wire);
+	if(wlen > FRAME_WIRE_MAX(len)) return -1;
+	for(ii = 1; ii < wlen - 1; ii++) if(wire[ii] == 0) return -1;
+
+	plen = frame_decode(&wire[1], wlen - 2, back);
+	if(plen != len || memcmp(back, buf, len)) return -1;
+
+	wire[1 + (rand() % (wlen - 2))] ^= 1 << (rand() % 8);
+	if(frame_decode(&wire[1], wlen - 2, back) == len && memcmp(back, buf, len) == 0) return -1;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint8_t ex_in[] = { 0x11, 0x22, 0x00, 0x33 };
+	static const uint8_t ex_out[] = { 0x03, 0x11, 0x22, 0x02, 0x33 };
+	uint8_t buf[600], enc[FRAME_COBS_MAX(600)];
+	int ii, len, trial;
+
+	if(frame_crc16(FRAME_CRC_INIT, (const uint8_t*) "123456789", 9) != 0x29b1) {
+		printf("crc check value wrong\n");
+		return -1;
+	}
+
+	len = frame_cobs_encode(ex_in, sizeof(ex_in), enc);
+	if(len != sizeof(ex_out) || memcmp(enc, ex_out, len)) {
+		printf("cobs example wrong\n");
+		return -1;
+	}
+
+	for(ii = 0; ii < 600; ii++) buf[ii] = (ii % 255) + 1;
+	if(round_trip(buf, 254) || round_trip(buf, 255) || round_trip(buf, 600)) {
+		printf("long runs failed\n");
+		return -1;
+	}
+
+	memset(buf, 0, sizeof(buf));
+	if(round_trip(buf, 0) || round_trip(buf, 1) || round_trip(buf, 300)) {
+		printf("zeros failed\n");
+		return -1;
+	}
+
+	for(trial = 0; trial < 10000; trial++) {
+		len = rand() % sizeof(buf);
+		for(ii = 0; ii < len; ii++) buf[ii] = (rand() & 3) ? rand() : 0;
+		if(round_trip(buf, len)) {
+			printf("round trip %d of %d bytes failed\n", trial, len);
+			return -1;
+		}
+	}
+
+	printf("frame: crc, cobs and 10000 round trips ok\n");
+
+	return 0;
+}
+
+#endif // SA_CONSOLE_BUILD
@@ -17,10 +17,39 @@
  * DEALINGS IN THE SOFTWARE.
  */
 /**
- * @file mem_db.h
- * @brief exports and structs from mem_db.c
+ * @file frame.h
+ * @brief exports for framing binary streams, COBS byte stuffing and a CRC-16
  * @author Daniel G. Robinson
- * @date 27 Jun 2018
+ * @date 16 Oct 26
  */
 
-extern void mem_db_init();
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdint.h>
+
+/**
+ * a frame on the wire is
+ *
+ * 	0x00, COBS(payload, CRC-16 of payload low byte first), 0x00
+ *
+ * COBS leaves no zero bytes in the frame, so a zero always delimits.  The
+ * leading zero makes anything else on the line, e.g., console text, a frame
+ * of its own that fails the CRC instead of spoiling the next one.
+ *
+ * FRAME_COBS_MAX(len) is the most bytes cobs_encode() makes of len bytes
+ */
+
+#define FRAME_COBS_MAX(len)	((len) + ((len) / 254) + 1)
+#define FRAME_WIRE_MAX(len)	(FRAME_COBS_MAX((len) + 2) + 2)
+
+#define FRAME_CRC_INIT		(0xffff)
+
+extern uint16_t frame_crc16(uint16_t crc, const uint8_t *buf, uint16_t len);
+extern uint16_t frame_cobs_encode(const uint8_t *src, uint16_t len, uint8_t *dst);
+extern int frame_cobs_decode(const uint8_t *src, uint16_t len, uint8_t *dst);
+
+extern uint16_t frame_encode(uint8_t *payload, uint16_t len, uint8_t *wire);
+extern int frame_decode(const uint8_t *src, uint16_t len, uint8_t *payload);
+
+#endif // _FRAME_H_
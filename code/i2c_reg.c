@@ -31,6 +31,7 @@
 #include "micro_stdio.h"
 #include "format.h"
 #include "probe.h"
+#include "result.h"
 
 
 #ifdef CONSOLE_BUILD
@@ -110,26 +111,38 @@ Probe_funcs i2c_probe_funcs = {
 	ipf_print,
 };
 
-int i2c_reg_print_all()
+static void i2c_reg_print(int ii)
 {
-	int ii;
 	char obuf[9];
 	uint32_t* reg_ptr;
 
 	reg_ptr = (uint32_t*) I2C1;
 
-	for(ii = 0; ii < I2C_REG_COUNT; ii++) {
+	if(RES_TEXT()) {
 		PUTSS(i2c_reg_name[ii]);
 		PUTSS(": ");
-		PUTSS(format_x(*reg_ptr++, 8, obuf));
+		PUTSS(format_x(reg_ptr[ii], 8, obuf));
 		PUTSS(newline);
 	}
+	else {
+		res_begin("i2c_reg");
+		res_str("reg", i2c_reg_name[ii]);
+		res_u32("value", reg_ptr[ii]);
+		res_end();
+	}
+}
+
+int i2c_reg_print_all()
+{
+	int ii;
+
+	for(ii = 0; ii < I2C_REG_COUNT; ii++) i2c_reg_print(ii);
+
 	return 0;
 }
 
 int i2c_reg_cmd_access(int sargc, char *sargv[])
 {
-	char obuf[9];
 	if(sargc == 2) {
 		if(*sargv[1] == 'p') {
 			if(probe_set_funcs(&i2c_probe_funcs) != -1) {
@@ -149,15 +162,10 @@ int i2c_reg_cmd_access(int sargc, char *sargv[])
 			}
 			else {
 				int ii;
-				uint32_t* reg_ptr;
 
-				reg_ptr = (uint32_t*) I2C1;
 				for(ii = 0; ii < I2C_REG_COUNT; ii++) {
 					if(strcmp(sargv[2], i2c_reg_name[ii]) == 0) {
-						PUTSS(i2c_reg_name[ii]);
-						PUTSS(": ");
-						PUTSS(format_x(reg_ptr[ii], 8, obuf));
-						PUTSS(newline);
+						i2c_reg_print(ii);
 						return 1;
 					}
 				}
@@ -196,21 +204,9 @@ i2c_reg_access_exit:
 	return 1;
 }
 
-Shell_cmd cmd_i2c_reg = {
-	.list = {0, 0},
-	.sc_name = "i2c_reg",
-	.sc_abrev = "ir",
-	.sc_help = "i2c_reg read | write | probe,  all | <name> : read or write or probe i2c registers",
-
-	.sc_func = i2c_reg_cmd_access,
-	.sc_min = 2,
-	.sc_max = 4,
-};
-
-void i2c_reg_init()
-{
-	shell_add_cmd(&cmd_i2c_reg);
-}
+SHELL_COMMAND(cmd_i2c_reg, "i2c_reg", "ir",
+		"i2c_reg read | write | probe,  all | <name> : read or write or probe i2c registers",
+		i2c_reg_cmd_access, 2, 4);
 
 #ifdef CONSOLE_BUILD
 
@@ -218,18 +214,12 @@ void i2c_reg_init()
 
 int main(int argc, char *argv[])
 {
-	int done = 0;
-	int shell_arg = 1;
+
+	if(argc == 3 && strcmp(argv[1], "-f") == 0) return shell_run_file(argv[2]) ? 1 : 0;
 
 	shell_init(" :> ");
-	i2c_reg_init();
 
-	while(!done) {
-		shell_arg = shell_func(shell_arg);
-		if(shell_arg < 0) {
-			done = 1;
-		}
-	}
+	while(shell_poll() >= 0) shell_wait();
 	
 	shell_exit();
 }
@@ -30,6 +30,7 @@
 #include "micro_types.h"
 #include "micro_stdio.h"
 #include "format.h"
+#include "result.h"
 
 #ifdef CONSOLE_BUILD
 #else
@@ -454,6 +455,46 @@ static int lsm303_probe_pass_to_func(char cc)
 	return 0;			// don't print shell prompt
 }
 
+/*
+ * display runs as a shell task, one sample each time it's called
+ */
+
+static struct {
+	Shell_task ld_task;
+	uint32_t ld_left;
+	uint8_t ld_dev;
+} lsm303_disp;
+
+static int lsm303_disp_step(Shell_task *task)
+{
+	Type64 sensor_values;
+	char obuf[9];
+
+	if(task->st_cancel || lsm303_disp.ld_left == 0) return 0;
+
+	sensor_values.u64 = get_sensor_values(lsm303_disp.ld_dev);
+
+	if(!RES_TEXT()) {			// the readings are signed
+		res_begin("lsm303");
+		res_u32("dev", lsm303_disp.ld_dev);
+		res_i32("x", (int16_t) sensor_values.u16[0]);
+		res_i32("y", (int16_t) sensor_values.u16[1]);
+		res_i32("z", (int16_t) sensor_values.u16[2]);
+		res_end();
+		return --lsm303_disp.ld_left != 0;
+	}
+
+	PUTSS("x: ");
+	PUTSS(format_x((uint32_t) sensor_values.u16[0], 4, obuf));
+	PUTSS(", y: ");
+	PUTSS(format_x((uint32_t) sensor_values.u16[1], 4, obuf));
+	PUTSS(", z: ");
+	PUTSS(format_x((uint32_t) sensor_values.u16[2], 4, obuf));
+	PUTSS(newline);
+
+	return --lsm303_disp.ld_left != 0;
+}
+
 /*
  * lsm acc|mag|0x32|0x3c r|read reg_addr | all
  * lsm acc|mag|0x32|0x3c w|write reg_addr val
@@ -527,24 +568,17 @@ int lsm303_cmd_access(int sargc, char *sargv[])
 		}
 	}
 
-	if(*sargv[2] == 'd') {			// display
-		uint32_t count;
-		Type64 sensor_values;
-		if(sargc == 4) count = STRTOL(sargv[3]);
-		else count = 100;			// for now, need to make a bypass_func
+	if(*sargv[2] == 'd') {			// display, a sample a slice
+		lsm303_disp.ld_dev = dev;
+		lsm303_disp.ld_left = (sargc == 4) ? STRTOL(sargv[3]) : 100;
+		lsm303_disp.ld_task.st_step = lsm303_disp_step;
 		PUTSS(newline);
 
-		for(ii = 0; ii < count; ii++) {
-			sensor_values.u64 = get_sensor_values(dev);
-
-			PUTSS("x: ");
-			PUTSS(format_x((uint32_t) sensor_values.u16[0], 4, obuf));
-			PUTSS(", y: ");
-			PUTSS(format_x((uint32_t) sensor_values.u16[1], 4, obuf));
-			PUTSS(", z: ");
-			PUTSS(format_x((uint32_t) sensor_values.u16[1], 4, obuf));
-			PUTSS(newline);
+		if(shell_task_start(&lsm303_disp.ld_task) < 0) {
+			PUTSS("a task is running\r\n");
+			return 1;
 		}
+		return 0;		// the prompt comes when it's done
 	}
 
 	if(*sargv[2] == 'r') {			// read
@@ -615,18 +649,7 @@ lsm303_cmd_access_exit:
 	return 1;	// print prompt
 }
 
-Shell_cmd cmd_lsm303 = {
-	.list = {0, 0},
-	.sc_name = "lsm303",
-	.sc_abrev = "lsm",
-	.sc_help = "lsm303 acc|mag read|write|probe|disp reg [val]: read/write/probe/display access to LSM303",
-	.sc_func = lsm303_cmd_access,
-	.sc_min = 3,
-	.sc_max = 5,
-};
-
-void lsm303_driver_init()
-{
-	shell_add_cmd(&cmd_lsm303);
-}
+SHELL_COMMAND(cmd_lsm303, "lsm303", "lsm",
+		"lsm303 acc|mag read|write|probe|disp reg [val]: read/write/probe/display access to LSM303",
+		lsm303_cmd_access, 3, 5);
 
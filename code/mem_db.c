@@ -24,12 +24,14 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include "shell.h"
 #include "console.h"
 #include "micro_types.h"
 #include "micro_stdio.h"
 #include "format.h"
 #include "probe.h"
+#include "result.h"
 
 /*
  * This hack is to compensate for the fact that I'm working on 64 bit linux
@@ -53,18 +55,61 @@ static inline uint8_t* addr_of(uint32_t addr)
 
 /*
  * loop addr [1|2|4|b|s|l] r|w value [count]
+ *
+ * the accesses are a shell task, SHELL_TASK_SLICE at a time
  */
 
+static struct {
+	Shell_task ml_task;
+	uint32_t ml_addr;
+	uint32_t ml_val;
+	uint32_t ml_left;
+	uint8_t ml_size;
+	uint8_t ml_write;
+} mem_loop;
+
+static int mem_db_loop_step(Shell_task *task)
+{
+	uint32_t ii, nn;
+	uint32_t addr = mem_loop.ml_addr, val = mem_loop.ml_val;
+
+	if(task->st_cancel) return 0;
+
+	nn = mem_loop.ml_left < SHELL_TASK_SLICE ? mem_loop.ml_left : SHELL_TASK_SLICE;
+
+	switch(mem_loop.ml_size | (mem_loop.ml_write << 4)) {
+	case 1:
+		for(ii = 0; ii < nn; ii++) val = *((volatile uint8_t*) addr_of(addr));
+		break;
+	case 2:
+		for(ii = 0; ii < nn; ii++) val = *((volatile uint16_t*) addr_of(addr));
+		break;
+	case 4:
+		for(ii = 0; ii < nn; ii++) val = *((volatile uint32_t*) addr_of(addr));
+		break;
+	case 0x11:
+		for(ii = 0; ii < nn; ii++) *((volatile uint8_t*) addr_of(addr)) = (uint8_t) val;
+		break;
+	case 0x12:
+		for(ii = 0; ii < nn; ii++) *((volatile uint16_t*) addr_of(addr)) = (uint16_t) val;
+		break;
+	case 0x14:
+		for(ii = 0; ii < nn; ii++) *((volatile uint32_t*) addr_of(addr)) = val;
+		break;
+	}
+
+	mem_loop.ml_left -= nn;
+
+	return mem_loop.ml_left != 0;
+}
+
 int mem_db_cmd_loop(int sargc, char *sargv[])
 {
 	int size, index_for_size_arg;
 	uint32_t addr;
-	int read_write;
 	uint32_t count;
-	uint32_t ii;
-	uint8_t u8_val;
-	uint16_t u16_val;
-	uint32_t u32_val;
+	uint32_t u32_val = 0;
+	int write;
 	char obuf[9];
 
 	addr = STRTOL(sargv[1]);
@@ -92,6 +137,7 @@ int mem_db_cmd_loop(int sargc, char *sargv[])
 	count = 0;
 
 	if(*sargv[index_for_size_arg] == 'r') { // loop addr [size] r [count]
+		write = 0;
 		if(sargc > (index_for_size_arg + 1)) count = STRTOL(sargv[index_for_size_arg+1]);
 		if(count) {
 			PUTSS("reading ");
@@ -99,38 +145,17 @@ int mem_db_cmd_loop(int sargc, char *sargv[])
 			PUTSS(" times from ");
 			PUTSS(format_x(addr, 8, obuf));
 			PUTSS(newline);
-
-			switch(size) {
-			case 1:
-				for(ii = 0; ii < count; ii++) {
-					u8_val = *((volatile uint8_t*) addr_of(addr));
-				}
-				break;
-			case 2:
-				for(ii = 0; ii < count; ii++) {
-					u16_val = *((volatile uint16_t*) addr_of(addr));
-				}
-				break;
-			case 4:
-				for(ii = 0; ii < count; ii++) {
-					u32_val = *((volatile uint32_t*) addr_of(addr));
-				}
-				break;
-			}
-			return 1;
-		}
-		else {
-			// do bypass
 		}
 	}
 	else if(*sargv[index_for_size_arg] == 'w') {	// loop addr [size] w val [count]
-		if(sargc < index_for_size_arg + 1)  {
+		write = 1;
+		if(sargc < index_for_size_arg + 2)  {
 			PUTSS("loop writes require a value for writing\n\r");
 			return 1; 		// write prompt
 		}
 		u32_val = STRTOL(sargv[index_for_size_arg+1]);
 		if(sargc > (index_for_size_arg + 2))
-			count = STRTOL(sargv[index_for_size_arg+1]);
+			count = STRTOL(sargv[index_for_size_arg+2]);
 		if(count) {
 			PUTSS("writing ");
 			PUTSS(format_x(count, 8, obuf));
@@ -139,29 +164,6 @@ int mem_db_cmd_loop(int sargc, char *sargv[])
 			PUTSS(" this value ");
 			PUTSS(format_x(u32_val, 8, obuf));
 			PUTSS(newline);
-			
-			switch(size) {
-			case 1:
-				u8_val = (uint8_t) u32_val;
-				for(ii = 0; ii < count; ii++) {
-					*((volatile uint8_t*) addr_of(addr)) = u8_val;
-				}
-				break;
-			case 2:
-				u16_val = (uint16_t) u32_val;
-				for(ii = 0; ii < count; ii++) {
-					*((volatile uint16_t*) addr_of(addr)) = u16_val;
-				}
-				break;
-			case 4:
-				for(ii = 0; ii < count; ii++) {
-					*((volatile uint32_t*) addr_of(addr)) = u32_val;
-				}
-				break;
-			}
-			return 1;
-		}
-		else {
 		}
 	}
 	else {
@@ -169,18 +171,24 @@ int mem_db_cmd_loop(int sargc, char *sargv[])
 		return 1;				// print prompt
 	}
 
-	return 1;		// make the c compiler happy
+	if(count == 0) return 1;		// no count, nothing to loop on yet
+
+	mem_loop.ml_task.st_step = mem_db_loop_step;
+	mem_loop.ml_addr = addr;
+	mem_loop.ml_val = u32_val;
+	mem_loop.ml_left = count;
+	mem_loop.ml_size = size;
+	mem_loop.ml_write = write;
+	if(shell_task_start(&mem_loop.ml_task) < 0) {
+		PUTSS("a task is running\r\n");
+		return 1;
+	}
+
+	return 0;			// the prompt comes when it's done
 }
 
-Shell_cmd cmd_loop = {
-	.list = {0, 0},
-	.sc_name = "loop",
-	.sc_abrev = "l",
-	.sc_help = "loop addr [1|2|4|b|s|l] r|w value [count]: loop doing read/write on addr",
-	.sc_func = mem_db_cmd_loop,
-	.sc_min = 3,
-	.sc_max = 6,
-};
+SHELL_COMMAND(cmd_loop, "loop", "l", "loop addr [1|2|4|b|s|l] r|w value [count]: loop doing read/write on addr",
+		mem_db_cmd_loop, 3, 6);
 
 int mem_db_map(int sargc, char *sargv[])
 {
@@ -199,16 +207,42 @@ void mem_print_map_alias()
 
 void mem_print_map() __attribute__((weak, alias("mem_print_map_alias")));
 
-Shell_cmd cmd_map = {
-	.list = {0, 0},
-	.sc_name = "map",
-	.sc_abrev = "map",
-	.sc_help = "map :  print MCU memory map",
-	.sc_func = mem_db_map,
-	.sc_min = 1,
-	.sc_max = 1,
-};
+SHELL_COMMAND(cmd_map, "map", "map", "map :  print MCU memory map", mem_db_map, 1, 1);
+
+
+/*
+ * dump as results, RES_DUMP_BYTES a result, each read the size asked for in
+ * case it is a register, the bytes as they are in memory
+ */
+
+#define RES_DUMP_BYTES (64)
+
+static int mem_db_dump_result(uint32_t addr, int len, int size)
+{
+	uint8_t data[RES_DUMP_BYTES];
+	uint32_t val;
+	int count, jj;
+
+	for(; len > 0; len -= count, addr += count) {
+		count = (len < RES_DUMP_BYTES) ? len : RES_DUMP_BYTES;
+
+		for(jj = 0; jj < count; jj += size) {
+			switch(size) {
+			case 1: val = *((uint8_t*) addr_of(addr + jj)); break;
+			case 2: val = *((uint16_t*) addr_of(addr + jj)); break;
+			default: val = *((uint32_t*) addr_of(addr + jj)); break;
+			}
+			memcpy(&data[jj], &val, size);		// little endian, the low bytes
+		}
 
+		res_begin("dump");
+		res_u32("addr", addr);
+		res_u32("size", size);
+		res_bytes("data", data, count);
+		res_end();
+	}
+	return 1;
+}
 
 /*
  * dump addr len_in_bytes [size]
@@ -254,7 +288,8 @@ int mem_db_cmd_dump(int sargc, char *sargv[])
 		line_len = 16;
 	}
 
-	
+	if(!RES_TEXT()) return mem_db_dump_result(addr, len * size, size);
+
 	for(ii = 0; ii < len; ii += (line_len)) {
 		int jj;
 		char obuf[9];
@@ -302,15 +337,8 @@ int mem_db_cmd_dump(int sargc, char *sargv[])
 	return 1;			// print prompt
 }
 
-Shell_cmd cmd_dump = {
-	.list = {0, 0},
-	.sc_name = "dump",
-	.sc_abrev = "d",
-	.sc_help = "dump addr len [1|2|4|b|s|l] : dump memory from addr for len optional size",
-	.sc_func = mem_db_cmd_dump,
-	.sc_min = 3,
-	.sc_max = 4,
-};
+SHELL_COMMAND(cmd_dump, "dump", "d", "dump addr len [1|2|4|b|s|l] : dump memory from addr for len optional size",
+		mem_db_cmd_dump, 3, 4);
 
 
 static uint32_t probe_addr = 0;
@@ -433,34 +461,70 @@ int mem_db_cmd_probe(int sargc, char *sargv[])
 	}
 }
 
-Shell_cmd cmd_probe = {
-	.list = {0, 0},
-	.sc_name = "probe",
-	.sc_abrev = "pr",
-	.sc_help = "probe addr [1|2|4|b|s|l] : probe at memory location with optional size",
-	.sc_func = mem_db_cmd_probe,
-	.sc_min = 2,
-	.sc_max = 3,
-};
+SHELL_COMMAND(cmd_probe, "probe", "pr", "probe addr [1|2|4|b|s|l] : probe at memory location with optional size",
+		mem_db_cmd_probe, 2, 3);
+
+#ifdef CONSOLE_BUILD
 
-void mem_db_init()
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * console/mem_db -b, the output of dump 0 4096 into /dev/null, a write for
+ * each PUTSS() the way it was before the console buffer, then through it.
+ * Milliseconds a dump.
+ */
+
+#define DUMP_RUNS (200)
+
+static double mem_db_dump_bench(int buffered)
 {
-	shell_add_cmd(&cmd_dump);
-	shell_add_cmd(&cmd_probe);
-	shell_add_cmd(&cmd_loop);
-	shell_add_cmd(& cmd_map);
-	// add commands to shell
+	char *dump_argv[] = { "dump", "0", "4096" };
+	struct timespec start, end;
+	int ii;
+
+	if(freopen("/dev/null", "w", stdout) == 0) return -1;
+	if(buffered) stdio_obuf();
+	else setvbuf(stdout, 0, _IONBF, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(ii = 0; ii < DUMP_RUNS; ii++) mem_db_cmd_dump(3, dump_argv);
+	FLUSHCC();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return ((end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6) / DUMP_RUNS;
 }
 
-#ifdef CONSOLE_BUILD
+/*
+ * and the bytes dump 0 4096 sends in each mode
+ */
 
-#include <stdio.h>
+static long mem_db_dump_size(int mode)
+{
+	char *dump_argv[] = { "dump", "0", "4096" };
+	FILE *saved = stdout;
+	char *out;
+	size_t len;
+
+	fflush(stdout);
+	if((stdout = open_memstream(&out, &len)) == 0) {
+		stdout = saved;
+		return -1;
+	}
+	res_mode = mode;
+	mem_db_cmd_dump(3, dump_argv);
+	res_mode = RES_MODE_TEXT;
+	fclose(stdout);
+	stdout = saved;
+	free(out);
+
+	return (long) len;
+}
 
 int main(int argc, char *argv[])
 {
 	int ii;
-	int done = 0;
-	int shell_arg = 1;
 
 	for(ii = 0; ii < 1024; ii++) {
 		uint8_t fill_val;
@@ -469,15 +533,21 @@ int main(int argc, char *argv[])
 		debug_buf[ii] = fill_val;
 	}
 
-	shell_init(" :> ");
-	mem_db_init();
+	if(argc == 3 && strcmp(argv[1], "-f") == 0) return shell_run_file(argv[2]) ? 1 : 0;
+	if(argc == 2 && strcmp(argv[1], "-b") == 0) {
+		double before = mem_db_dump_bench(0), after = mem_db_dump_bench(1);
 
-	while(!done) {
-		shell_arg = shell_func(shell_arg);
-		if(shell_arg < 0) {
-			done = 1;
-		}
+		fprintf(stderr, "dump 0 4096: %.3f ms unbuffered, %.3f ms buffered, %.1f times\n",
+				before, after, before / after);
+		fprintf(stderr, "dump 0 4096: %ld bytes text, %ld json, %ld bin\n",
+				mem_db_dump_size(RES_MODE_TEXT), mem_db_dump_size(RES_MODE_JSON),
+				mem_db_dump_size(RES_MODE_BIN));
+		return 0;
 	}
+
+	shell_init(" :> ");
+
+	while(shell_poll() >= 0) shell_wait();
 	
 	shell_exit();
 }
@@ -42,6 +42,21 @@ int micro_puts(const char *ss)
 	return 0;
 }
 
+int micro_putb(const void *buf, int len)
+{
+	/*
+	 * put the output routine for your system here, the bytes can be zero
+	 */
+	return 0;
+}
+
+void micro_flush()
+{
+	/*
+	 * if the output routines hold characters, send them here
+	 */
+}
+
 int micro_getc()
 {
 	/*
@@ -50,6 +65,22 @@ int micro_getc()
 	return 0;
 }
 
+int micro_avail()
+{
+	/*
+	 * non zero if micro_getc() has a character waiting
+	 */
+	return 0;
+}
+
+uint32_t micro_lost()
+{
+	/*
+	 * the count of input characters dropped since power up
+	 */
+	return 0;
+}
+
 char *micro_gets(char *ss, int nn)
 {
 	/*
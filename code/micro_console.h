@@ -31,7 +31,11 @@
 extern int32_t micro_strtol(char *ss);
 extern int micro_putc(int cc);
 extern int micro_puts(const char *ss);
+extern int micro_putb(const void *buf, int len);
+extern void micro_flush();
 extern int micro_getc();
+extern int micro_avail();
+extern uint32_t micro_lost();
 extern char *micro_gets(char *ss, int nn);
 extern char micro_tolower(char cc);
 extern int micro_isalnum(char cc);
@@ -29,47 +29,79 @@
 #include "stm32f3xx_it.h"
 #endif // CONSOLE_BUILD
 
+#include <string.h>
 #include "byte_fifo.h"
+#include "micro_stdio.h"
+#include "console.h"
+#include "format.h"
+#include "shell.h"
+#include "frame.h"
+#include "result.h"
 
-#define USART1_RX_BUF_SIZE	200
+// power of two sizes so the fifos also build with BYTE_FIFO_POW2
 
-uint8_t usart1_rx_buf[USART1_RX_BUF_SIZE];
+#define USART1_RX_BUF_SIZE	256
 
-Byte_fifo usart1_rx_fifo = {
-	&usart1_rx_buf[0],
-	0, 0,
-	USART1_RX_BUF_SIZE
-};
+/*
+ * a full receive fifo drops the new byte, typed input wants the oldest.
+ * define USART1_RX_FLAGS as BF_FLAG_OVERWRITE to keep the newest instead,
+ * for a telemetry link.  Either way "fifo stats" shows what was lost.
+ */
 
-#define USART1_TX_BUF_SIZE	200
+#ifndef USART1_RX_FLAGS
+#define USART1_RX_FLAGS		(0)
+#endif // USART1_RX_FLAGS
 
-uint8_t usart1_tx_buf[USART1_TX_BUF_SIZE];
+BYTE_FIFO_DEFINE_FLAGS(usart1_rx_fifo, USART1_RX_BUF_SIZE, USART1_RX_FLAGS);
 
-Byte_fifo usart1_tx_fifo = {
-	&usart1_tx_buf[0],
-	0, 0,
-	USART1_TX_BUF_SIZE
-};
+#define USART1_TX_BUF_SIZE	256
 
-int _write (int fd, const void *buf, int count)
-{
-	uint8_t ch, *ss;
-	int ii;
+BYTE_FIFO_DEFINE(usart1_tx_fifo, USART1_TX_BUF_SIZE);
+
+/*
+ * output can come from the main loop, timer ISRs and fault handlers at the same
+ * time, so the transmit fifo has multiple producers.  Each piece goes in whole, see
+ * bf_mp_write().  Strings go in USART1_TX_CHUNK pieces, a quarter of the fifo, so
+ * a piece still fits while a writer that was interrupted holds its reservation.
+ *
+ * the main loop waits for room, the transmit interrupt makes it.  An ISR can't:
+ * bytes are only sent once every writer has finished copying, and the one it
+ * interrupted can't finish until it returns.  In an ISR a piece gets
+ * USART1_TX_ISR_TRIES and is then dropped and counted, see byte_fifo.h.
+ */
 
-	ss = (uint8_t*) buf;
+#define USART1_TX_CHUNK		(USART1_TX_BUF_SIZE / 4)
+#define USART1_TX_ISR_TRIES	(4)
 
-	for(ii = 0; ii < count; ii++) {
-		ch = ss[ii];
-_write_retry:
-		if(bf_space_avail(&usart1_tx_fifo)) {
-			bf_write(&usart1_tx_fifo, ch);
-			extern void usart1_transmit_interrupt_enable();
+#ifdef CONSOLE_BUILD
+#define USART1_IN_ISR()		(0)
+#else
+#define USART1_IN_ISR()		(__get_IPSR() != 0)
+#endif // CONSOLE_BUILD
+
+static void usart1_tx_write(const uint8_t *ss, int count)
+{
+	uint16_t len;
+	int tries = 0;
+
+	while(count > 0) {
+		len = (count > USART1_TX_CHUNK) ? USART1_TX_CHUNK : (uint16_t) count;
+		if(bf_mp_write(&usart1_tx_fifo, ss, len)) {
 			usart1_transmit_interrupt_enable();
+			ss += len;
+			count -= len;
+			tries = 0;
 		}
-		else {
-			goto _write_retry;
+		else if(USART1_IN_ISR() && ++tries == USART1_TX_ISR_TRIES) {
+			bf_count_dropped(&usart1_tx_fifo, (uint16_t) count);
+			return;
 		}
 	}
+}
+
+int _write (int fd, const void *buf, int count)
+{
+	usart1_tx_write((const uint8_t*) buf, count);
 
 	return count;
 }
@@ -82,15 +114,7 @@ int micro_putc(int cc)
 	uint8_t ch;
 
 	ch = (char) cc;
-putc_retry:
-	if(bf_space_avail(&usart1_tx_fifo)) {
-		bf_write(&usart1_tx_fifo, ch);
-		extern void usart1_transmit_interrupt_enable();
-		usart1_transmit_interrupt_enable();
-	}
-	else {
-		goto putc_retry;
-	}
+	usart1_tx_write(&ch, 1);
 
 	return 0;
 }
@@ -100,24 +124,51 @@ int micro_puts(const char *ss)
 	/*
 	 * put the output routine for your system here
 	 */
-	uint8_t ch;
+	if(ss) usart1_tx_write((const uint8_t*) ss, strlen(ss));
 
-	while(ss && *ss) {
-		ch = *ss++;
-puts_retry:
-		if(bf_space_avail(&usart1_tx_fifo)) {
-			bf_write(&usart1_tx_fifo, ch);
-			extern void usart1_transmit_interrupt_enable();
-			usart1_transmit_interrupt_enable();
-		}
-		else {
-			goto puts_retry;
+	return 0;
+}
+
+/*
+ * a binary frame goes in with one bf_mp_write, like dbt_stream_uart(), in
+ * pieces ISR output could land between them and break its CRC.  The main
+ * loop waits for room, an ISR gets USART1_TX_ISR_TRIES.  One over
+ * USART1_TX_FRAME_MAX might never find room next to a writer's piece and is
+ * dropped.
+ */
+
+#define USART1_TX_FRAME_MAX	(USART1_TX_BUF_SIZE - USART1_TX_CHUNK)
+
+_Static_assert(FRAME_WIRE_MAX(RES_PAYLOAD_MAX) <= USART1_TX_FRAME_MAX,
+		"a result frame must fit the transmit fifo whole");
+
+int micro_putb(const void *buf, int len)
+{
+	int tries = 0;
+
+	if(len <= 0) return 0;
+	if(len > USART1_TX_FRAME_MAX) {
+		bf_count_dropped(&usart1_tx_fifo, (uint16_t) len);
+		return -1;
+	}
+
+	while(bf_mp_write(&usart1_tx_fifo, (const uint8_t*) buf, (uint16_t) len) == 0) {
+		if(USART1_IN_ISR() && ++tries == USART1_TX_ISR_TRIES) {
+			bf_count_dropped(&usart1_tx_fifo, (uint16_t) len);
+			return -1;
 		}
 	}
+	usart1_transmit_interrupt_enable();
 
 	return 0;
 }
 
+// the transmit fifo is the buffer, the interrupt is already on
+
+void micro_flush()
+{
+}
+
 int micro_getc()
 {
 	/*
@@ -130,6 +181,16 @@ int micro_getc()
 	return (int) ch;
 }
 
+int micro_avail()
+{
+	return bf_data_avail(&usart1_rx_fifo);
+}
+
+uint32_t micro_lost()
+{
+	return atomic_load_explicit(&usart1_rx_fifo.bf_dropped, memory_order_relaxed);
+}
+
 char *micro_gets(char *ss, int nn)
 {
 	/*
@@ -185,10 +246,9 @@ void usart1_irq_handler()
     if(((isrflags & USART_ISR_RXNE) != RESET) && ((cr1its & USART_CR1_RXNEIE) != RESET)) {
 		// do receipt of character
 		// RDR is read data register, UART_RDR in ref manual
+		// a full fifo counts the drop, see "fifo stats"
 		uint32_t read_byte = USART1->RDR;	
-		if(bf_space_avail(&usart1_rx_fifo)) {
-			bf_write(&usart1_rx_fifo, (uint8_t) read_byte);
-		}
+		bf_write(&usart1_rx_fifo, (uint8_t) read_byte);
     }
 	// if transmit enabled and transmit empty
 	
@@ -261,3 +321,49 @@ void usart1_irq_handler()
   }
 }
 
+/*
+ * fifo stats | clear
+ *
+ * stats prints, for each uart fifo, the bytes in it now, the high water mark,
+ * the capacity, the bytes dropped and the number of writes that found it full.
+ * clear zeroes the counters and restarts the high water mark.
+ */
+
+static void fifo_print_stats(const char *name, Byte_fifo *bf)
+{
+	Bf_stats stats;
+	char obuf[12];
+
+	bf_get_stats(bf, &stats);
+
+	PUTSS(name);
+	PUTSS(": level ");
+	PUTSS(format_d((int32_t) stats.bfs_level, obuf));
+	PUTSS(" high ");
+	PUTSS(format_d((int32_t) stats.bfs_high_water, obuf));
+	PUTSS(" of ");
+	PUTSS(format_d((int32_t) stats.bfs_capacity, obuf));
+	PUTSS(" dropped ");
+	PUTSS(format_d((int32_t) stats.bfs_dropped, obuf));
+	PUTSS(" overruns ");
+	PUTSS(format_d((int32_t) stats.bfs_overruns, obuf));
+	PUTSS(newline);
+}
+
+int fifo_shell_cmd(int sargc, char *sargv[])
+{
+	if(*sargv[1] == 's') {
+		fifo_print_stats("usart1_rx", &usart1_rx_fifo);
+		fifo_print_stats("usart1_tx", &usart1_tx_fifo);
+	}
+	else if(*sargv[1] == 'c') {
+		bf_clear_stats(&usart1_rx_fifo);
+		bf_clear_stats(&usart1_tx_fifo);
+	}
+	else {
+		PUTSS("unknown option\n\r");
+	}
+	return 1;			// print prompt
+}
+
+SHELL_COMMAND(fifo_cmd, "fifo", "ff", "fifo stats | clear", fifo_shell_cmd, 2, 2);
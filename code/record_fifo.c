@@ -0,0 +1,358 @@
+/*
+ * Copyright 2018 Daniel G. Robinson
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software. 
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+/**
+ * @file record_fifo.c
+ * @brief length prefixed record queue on top of Byte_fifo
+ * @author Daniel G. Robinson
+ * @date 16 Oct 26
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "byte_fifo.h"
+#include "record_fifo.h"
+
+/*
+ * span helpers, a span is at most two regions, offsets run across both
+ */
+
+static inline uint8_t *rf_span_ptr(Bf_span *span, uint16_t off)
+{
+	if(off < span->bs_len[0]) return span->bs_ptr[0] + off;
+	return span->bs_ptr[1] + (off - span->bs_len[0]);
+}
+
+// sub is the len bytes of span starting at off
+
+static void rf_span_sub(Bf_span *span, uint16_t off, uint16_t len, Bf_span *sub)
+{
+	uint16_t first;
+
+	if(off < span->bs_len[0]) {
+		first = span->bs_len[0] - off;
+		if(first > len) first = len;
+		sub->bs_ptr[0] = span->bs_ptr[0] + off;
+		sub->bs_len[0] = first;
+		sub->bs_ptr[1] = span->bs_ptr[1];
+		sub->bs_len[1] = len - first;
+	}
+	else {
+		sub->bs_ptr[0] = span->bs_ptr[1] + (off - span->bs_len[0]);
+		sub->bs_len[0] = len;
+		sub->bs_ptr[1] = span->bs_ptr[1];
+		sub->bs_len[1] = 0;
+	}
+}
+
+static void rf_span_copy_out(Bf_span *span, uint8_t *dst)
+{
+	memcpy(dst, span->bs_ptr[0], span->bs_len[0]);
+	if(span->bs_len[1]) memcpy(dst + span->bs_len[0], span->bs_ptr[1], span->bs_len[1]);
+}
+
+/*
+ * producer
+ */
+
+// returns 0 with span set to the payload area, -1 if the record doesn't fit
+
+int rf_reserve(Record_fifo *rf, uint16_t len, Bf_span *span)
+{
+	Bf_span free_span;
+	uint16_t avail;
+
+	avail = bf_peek_span(rf->rf_bf, BF_SPAN_WRITE, &free_span);
+	if((uint32_t) len + RF_HDR_SIZE > avail) return -1;
+
+	*rf_span_ptr(&free_span, 0) = (uint8_t) len;
+	*rf_span_ptr(&free_span, 1) = (uint8_t) (len >> 8);
+	rf_span_sub(&free_span, RF_HDR_SIZE, len, span);
+
+	rf->rf_pending = len + RF_HDR_SIZE;
+
+	return 0;
+}
+
+// NB: only after a successful rf_reserve
+
+void rf_commit(Record_fifo *rf)
+{
+	atomic_fetch_add_explicit(&rf->rf_produced, 1, memory_order_relaxed);
+	bf_commit(rf->rf_bf, BF_SPAN_WRITE, rf->rf_pending);
+	rf->rf_pending = 0;
+}
+
+int rf_write(Record_fifo *rf, const void *src, uint16_t len)
+{
+	Bf_span span;
+
+	if(rf_reserve(rf, len, &span) < 0) return -1;
+
+	memcpy(span.bs_ptr[0], src, span.bs_len[0]);
+	if(span.bs_len[1])
+		memcpy(span.bs_ptr[1], (const uint8_t*) src + span.bs_len[0], span.bs_len[1]);
+
+	rf_commit(rf);
+
+	return 0;
+}
+
+/*
+ * consumer
+ */
+
+/*
+ * the producer bumps rf_produced before the frame is in, so this may run one
+ * ahead, never behind.  The consumer only releases frames it saw, after
+ * they were counted, so rf_consumed can't pass rf_produced.
+ */
+
+uint32_t rf_records(Record_fifo *rf)
+{
+	return atomic_load_explicit(&rf->rf_produced, memory_order_acquire)
+		- atomic_load_explicit(&rf->rf_consumed, memory_order_relaxed);
+}
+
+/*
+ * whole frames from the tail, at most max_records of them in at most max_bytes,
+ * frames included.  The producer only publishes whole frames, so the bytes
+ * available always end on a frame.
+ *
+ * returns the number of records, 0 if none or the first frame is over max_bytes
+ */
+
+uint16_t rf_peek_batch(Record_fifo *rf, uint16_t max_records, uint16_t max_bytes,
+		Rf_batch *batch)
+{
+	Bf_span span;
+	uint16_t avail, len;
+	uint32_t off = 0, next;
+
+	batch->rb_records = 0;
+	avail = bf_peek_span(rf->rf_bf, BF_SPAN_READ, &span);
+
+	while(batch->rb_records < max_records && off + RF_HDR_SIZE <= avail) {
+		len = *rf_span_ptr(&span, off) | (*rf_span_ptr(&span, off + 1) << 8);
+		next = off + RF_HDR_SIZE + len;
+		if(next > max_bytes) break;
+		off = next;
+		batch->rb_records++;
+	}
+
+	batch->rb_bytes = off;
+	rf_span_sub(&span, 0, off, &batch->rb_span);
+
+	return batch->rb_records;
+}
+
+void rf_release(Record_fifo *rf, Rf_batch *batch)
+{
+	if(batch->rb_records == 0) return;
+
+	bf_commit(rf->rf_bf, BF_SPAN_READ, batch->rb_bytes);
+	atomic_fetch_add_explicit(&rf->rf_consumed, batch->rb_records, memory_order_relaxed);
+	batch->rb_records = batch->rb_bytes = 0;
+}
+
+// length of the record at the tail, -1 if none
+
+int rf_peek_len(Record_fifo *rf)
+{
+	Rf_batch batch;
+
+	if(rf_peek_batch(rf, 1, 0xffff, &batch) == 0) return -1;
+
+	return batch.rb_bytes - RF_HDR_SIZE;
+}
+
+/*
+ * copy one record out
+ *
+ * returns its length, -1 if there is none, -2 if it is longer than max, the
+ * record is left in the fifo then, see rf_peek_len
+ */
+
+int rf_read(Record_fifo *rf, void *dst, uint16_t max)
+{
+	Rf_batch batch;
+	Bf_span payload;
+	uint16_t len;
+
+	if(rf_peek_batch(rf, 1, 0xffff, &batch) == 0) return -1;
+
+	len = batch.rb_bytes - RF_HDR_SIZE;
+	if(len > max) return -2;
+
+	rf_span_sub(&batch.rb_span, RF_HDR_SIZE, len, &payload);
+	rf_span_copy_out(&payload, (uint8_t*) dst);
+	rf_release(rf, &batch);
+
+	return len;
+}
+
+/*
+ * copy up to max_records whole frames, length prefixes included, into dst,
+ * walk them with RF_FRAME_LEN
+ *
+ * returns the number of records copied
+ */
+
+uint16_t rf_read_batch(Record_fifo *rf, void *dst, uint16_t max_bytes, uint16_t max_records)
+{
+	Rf_batch batch;
+	uint16_t records;
+
+	if(rf_peek_batch(rf, max_records, max_bytes, &batch) == 0) return 0;
+
+	rf_span_copy_out(&batch.rb_span, (uint8_t*) dst);
+	records = batch.rb_records;
+	rf_release(rf, &batch);
+
+	return records;
+}
+
+#ifdef SA_CONSOLE_BUILD
+
+/*
+ * stress test
+ *
+ * console/record_fifo [num_records]
+ *
+ * the writer sends records of 0 to RT_MAX_LEN bytes, the payload a function of
+ * the sequence number, alternating rf_write and rf_reserve / rf_commit.  The
+ * reader alternates rf_read and rf_read_batch and checks every record is whole
+ * and in order.
+ *
+ * returns 0 on success, -1 on failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define RT_MAX_LEN	(60)
+#define RT_BATCH_BYTES	(200)
+
+RECORD_FIFO_DEFINE(rt_fifo, 256);
+
+static int rt_records = 1000000;
+
+static inline uint16_t rt_len(int seq)
+{
+	return (uint16_t) ((seq * 13) % (RT_MAX_LEN + 1));
+}
+
+static inline uint8_t rt_byte(int seq, int ii)
+{
+	return (uint8_t) (seq * 7 + ii);
+}
+
+void *rt_write_side(void *ptr)
+{
+	uint8_t rec[RT_MAX_LEN];
+	Bf_span span;
+	uint16_t len, ii;
+	int seq;
+
+	for(seq = 0; seq < rt_records; seq++) {
+		len = rt_len(seq);
+
+		if(seq & 1) {
+			for(ii = 0; ii < len; ii++) rec[ii] = rt_byte(seq, ii);
+			while(rf_write(&rt_fifo, rec, len) < 0) sched_yield();
+		}
+		else {
+			while(rf_reserve(&rt_fifo, len, &span) < 0) sched_yield();
+			for(ii = 0; ii < len; ii++) *rf_span_ptr(&span, ii) = rt_byte(seq, ii);
+			rf_commit(&rt_fifo);
+		}
+	}
+
+	return 0;
+}
+
+static int rt_check(int seq, const uint8_t *rec, int len)
+{
+	int ii;
+
+	if(len != rt_len(seq)) {
+		fprintf(stderr, "record %d: length %d, expected %d\n", seq, len, rt_len(seq));
+		return -1;
+	}
+	for(ii = 0; ii < len; ii++) {
+		if(rec[ii] != rt_byte(seq, ii)) {
+			fprintf(stderr, "record %d: bad byte %d\n", seq, ii);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t writer;
+	uint8_t buf[RT_BATCH_BYTES];
+	uint8_t *frame;
+	int seq = 0, batches = 0, len;
+	uint16_t records, ii;
+
+	if(argc >= 2) rt_records = atoi(argv[1]);
+
+	if(pthread_create(&writer, NULL, rt_write_side, 0) != 0) {
+		fprintf(stderr, "couldn't start writer\n");
+		exit(-1);
+	}
+
+	while(seq < rt_records) {
+		if(seq & 1) {
+			records = rf_read_batch(&rt_fifo, buf, sizeof(buf), 8);
+			if(records > 1) batches++;
+			for(ii = 0, frame = buf; ii < records; ii++, seq++) {
+				if(rt_check(seq, frame + RF_HDR_SIZE, RF_FRAME_LEN(frame)) < 0) exit(-1);
+				frame += RF_HDR_SIZE + RF_FRAME_LEN(frame);
+			}
+		}
+		else {
+			len = rf_read(&rt_fifo, buf, sizeof(buf));
+			if(len >= 0) {
+				if(rt_check(seq, buf, len) < 0) exit(-1);
+				records = 1;
+				seq++;
+			}
+			else records = 0;
+		}
+		if(records == 0) sched_yield();
+	}
+
+	pthread_join(writer, NULL);
+
+	if(rf_records(&rt_fifo) != 0 || bf_data_avail(rt_fifo.rf_bf) != 0) {
+		fprintf(stderr, "%u records left over\n", rf_records(&rt_fifo));
+		exit(-1);
+	}
+
+	printf("record_fifo: %d records, %d multi record batches, ok\n", seq, batches);
+
+	return 0;
+}
+
+#endif // SA_CONSOLE_BUILD
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2018 Daniel G. Robinson
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software. 
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+/**
+ * @file record_fifo.h
+ * @brief length prefixed record queue on top of Byte_fifo
+ * @author Daniel G. Robinson
+ * @date 16 Oct 26
+ */
+/*
+ * Records of 0 to capacity - RF_HDR_SIZE bytes go through a Byte_fifo as frames
+ *
+ * 	length low, length high, payload
+ *
+ * A record goes in whole or not at all and comes out whole, so a consumer never
+ * sees part of one.  The same one producer, one consumer rules as Byte_fifo
+ * apply, and the Byte_fifo must not be BF_FLAG_OVERWRITE, dropping bytes
+ * would break the framing.
+ *
+ * producer:
+ *
+ * RECORD_FIFO_DEFINE(sample_q, 512);
+ *
+ * rf_write(&sample_q, &sample, sizeof(sample));
+ *
+ * or, to build the record in place,
+ *
+ * Bf_span span;
+ *
+ * if(rf_reserve(&sample_q, len, &span) == 0) {
+ * 	fill span.bs_ptr[0] for span.bs_len[0] bytes, then bs_ptr[1] for bs_len[1]
+ * 	rf_commit(&sample_q);
+ * }
+ *
+ * consumer, one record at a time:
+ *
+ * len = rf_read(&sample_q, buf, sizeof(buf));
+ *
+ * or a batch of whole frames in one go, e.g., a uart ISR or a DMA transfer
+ * sending frames as they are:
+ *
+ * Rf_batch batch;
+ *
+ * if(rf_peek_batch(&sample_q, max_records, max_bytes, &batch)) {
+ * 	send batch.rb_span, batch.rb_bytes bytes of frames
+ * 	rf_release(&sample_q, &batch);
+ * }
+ *
+ * rf_release moves the tail once for the whole batch, so a batch is dequeued
+ * atomically, the producer sees all of the room come free at the same time.
+ */
+
+#ifndef _RECORD_FIFO_H
+#define _RECORD_FIFO_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "byte_fifo.h"
+
+#define RF_HDR_SIZE		(2)
+#define RF_FRAME_LEN(frame)	((uint16_t) ((frame)[0] | ((frame)[1] << 8)))
+
+typedef struct _record_fifo {
+	Byte_fifo *rf_bf;		// holds the frames
+	_Atomic uint32_t rf_produced;	// records committed
+	_Atomic uint32_t rf_consumed;	// records released
+	uint16_t rf_pending;		// producer only, frame size of the reserved record
+} Record_fifo;
+
+#define RECORD_FIFO_DEFINE(name, size) \
+	BYTE_FIFO_DEFINE(name##_bytes, size); \
+	Record_fifo name = { .rf_bf = &name##_bytes }
+
+typedef struct _rf_batch {
+	Bf_span rb_span;		// the frames, length prefixes included
+	uint16_t rb_records;
+	uint16_t rb_bytes;
+} Rf_batch;
+
+extern int rf_reserve(Record_fifo *rf, uint16_t len, Bf_span *span);
+extern void rf_commit(Record_fifo *rf);
+extern int rf_write(Record_fifo *rf, const void *src, uint16_t len);
+
+extern uint32_t rf_records(Record_fifo *rf);
+extern int rf_peek_len(Record_fifo *rf);
+extern int rf_read(Record_fifo *rf, void *dst, uint16_t max);
+
+extern uint16_t rf_peek_batch(Record_fifo *rf, uint16_t max_records, uint16_t max_bytes,
+		Rf_batch *batch);
+extern void rf_release(Record_fifo *rf, Rf_batch *batch);
+extern uint16_t rf_read_batch(Record_fifo *rf, void *dst, uint16_t max_bytes,
+		uint16_t max_records);
+
+#endif // _RECORD_FIFO_H
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2018 Daniel G. Robinson
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software. 
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+/**
+ * @file result.c
+ * @brief typed command results, as text, JSON lines or binary frames
+ * @author Daniel G. Robinson
+ * @date 16 Oct 26
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "shell.h"
+#include "console.h"
+#include "frame.h"
+#include "result.h"
+
+/*
+ * see result.h
+ *
+ * json goes out as it is built, bin is built in res_buf and framed at
+ * res_end().  In text they do nothing, the command prints for itself.
+ */
+
+int res_mode = RES_MODE_TEXT;
+
+static const char *res_mode_name[RES_MODE_COUNT] = { "text", "json", "bin" };
+
+static uint8_t res_buf[RES_PAYLOAD_MAX + 2];		// and the CRC, see frame_encode()
+static uint16_t res_len;
+static uint8_t res_wire[FRAME_WIRE_MAX(RES_PAYLOAD_MAX)];
+
+static const char hex_digit[] = "0123456789abcdef";
+
+static void res_json_str(const char *ss)
+{
+	char esc[7] = "\\u00";
+
+	PUTCC('"');
+	for(; *ss; ss++) {
+		if(*ss == '"' || *ss == '\\') {
+			PUTCC('\\');
+			PUTCC(*ss);
+		}
+		else if((uint8_t) *ss < 0x20) {
+			esc[4] = hex_digit[(*ss >> 4) & 0xf];
+			esc[5] = hex_digit[*ss & 0xf];
+			esc[6] = 0;
+			PUTSS(esc);
+		}
+		else PUTCC(*ss);
+	}
+	PUTCC('"');
+}
+
+static void res_json_key(const char *key)
+{
+	PUTCC(',');
+	res_json_str(key);
+	PUTCC(':');
+}
+
+static void res_json_u64(uint64_t val)
+{
+	char obuf[21];
+	int ii = sizeof(obuf) - 1;
+
+	obuf[ii] = 0;
+	do {
+		obuf[--ii] = '0' + (char) (val % 10);
+		val /= 10;
+	} while(val);
+
+	PUTSS(&obuf[ii]);
+}
+
+// room for a bin field with a value of len bytes, 0 and the flag set if none
+
+static uint8_t *res_field(char type, const char *key, uint16_t len)
+{
+	uint16_t key_len = strlen(key) + 1;
+	uint8_t *dst;
+
+	if(res_len + 1 + key_len + len > RES_PAYLOAD_MAX) {
+		res_buf[0] |= RES_FLAG_DROPPED;
+		return 0;
+	}
+
+	dst = &res_buf[res_len];
+	*dst++ = (uint8_t) type;
+	memcpy(dst, key, key_len);
+	res_len += 1 + key_len + len;
+
+	return dst + key_len;
+}
+
+static void res_le(uint8_t *dst, uint64_t val, int len)
+{
+	while(len--) {
+		*dst++ = (uint8_t) val;
+		val >>= 8;
+	}
+}
+
+void res_begin(const char *cmd)
+{
+	uint16_t len = strlen(cmd) + 1;
+
+	if(res_mode == RES_MODE_JSON) {
+		PUTSS("{\"cmd\":");
+		res_json_str(cmd);
+	}
+	else if(res_mode == RES_MODE_BIN) {
+		if(len > RES_PAYLOAD_MAX - 1) len = RES_PAYLOAD_MAX - 1;
+		res_buf[0] = 0;
+		memcpy(&res_buf[1], cmd, len);
+		res_buf[len] = 0;
+		res_len = 1 + len;
+	}
+}
+
+void res_u32(const char *key, uint32_t val)
+{
+	uint8_t *dst;
+
+	if(res_mode == RES_MODE_JSON) {
+		res_json_key(key);
+		res_json_u64(val);
+	}
+	else if(res_mode == RES_MODE_BIN && (dst = res_field('u', key, 4))) res_le(dst, val, 4);
+}
+
+void res_i32(const char *key, int32_t val)
+{
+	uint8_t *dst;
+
+	if(res_mode == RES_MODE_JSON) {
+		res_json_key(key);
+		if(val < 0) PUTCC('-');
+		res_json_u64(val < 0 ? -(int64_t) val : val);
+	}
+	else if(res_mode == RES_MODE_BIN && (dst = res_field('i', key, 4))) res_le(dst, (uint32_t) val, 4);
+}
+
+void res_u64(const char *key, uint64_t val)
+{
+	uint8_t *dst;
+
+	if(res_mode == RES_MODE_JSON) {
+		res_json_key(key);
+		res_json_u64(val);
+	}
+	else if(res_mode == RES_MODE_BIN && (dst = res_field('q', key, 8))) res_le(dst, val, 8);
+}
+
+void res_str(const char *key, const char *val)
+{
+	uint16_t len = strlen(val) + 1;
+	uint8_t *dst;
+
+	if(res_mode == RES_MODE_JSON) {
+		res_json_key(key);
+		res_json_str(val);
+	}
+	else if(res_mode == RES_MODE_BIN && (dst = res_field('s', key, len))) memcpy(dst, val, len);
+}
+
+void res_bytes(const char *key, const uint8_t *buf, uint16_t len)
+{
+	uint8_t *dst;
+	uint16_t ii;
+
+	if(res_mode == RES_MODE_JSON) {
+		res_json_key(key);
+		PUTCC('"');
+		for(ii = 0; ii < len; ii++) {
+			PUTCC(hex_digit[buf[ii] >> 4]);
+			PUTCC(hex_digit[buf[ii] & 0xf]);
+		}
+		PUTCC('"');
+	}
+	else if(res_mode == RES_MODE_BIN && (dst = res_field('b', key, len + 2))) {
+		res_le(dst, len, 2);
+		memcpy(dst + 2, buf, len);
+	}
+}
+
+void res_end()
+{
+	if(res_mode == RES_MODE_JSON) {
+		PUTCC('}');
+		PUTSS(newline);
+	}
+	else if(res_mode == RES_MODE_BIN) {
+		PUTBB(res_wire, frame_encode(res_buf, res_len, res_wire));
+	}
+}
+
+/*
+ * mode [json | bin | text]
+ */
+
+int res_cmd_mode(int sargc, char *sargv[])
+{
+	int ii;
+
+	if(sargc == 2) {
+		for(ii = 0; ii < RES_MODE_COUNT && strcmp(sargv[1], res_mode_name[ii]); ii++) ;
+		if(ii == RES_MODE_COUNT) {
+			PUTSS("mode json | bin | text");
+			PUTSS(newline);
+			return 1;
+		}
+		res_mode = ii;
+	}
+
+	if(RES_TEXT()) {
+		PUTSS("mode ");
+		PUTSS(res_mode_name[res_mode]);
+		PUTSS(newline);
+	}
+	else {
+		res_begin("mode");
+		res_str("mode", res_mode_name[res_mode]);
+		res_end();
+	}
+	return 1;
+}
+
+SHELL_COMMAND(cmd_mode, "mode", "mode", "mode [json | bin | text] : results as text, JSON lines or binary frames",
+		res_cmd_mode, 1, 2);
+
+#ifdef SA_CONSOLE_BUILD
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * a result as a JSON line and as a frame, decoded and taken apart again,
+ * and one too big for a frame
+ *
+ * returns 0 on success, -1 on failure
+ */
+
+static char *out_buf;
+static size_t out_len;
+
+static void res_sample()
+{
+	static const uint8_t bytes[] = { 0x00, 0x7f, 0xa5 };
+
+	res_begin("test");
+	res_u32("u", 51966);
+	res_i32("i", -12);
+	res_u64("q", 1ULL << 40);
+	res_str("s", "a\"b");
+	res_bytes("b", bytes, sizeof(bytes));
+	res_end();
+}
+
+// the output of one res_sample() in mode
+
+static int capture(int mode)
+{
+	FILE *saved = stdout;
+
+	res_mode = mode;
+	fflush(stdout);
+	if((stdout = open_memstream(&out_buf, &out_len)) == 0) {
+		stdout = saved;
+		return -1;
+	}
+	res_sample();
+	fclose(stdout);
+	stdout = saved;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const char json[] =
+		"{\"cmd\":\"test\",\"u\":51966,\"i\":-12,\"q\":1099511627776,\"s\":\"a\\\"b\",\"b\":\"007fa5\"}\r\n";
+	static const uint8_t bin[] = {
+		0, 't', 'e', 's', 't', 0,
+		'u', 'u', 0, 0xfe, 0xca, 0, 0,
+		'i', 'i', 0, 0xf4, 0xff, 0xff, 0xff,
+		'q', 'q', 0, 0, 0, 0, 0, 0, 1, 0, 0,
+		's', 's', 0, 'a', '"', 'b', 0,
+		'b', 'b', 0, 3, 0, 0x00, 0x7f, 0xa5,
+	};
+	uint8_t payload[RES_PAYLOAD_MAX + 2], big[RES_PAYLOAD_MAX];
+	int len, ii;
+
+	if(capture(RES_MODE_JSON) || out_len != strlen(json) || memcmp(out_buf, json, out_len)) {
+		printf("json wrong\n");
+		return -1;
+	}
+	free(out_buf);
+
+	// a frame, 0 at each end and none in between
+
+	if(capture(RES_MODE_BIN) || out_len < 4 || out_buf[0] || out_buf[out_len - 1]) return -1;
+	for(ii = 1; ii < out_len - 1; ii++) if(out_buf[ii] == 0) return -1;
+	len = frame_decode((uint8_t*) &out_buf[1], out_len - 2, payload);
+	free(out_buf);
+	if(len != sizeof(bin) || memcmp(payload, bin, len)) {
+		printf("bin wrong\n");
+		return -1;
+	}
+
+	// too big for a frame, the field is left out
+
+	memset(big, 0x55, sizeof(big));
+	res_mode = RES_MODE_BIN;
+	res_begin("big");
+	res_bytes("b", big, sizeof(big));
+	if(res_len != 5 || (res_buf[0] & RES_FLAG_DROPPED) == 0) return -1;
+
+	res_mode = RES_MODE_TEXT;
+	if(capture(RES_MODE_TEXT) || out_len != 0) return -1;
+	free(out_buf);
+
+	return 0;
+}
+
+#endif // SA_CONSOLE_BUILD
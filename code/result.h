@@ -0,0 +1,83 @@
+/*
+ * Copyright 2018 Daniel G. Robinson
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software. 
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+/**
+ * @file result.h
+ * @brief exports for typed command results, as text, JSON lines or binary frames
+ * @author Daniel G. Robinson
+ * @date 16 Oct 26
+ */
+
+#ifndef _RESULT_H_
+#define _RESULT_H_
+
+#include <stdint.h>
+
+/**
+ * "mode json|bin|text" picks how commands print what they find.  In text
+ * they print it for a person as always, in the others they build a result
+ *
+ * 	if(RES_TEXT()) {
+ * 		... PUTSS(format_x(val, 8, obuf)) ...
+ * 	}
+ * 	else {
+ * 		res_begin("i2c_reg");
+ * 		res_str("reg", "cr1");
+ * 		res_u32("value", val);
+ * 		res_end();
+ * 	}
+ *
+ * json is a line for each result, {"cmd":"i2c_reg","reg":"cr1","value":51966}
+ * with bytes as a string of hex pairs.  bin is a frame for each, see frame.h,
+ * the payload
+ *
+ * 	flags, cmd, 0, then for each field: type, key, 0, value
+ *
+ * the types are 'u' uint32_t, 'i' int32_t, 'q' uint64_t, all low byte first,
+ * 's' a string and a 0, 'b' a length, two bytes, and the bytes.  A field that
+ * doesn't fit in RES_PAYLOAD_MAX is left out and RES_FLAG_DROPPED set.  Other
+ * output, the prompt and the echo, stays text, a host finds the results as
+ * the lines starting with '{' or as the frames that check.
+ */
+
+enum {
+	RES_MODE_TEXT,
+	RES_MODE_JSON,
+	RES_MODE_BIN,
+	RES_MODE_COUNT,
+};
+
+#ifndef RES_PAYLOAD_MAX
+#define RES_PAYLOAD_MAX		(160)
+#endif
+
+#define RES_FLAG_DROPPED	(0x01)
+
+extern int res_mode;
+
+#define RES_TEXT() (res_mode == RES_MODE_TEXT)
+
+extern void res_begin(const char *cmd);
+extern void res_u32(const char *key, uint32_t val);
+extern void res_i32(const char *key, int32_t val);
+extern void res_u64(const char *key, uint64_t val);
+extern void res_str(const char *key, const char *val);
+extern void res_bytes(const char *key, const uint8_t *buf, uint16_t len);
+extern void res_end();
+
+#endif // _RESULT_H_
@@ -65,21 +65,247 @@ struct list_head cmd_list = {0,0};
 
 /**
  * commands can have a long and a short name.  They can be identical.
- * We don't do command completion.  We could, but we didn't feel like it.
- * Yet.
- * Do a simple linear search.
+ * Either can be typed as a prefix no other name starts with, and the tab key
+ * completes one, see the trie below.
+ *
+ * lookups go through cmd_hash, an open addressed table of both names,
+ * FNV-1a hashed and linearly probed.  It is static, filled from the
+ * shell_cmd section by shell_init() and by shell_add_cmd(), and never more
+ * than 3/4 full so a miss ends at an empty slot soon.  SHELL_HASH_SIZE is a
+ * power of two, 128 holds 96 names.  cmd_list keeps the order of the ones
+ * added for help.
+ */
+
+#ifndef SHELL_HASH_SIZE
+#define SHELL_HASH_SIZE (128)
+#endif
+
+#define SHELL_HASH_MAX	(SHELL_HASH_SIZE * 3 / 4)
+
+_Static_assert((SHELL_HASH_SIZE & (SHELL_HASH_SIZE - 1)) == 0, "SHELL_HASH_SIZE must be a power of two");
+
+static const Shell_cmd *cmd_hash[SHELL_HASH_SIZE];
+static int cmd_hash_count;
+
+static uint32_t shell_hash(const char *name)
+{
+	uint32_t hash = 0x811c9dc5;
+
+	while(*name) {
+		hash ^= (uint8_t) *name++;
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+// the slot holding name, or the empty one it would go in
+
+static const Shell_cmd **shell_hash_slot(const char *name)
+{
+	uint32_t ii = shell_hash(name);
+	const Shell_cmd *cmd;
+
+	for(;; ii++) {
+		cmd = cmd_hash[ii & (SHELL_HASH_SIZE - 1)];
+		if(cmd == 0 || strcmp(name, cmd->sc_name) == 0 || strcmp(name, cmd->sc_abrev) == 0)
+			return &cmd_hash[ii & (SHELL_HASH_SIZE - 1)];
+	}
+}
+
+/*
  * return 0 on not found
  */
 
-static Shell_cmd *shell_find_cmd(char *name)
+static const Shell_cmd *shell_find_cmd(char *name)
 {
-	Shell_cmd *cmd;
+	return *shell_hash_slot(name);
+}
 
-	list_for_each_entry(cmd, &cmd_list, list) {
-		if(strcmp(name, cmd->sc_name) == 0) return cmd;
-		if(strcmp(name, cmd->sc_abrev) == 0) return cmd;
+/*
+ * prefixes go through a trie of the same names, for a command typed short and
+ * for the tab key.  The nodes are in shell_trie, a static arena filled with
+ * the hash, node 0 the root of the commands.  A node is a character, its
+ * first child, its next sibling, the siblings in order, and st_only, the one
+ * command every name below belongs to or TRIE_MANY.  A prefix is a node a
+ * character, so finding it costs its length, not the number of commands.
+ *
+ * the Shell_sub_cmd table of a SHELL_COMMAND_SUBS() gets a root of its own.
+ *
+ * st_only is an index, not a pointer, so a node is 6 bytes up to 256 nodes,
+ * 8 past that.  All the commands and dbtrace's sub commands take about 90,
+ * 200 leaves room.
+ */
+
+#ifndef SHELL_TRIE_NODES
+#define SHELL_TRIE_NODES (200)
+#endif
+
+#if SHELL_TRIE_NODES <= 256
+typedef uint8_t trie_index_t;
+#else
+typedef uint16_t trie_index_t;
+#endif
+
+#ifndef SHELL_SUB_TABLES
+#define SHELL_SUB_TABLES (8)
+#endif
+
+/*
+ * st_only is 0 for none, TRIE_MANY, or one more than the entry's index: its
+ * name's slot in cmd_hash under node 0, its place in the table under a sub
+ * command root, see trie_entry()
+ */
+
+#define TRIE_MANY	(0xffff)
+
+typedef struct _shell_trie {
+	char st_ch;
+	uint8_t st_end;				// a name ends here
+	trie_index_t st_child, st_next;		// 0 for none
+	uint16_t st_only;
+} Shell_trie;
+
+_Static_assert(SHELL_HASH_SIZE < TRIE_MANY, "st_only must hold a cmd_hash slot");
+
+static Shell_trie shell_trie[SHELL_TRIE_NODES];
+static uint16_t trie_count = 1;		// node 0 is the root
+
+static struct {
+	const Shell_sub_cmd *ss_list;
+	uint16_t ss_root;
+} sub_trie[SHELL_SUB_TABLES];
+static int sub_trie_count;
+
+static void shell_hash_clear()
+{
+	memset(cmd_hash, 0, sizeof(cmd_hash));
+	cmd_hash_count = 0;
+
+	memset(shell_trie, 0, sizeof(Shell_trie));
+	trie_count = 1;
+	sub_trie_count = 0;
+}
+
+static void trie_mark(int node, uint16_t entry)
+{
+	if(shell_trie[node].st_only == 0) shell_trie[node].st_only = entry;
+	else if(shell_trie[node].st_only != entry) shell_trie[node].st_only = TRIE_MANY;
+}
+
+// the caller checked there is room, see trie_room()
+
+static void trie_add(int root, const char *name, uint16_t entry)
+{
+	trie_index_t *link;
+	int node = root;
+
+	for(; *name; name++) {
+		trie_mark(node, entry);
+
+		link = &shell_trie[node].st_child;
+		while(*link && shell_trie[*link].st_ch < *name) link = &shell_trie[*link].st_next;
+
+		if(*link == 0 || shell_trie[*link].st_ch != *name) {
+			memset(&shell_trie[trie_count], 0, sizeof(Shell_trie));
+			shell_trie[trie_count].st_ch = *name;
+			shell_trie[trie_count].st_next = *link;
+			*link = trie_count++;
+		}
+		node = *link;
+	}
+	trie_mark(node, entry);
+	shell_trie[node].st_end = 1;
+}
+
+// the node of the first len characters of prefix, -1 if no name starts so
+
+static int trie_find(int root, const char *prefix, int len)
+{
+	int node = root, child;
+
+	while(len--) {
+		for(child = shell_trie[node].st_child; child; child = shell_trie[child].st_next)
+			if(shell_trie[child].st_ch >= *prefix) break;
+		if(child == 0 || shell_trie[child].st_ch != *prefix++) return -1;
+		node = child;
+	}
+	return node;
+}
+
+static int sub_trie_root(const Shell_sub_cmd *list)
+{
+	int ii;
+
+	for(ii = 0; ii < sub_trie_count; ii++)
+		if(sub_trie[ii].ss_list == list) return sub_trie[ii].ss_root;
+
+	return -1;
+}
+
+// what st_only names under root, a Shell_cmd or a Shell_sub_cmd, 0 for none or many
+
+static const void *trie_entry(int root, uint16_t only)
+{
+	int ii;
+
+	if(only == 0 || only == TRIE_MANY) return 0;
+	if(root == 0) return cmd_hash[only - 1];
+
+	for(ii = 0; ii < sub_trie_count; ii++)
+		if(sub_trie[ii].ss_root == root) return &sub_trie[ii].ss_list[only - 1];
+
+	return 0;
+}
+
+// the one entry a non empty prefix names, or 0
+
+static const void *trie_unique(int root, const char *prefix)
+{
+	int node;
+
+	if(*prefix == 0 || (node = trie_find(root, prefix, strlen(prefix))) < 0) return 0;
+
+	return trie_entry(root, shell_trie[node].st_only);
+}
+
+// -1 if cmd's names and sub commands might not fit, the most they could take
+
+static int trie_room(const Shell_cmd *cmd)
+{
+	int need, ii;
+
+	need = strlen(cmd->sc_name) + strlen(cmd->sc_abrev);
+
+	if(cmd->sc_sub && sub_trie_root(cmd->sc_sub) < 0) {
+		if(sub_trie_count == SHELL_SUB_TABLES) return -1;
+		need++;
+		for(ii = 0; ii < cmd->sc_sub_len; ii++)
+			need += strlen(cmd->sc_sub[ii].ssc_name) + strlen(cmd->sc_sub[ii].ssc_abrev);
+	}
+	return trie_count + need > SHELL_TRIE_NODES ? -1 : 0;
+}
+
+// after cmd is in cmd_hash, the slot of its name stands for it
+
+static void trie_add_cmd(const Shell_cmd *cmd)
+{
+	uint16_t entry = shell_hash_slot(cmd->sc_name) - cmd_hash + 1;
+	int root, ii;
+
+	trie_add(0, cmd->sc_name, entry);
+	trie_add(0, cmd->sc_abrev, entry);
+
+	if(cmd->sc_sub == 0 || sub_trie_root(cmd->sc_sub) >= 0) return;
+
+	root = trie_count++;
+	memset(&shell_trie[root], 0, sizeof(Shell_trie));
+	sub_trie[sub_trie_count].ss_list = cmd->sc_sub;
+	sub_trie[sub_trie_count++].ss_root = root;
+
+	for(ii = 0; ii < cmd->sc_sub_len; ii++) {
+		trie_add(root, cmd->sc_sub[ii].ssc_name, ii + 1);
+		trie_add(root, cmd->sc_sub[ii].ssc_abrev, ii + 1);
 	}
-	return (Shell_cmd*) 0;
 }
 
 /**
@@ -99,7 +325,8 @@ enum {
 	SHELL_ADD_CMD_MIN_ARG_CNT_GT_MAX_ARG_CNT = 7,
 	SHELL_ADD_CMD_NUM_ARGS_EXCEEDED = 8,
 	SHELL_ADD_CMD_ALREADY_ADDED = 9,
-	SHELL_ADD_CMD_ERROR_COUNT = 9,
+	SHELL_ADD_CMD_TABLE_FULL = 10,
+	SHELL_ADD_CMD_ERROR_COUNT = 10,
 };
 
 static const char *shell_add_cmd_error[] = {
@@ -112,6 +339,7 @@ static const char *shell_add_cmd_error[] = {
 	"minimum arg count is greater than maximum arg count",
 	"number of argugments exceeds the number allowed",
 	"command already added",
+	"too many commands, raise SHELL_HASH_SIZE or SHELL_TRIE_NODES",
 	"unknown error",
 };
 
@@ -127,7 +355,7 @@ const char *shell_add_cmd_error_str(int err_code)
 	return shell_add_cmd_error[err_code];
 }
 
-static int validate_cmd(Shell_cmd *cmd)
+static int validate_cmd(const Shell_cmd *cmd)
 {
 	if(cmd == 0)
 		return -SHELL_ADD_CMD_NULL;
@@ -149,12 +377,12 @@ static int validate_cmd(Shell_cmd *cmd)
 	return 0;
 }
 
-int shell_add_cmd(Shell_cmd *cmd)
+// validate cmd and put it in the lookup table
+
+static int shell_hash_add(const Shell_cmd *cmd)
 {
-	// need to validate the cmd somehow
-	
-	int ret;
-	Shell_cmd *prior;
+	int ret, keys;
+	const Shell_cmd *prior;
 
 	if((ret = validate_cmd(cmd))) return ret;
 
@@ -163,6 +391,23 @@ int shell_add_cmd(Shell_cmd *cmd)
 
 	if(prior) return -SHELL_ADD_CMD_ALREADY_ADDED;
 
+	keys = strcmp(cmd->sc_name, cmd->sc_abrev) ? 2 : 1;
+	if(cmd_hash_count + keys > SHELL_HASH_MAX || trie_room(cmd) < 0) return -SHELL_ADD_CMD_TABLE_FULL;
+
+	*shell_hash_slot(cmd->sc_name) = cmd;
+	*shell_hash_slot(cmd->sc_abrev) = cmd;
+	cmd_hash_count += keys;
+	trie_add_cmd(cmd);
+
+	return 0;
+}
+
+int shell_add_cmd(Shell_cmd *cmd)
+{
+	int ret;
+
+	if((ret = shell_hash_add(cmd))) return ret;
+
 	// use list macros pulled from Linux sources
 	// see list.h
 
@@ -171,6 +416,25 @@ int shell_add_cmd(Shell_cmd *cmd)
 	return 0;
 }
 
+/*
+ * the SHELL_COMMAND ones, a bad one is reported and left out
+ */
+
+static void shell_index_cmds()
+{
+	const Shell_cmd *const *entry;
+	int ret;
+
+	for(entry = __start_shell_cmd; entry < __stop_shell_cmd; entry++) {
+		if((ret = shell_hash_add(*entry)) == 0) continue;
+
+		PUTSS((*entry)->sc_name);
+		PUTSS(": ");
+		PUTSS(shell_add_cmd_error_str(ret));
+		PUTSS(newline);
+	}
+}
+
 /**
  * built in commands
  * help - print help for one command or for all commands
@@ -182,7 +446,7 @@ int shell_add_cmd(Shell_cmd *cmd)
 
 static int cmd_print_help(char *name)
 {
-	Shell_cmd *cmd;
+	const Shell_cmd *cmd;
 
 	cmd = shell_find_cmd(name);
 
@@ -198,35 +462,39 @@ static int cmd_print_help(char *name)
 	return 0;
 }
 
+static void cmd_print_line(const Shell_cmd *cmd)
+{
+	PUTSS(cmd->sc_name);
+	PUTSS(": ");
+	PUTSS(cmd->sc_abrev);
+	PUTSS(": ");
+	PUTSS(cmd->sc_help);
+	PUTSS(newline);
+}
+
 int shell_cmd_help(int sargc, char *sargv[])
 {
+	const Shell_cmd *const *entry;
 	Shell_cmd *cmd;
 
 	if(sargc == 2) {
 		cmd_print_help(sargv[1]);
 	}
 	else {
+		for(entry = __start_shell_cmd; entry < __stop_shell_cmd; entry++) {
+			if(shell_find_cmd((*entry)->sc_name) == *entry) cmd_print_line(*entry);
+		}
 		list_for_each_entry(cmd, &cmd_list, list) {
-			PUTSS(cmd->sc_name);
-			PUTSS(": ");
-			PUTSS(cmd->sc_abrev);
-			PUTSS(": ");
-			PUTSS(cmd->sc_help);
-			PUTSS(newline);
+			cmd_print_line(cmd);
 		}
 	}
 	return 1;
 }
 
-Shell_cmd cmd_help = {
-	.list = {0, 0},
-	.sc_name = "help",
-	.sc_abrev = "h",
-	.sc_help = "print this help",
-	.sc_func = shell_cmd_help,
-	.sc_min = 1,		// minimum number of substrings in command, at least 1
-	.sc_max = 2,		// maximum number of substrings, including arguments
-};
+// min is the minimum number of substrings in the command, at least 1, max the
+// maximum including arguments
+
+SHELL_COMMAND(cmd_help, "help", "h", "print this help", shell_cmd_help, 1, 2);
 
 /*
  *	this command allows the developer to set a breakpoint in the debugger at
@@ -249,15 +517,7 @@ int shell_cmd_break(int sargc, char *sargv[])
 	return force_break(1);
 }
 
-Shell_cmd cmd_break = {
-	.list = {0, 0},
-	.sc_name = "break",
-	.sc_abrev = "b",
-	.sc_help = "force a break to support a debugger",
-	.sc_func = shell_cmd_break,
-	.sc_min = 1,
-	.sc_max = 1,
-};
+SHELL_COMMAND(cmd_break, "break", "b", "force a break to support a debugger", shell_cmd_break, 1, 1);
 
 // place holder to put out help string
 
@@ -266,23 +526,20 @@ int shell_cmd_quit(int sargc, char *sargv[])
 	return 0;
 }
 
-Shell_cmd cmd_quit = {
-	.list = {0, 0},
-	.sc_name = "q",
-	.sc_abrev = "q",
-	.sc_help = "type three 'q' characters in a row to quit or reset",
-	.sc_func = shell_cmd_quit,
-	.sc_min = 1,
-	.sc_max = 1,
-};
+SHELL_COMMAND(cmd_quit, "q", "q", "type three 'q' characters in a row to quit or reset",
+		shell_cmd_quit, 1, 1);
 
 /**
  * sub_cmd_list_search is provided for commands that implement sub commands
+ *
+ * the tables are short, a name is looked for in order.  A table indexed for
+ * a SHELL_COMMAND_SUBS() takes a unique prefix after that.
  */
 
-int shell_sub_cmd_list_search(char *sub_cmd, Shell_sub_cmd *sub_cmd_list, int sub_cmd_list_len)
+int shell_sub_cmd_list_search(char *sub_cmd, const Shell_sub_cmd *sub_cmd_list, int sub_cmd_list_len)
 {
-	int ii;
+	const Shell_sub_cmd *sub;
+	int ii, root;
 
 	for(ii = 0; ii < sub_cmd_list_len; ii++) {
 		if((strcmp(sub_cmd, sub_cmd_list[ii].ssc_abrev) == 0)
@@ -290,7 +547,11 @@ int shell_sub_cmd_list_search(char *sub_cmd, Shell_sub_cmd *sub_cmd_list, int su
 			return ii;
 		}
 	}
-	return -1;
+
+	if((root = sub_trie_root(sub_cmd_list)) < 0) return -1;
+	if((sub = trie_unique(root, sub_cmd)) == 0) return -1;
+
+	return sub - sub_cmd_list;
 }
 
 // break a buffer containing a command into sub strings
@@ -340,137 +601,510 @@ static int convert_cmd_buf_to_substr(char *cmd_buf, int len, char *nargv[], int
 	return nargc;
 }
 
-// called with input character from console
+/*
+ * line editing and history
+ *
+ * 	left, right, ^B, ^F		move the cursor
+ * 	home, end, ^A, ^E		to the start or the end
+ * 	backspace, delete, ^D		delete before or under the cursor
+ * 	^U				delete the line
+ * 	up, down, ^P, ^N		the lines before
+ * 	tab				completes a command, see line_complete()
+ *
+ * the keys are the VT100 ESC [ x and ESC O x sequences, and ESC [ n ~ for
+ * home, end and delete.  Everything a key echoes goes out in one PUTSS, an
+ * insert in the middle redraws the tail and backs up over it with \b.
+ *
+ * the history is a static ring of SHELL_HIST_SIZE bytes, lines end in a 0.
+ * A new line drops whole lines from the old end until it fits, so it holds
+ * more short lines than long ones.  Empty lines and a repeat of the last one
+ * aren't kept.
+ */
 
-// add the new byte to the buffer.
-// 		return count of bytes if a newline or if the buffer is full
-// 		need to do line editing
-//
-// 	return 0, or the length of the filled command line buffer
+#ifndef SHELL_HIST_SIZE
+#define SHELL_HIST_SIZE (512)
+#endif
 
-static int add_to_cmdline_buffer(char byte_in)
+static char hist_buf[SHELL_HIST_SIZE];
+static uint16_t hist_end;			// where the next line goes
+static uint16_t hist_used;			// bytes of whole lines
+static int hist_pos;				// 0 is the line being typed, 1 the last one
+
+static int16_t cmdline_cur;			// cursor, 0 to cmdline_buf_ind
+static uint8_t esc_state;			// 1 after ESC, 2 after ESC [, 3 after ESC [ n
+static char esc_num;
+
+static char echo_buf[CMDLINE_BUF_LEN * 3 + 8];
+static int echo_len;
+
+#define HIST_AT(ii) (hist_buf[(ii) % SHELL_HIST_SIZE])
+
+// copy the nth line back into line, return the length or -1 if there isn't one
+
+static int hist_get(int nth, char *line)
 {
-	if(byte_in == '\n' || byte_in == '\r') {
-		cmdline_buf[cmdline_buf_ind++] = 0;
-		PUTSS(newline);
-		return cmdline_buf_ind;
-	}
+	int start = hist_end + SHELL_HIST_SIZE, first = start - hist_used;
+	int len;
 
-	else if(byte_in == '\b' || byte_in == 0x7f) {		// backspace or delete key
-		if(cmdline_buf_ind) {
-			cmdline_buf[cmdline_buf_ind--] = 0;
-			PUTCC('\b');			// back space
-			PUTCC(' ');			// space
-			PUTCC('\b');			// back space
-		}
-	}
+	if(nth <= 0) return -1;
 
-	else {
-		PUTCC(byte_in);
-		if(!(ISSPACE(byte_in))) buffer_has_data = 1;
-		cmdline_buf[cmdline_buf_ind++] = byte_in;
+	while(nth--) {
+		if(start <= first) return -1;
+		for(start--; start > first && HIST_AT(start - 1); start--) ;
 	}
+	for(len = 0; HIST_AT(start + len); len++) line[len] = HIST_AT(start + len);
+	line[len] = 0;
+
+	return len;
+}
+
+static void hist_add(char *line, int len)
+{
+	char last[CMDLINE_BUF_LEN];
+	int ii;
 
-	if(cmdline_buf_ind == (CMDLINE_BUF_LEN - 1)) {
-		cmdline_buf[cmdline_buf_ind++] = 0;
-		return cmdline_buf_ind;
+	if(len == 0 || len >= SHELL_HIST_SIZE) return;
+	if(hist_get(1, last) == len && memcmp(last, line, len) == 0) return;
+
+	while(hist_used + len + 1 > SHELL_HIST_SIZE) {	// drop the oldest
+		int first = hist_end + SHELL_HIST_SIZE - hist_used;
+		while(HIST_AT(first)) first++, hist_used--;
+		hist_used--;
 	}
 
-	return 0;
+	for(ii = 0; ii < len; ii++) HIST_AT(hist_end + ii) = line[ii];
+	HIST_AT(hist_end + len) = 0;
+	hist_end = (hist_end + len + 1) % SHELL_HIST_SIZE;
+	hist_used += len + 1;
 }
 
-/**
- * for some commands, like memory probe, we want to be able to handle input
- * directly.
- *
- * For those commands, input bypasses the shell and goes directly to the command
- * The command routine needs to register the pass_to function on first entry
- * After that, all input is handled by the pass_to function
- * When the routine is done, function needs to be deregistered
- *
- * Note that it can only be called once.
- *
- * See mem_db.c for an example of how this works.
- */
+static void echo_c(char cc)
+{
+	if(echo_len < (int)sizeof(echo_buf) - 1) echo_buf[echo_len++] = cc;
+}
 
-static int (*pass_to_func)(char) = 0;
+static void echo_back(int count)
+{
+	while(count-- > 0) echo_c('\b');
+}
 
-int shell_set_pass_to(int (*func)(char))		// start pass_to
+// the line from the cursor on, then back to the cursor
+
+static void echo_tail(int erase)
 {
-	if(pass_to_func == 0) {
-		pass_to_func = func;
-		return 0;
-	}
-	return -1;				// error
+	int ii;
+
+	for(ii = cmdline_cur; ii < cmdline_buf_ind; ii++) echo_c(cmdline_buf[ii]);
+	for(ii = 0; ii < erase; ii++) echo_c(' ');
+	echo_back(cmdline_buf_ind - cmdline_cur + erase);
 }
 
-/**
- * the bypass function is different
- */
+static void echo_flush()
+{
+	if(echo_len == 0) return;
 
-static int (*bypass_func)(char) = 0;
+	echo_buf[echo_len] = 0;
+	PUTSS(echo_buf);
+	echo_len = 0;
+}
 
-int shell_set_bypass_func(int (*func)(char))		// start bypass
+static void line_set(const char *line, int len)
 {
-	if(bypass_func == 0) {
-		bypass_func = func;
-		return 0;
-	}
-	return -1;				// error
+	int old = cmdline_buf_ind, ii;
+
+	echo_back(cmdline_cur);
+	memcpy(cmdline_buf, line, len);
+	cmdline_buf_ind = len;
+	cmdline_cur = len;
+	for(ii = 0; ii < len; ii++) echo_c(cmdline_buf[ii]);
+	for(ii = len; ii < old; ii++) echo_c(' ');
+	echo_back(old - len);
+
+	buffer_has_data = 0;
+	for(ii = 0; ii < len; ii++) if(!(ISSPACE(line[ii]))) buffer_has_data = 1;
 }
 
-void shell_clear_pass_to()						// end pass_to
+static void line_recall(int pos)
 {
-	pass_to_func = 0;
+	char line[CMDLINE_BUF_LEN];
+	int len;
+
+	if(pos < 0) return;
+	if(pos == 0) len = 0;
+	else if((len = hist_get(pos, line)) < 0) return;
+
+	hist_pos = pos;
+	line_set(line, len);
 }
 
-void shell_clear_bypass()						// end bypass function
+static void line_delete(int at)
 {
-	bypass_func = 0;
+	if(at < 0 || at >= cmdline_buf_ind) return;
+
+	echo_back(cmdline_cur - at);
+	cmdline_cur = at;
+	memmove(&cmdline_buf[at], &cmdline_buf[at + 1], cmdline_buf_ind - at - 1);
+	cmdline_buf_ind--;
+	echo_tail(1);
 }
 
-/*
- * called with input character
- *
- * put in the buffer, do line editing to support
- * backspace, etc
- *
- * if it is a 'q', count three without a command and return -1
- *
- * return 1 if a prompt should be printed, else return 0
- *D
+static void line_insert(char byte_in)
+{
+	if(cmdline_buf_ind == (CMDLINE_BUF_LEN - 1)) return;	// full, room for the 0
 
+	memmove(&cmdline_buf[cmdline_cur + 1], &cmdline_buf[cmdline_cur], cmdline_buf_ind - cmdline_cur);
+	cmdline_buf[cmdline_cur] = byte_in;
+	cmdline_buf_ind++;
+	echo_c(byte_in);
+	cmdline_cur++;
+	echo_tail(0);
 
- * support bypassing this and handing input character to other
- * processing routine, e.g., memory probe
- */
+	if(!(ISSPACE(byte_in))) buffer_has_data = 1;
+}
 
-int shell_process_input(char cc)
+static void line_move(int to)
 {
-	int ret = 0;
-	Shell_cmd *cmd;
-	int buffer_len = 0;
-	static int q_count = 0;
-	char byte_in;
+	if(to < 0 || to > cmdline_buf_ind) return;
 
-	byte_in = TOLOWER(cc);
+	echo_back(cmdline_cur - to);
+	for(; cmdline_cur < to; cmdline_cur++) echo_c(cmdline_buf[cmdline_cur]);
+	cmdline_cur = to;
+}
 
-	// we are called with a character
+/*
+ * tab completes the word before the cursor, a command or the sub command of
+ * a SHELL_COMMAND_SUBS(), as far as the names that start with it agree, and
+ * puts a space after a whole one.  When that adds nothing the names are
+ * listed and the line drawn again.
+ */
 
-	if(pass_to_func) {		// if pass through is set, send char to that func
-		ret = (*pass_to_func)(byte_in);
-		return ret;
-	}
+void shell_print_prompt();
 
-	// if buffer is empty and we get a q or Q
-	// NB: q can be part of a command or argument, just the the first letter
-	// on an empty command line
+static void trie_list(int node, char *name, int len)
+{
+	int child;
 
-	else if((cmdline_buf_ind == 0 || buffer_has_data == 0)&& (byte_in == '\r' || byte_in == '\n')) {
-		return 1;			// empty line, print prompt
+	if(shell_trie[node].st_end) {
+		name[len] = 0;
+		PUTSS("  ");
+		PUTSS(name);
 	}
-	else if(cmdline_buf_ind == 0 && (byte_in == 'q')) {
-		q_count++;
+	if(len == CMDLINE_BUF_LEN - 1) return;
+
+	for(child = shell_trie[node].st_child; child; child = shell_trie[child].st_next) {
+		name[len] = shell_trie[child].st_ch;
+		trie_list(child, name, len + 1);
+	}
+}
+
+// the root for a word at start, the commands' or a sub command table's, or -1
+
+static int line_complete_root(int start)
+{
+	const Shell_cmd *cmd;
+	char name[CMDLINE_BUF_LEN];
+	int first, end;
+
+	for(first = 0; first < start && ISSPACE(cmdline_buf[first]); first++) ;
+	if(first == start) return 0;
+
+	for(end = first; !ISSPACE(cmdline_buf[end]); end++) ;
+	memcpy(name, &cmdline_buf[first], end - first);
+	name[end - first] = 0;
+
+	for(; end < start; end++) if(!ISSPACE(cmdline_buf[end])) return -1;	// a third word
+
+	if((cmd = shell_find_cmd(name)) == 0) cmd = trie_unique(0, name);
+	if(cmd == 0 || cmd->sc_sub == 0) return -1;
+
+	return sub_trie_root(cmd->sc_sub);
+}
+
+static void line_complete()
+{
+	char name[CMDLINE_BUF_LEN];
+	int start, root, node, child, typed, ii;
+
+	if(cmdline_cur < cmdline_buf_ind && !ISSPACE(cmdline_buf[cmdline_cur])) return;
+
+	for(start = cmdline_cur; start && !ISSPACE(cmdline_buf[start - 1]); start--) ;
+
+	if((root = line_complete_root(start)) < 0
+			|| (node = trie_find(root, &cmdline_buf[start], cmdline_cur - start)) < 0) {
+		echo_c('\a');
+		return;
+	}
+
+	typed = cmdline_cur;
+	while(!shell_trie[node].st_end && (child = shell_trie[node].st_child)
+			&& shell_trie[child].st_next == 0) {
+		node = child;
+		line_insert(shell_trie[node].st_ch);
+	}
+	if(shell_trie[node].st_end && shell_trie[node].st_only != TRIE_MANY) {
+		if(cmdline_cur == cmdline_buf_ind) line_insert(' ');
+		return;
+	}
+	if(cmdline_cur != typed) return;
+
+	echo_flush();
+	PUTSS(newline);
+	memcpy(name, &cmdline_buf[start], cmdline_cur - start);
+	trie_list(node, name, cmdline_cur - start);
+	PUTSS(newline);
+	shell_print_prompt();
+
+	for(ii = 0; ii < cmdline_buf_ind; ii++) echo_c(cmdline_buf[ii]);
+	echo_back(cmdline_buf_ind - cmdline_cur);
+}
+
+// the key after ESC, the ones with ~ are ESC [ n ~
+
+static void line_escape(char byte_in)
+{
+	if(esc_state == 1) {
+		esc_state = (byte_in == '[' || byte_in == 'O') ? 2 : 0;
+		return;
+	}
+	if(esc_state == 2 && byte_in >= '0' && byte_in <= '9') {
+		esc_num = byte_in;
+		esc_state = 3;
+		return;
+	}
+	if(esc_state == 3) {
+		esc_state = 0;
+		if(byte_in != '~') return;
+		if(esc_num == '1' || esc_num == '7') line_move(0);
+		if(esc_num == '4' || esc_num == '8') line_move(cmdline_buf_ind);
+		if(esc_num == '3') line_delete(cmdline_cur);
+		return;
+	}
+
+	esc_state = 0;
+	switch(byte_in) {
+	case 'A': line_recall(hist_pos + 1); break;
+	case 'B': line_recall(hist_pos - 1); break;
+	case 'C': line_move(cmdline_cur + 1); break;
+	case 'D': line_move(cmdline_cur - 1); break;
+	case 'H': line_move(0); break;
+	case 'F': line_move(cmdline_buf_ind); break;
+	}
+}
+
+// called with input character from console
+//
+// 	return 0, or the length of the filled command line buffer
+
+static int add_to_cmdline_buffer(char byte_in)
+{
+	int len = 0;
+
+	if(esc_state) line_escape(byte_in);
+
+	else switch(byte_in) {
+	case '\n':
+	case '\r':
+		cmdline_buf[cmdline_buf_ind] = 0;
+		if(buffer_has_data) hist_add(cmdline_buf, cmdline_buf_ind);
+		cmdline_cur = 0;
+		hist_pos = 0;
+		for(len = 0; newline[len]; len++) echo_c(newline[len]);
+		len = cmdline_buf_ind + 1;
+		break;
+	case '\b':
+	case 0x7f:	line_delete(cmdline_cur - 1); break;	// backspace or delete key
+	case 0x04:	line_delete(cmdline_cur); break;		// ^D
+	case 0x1b:	esc_state = 1; break;
+	case 0x01:	line_move(0); break;					// ^A
+	case 0x05:	line_move(cmdline_buf_ind); break;		// ^E
+	case 0x02:	line_move(cmdline_cur - 1); break;		// ^B
+	case 0x06:	line_move(cmdline_cur + 1); break;		// ^F
+	case 0x10:	line_recall(hist_pos + 1); break;		// ^P
+	case 0x0e:	line_recall(hist_pos - 1); break;		// ^N
+	case 0x15:	line_set("", 0); break;					// ^U
+	case '\t':	line_complete(); break;
+	default:
+		if(ISPRINT(byte_in)) line_insert(TOLOWER(byte_in));
+		break;
+	}
+
+	echo_flush();
+	return len;
+}
+
+/**
+ * for some commands, like memory probe, we want to be able to handle input
+ * directly.
+ *
+ * For those commands, input bypasses the shell and goes directly to the command
+ * The command routine needs to register the pass_to function on first entry
+ * After that, all input is handled by the pass_to function
+ * When the routine is done, function needs to be deregistered
+ *
+ * Note that it can only be called once.
+ *
+ * See mem_db.c for an example of how this works.
+ */
+
+static int (*pass_to_func)(char) = 0;
+
+int shell_set_pass_to(int (*func)(char))		// start pass_to
+{
+	if(pass_to_func == 0) {
+		pass_to_func = func;
+		return 0;
+	}
+	return -1;				// error
+}
+
+/**
+ * the bypass function is different
+ */
+
+static int (*bypass_func)(char) = 0;
+
+int shell_set_bypass_func(int (*func)(char))		// start bypass
+{
+	if(bypass_func == 0) {
+		bypass_func = func;
+		return 0;
+	}
+	return -1;				// error
+}
+
+void shell_clear_pass_to()						// end pass_to
+{
+	pass_to_func = 0;
+}
+
+void shell_clear_bypass()						// end bypass function
+{
+	bypass_func = 0;
+}
+
+/*
+ * run one command line, shared by the console and scripts.  Returns what the
+ * command returns, 1 for a comment or a bad line, 0 for no words.  *status
+ * says which, shell_print_status() prints what was wrong.
+ */
+
+enum {
+	SHELL_LINE_RAN = 0,
+	SHELL_LINE_EMPTY,
+	SHELL_LINE_COMMENT,
+	SHELL_LINE_BAD_CMD,
+	SHELL_LINE_BAD_ARGS,
+	SHELL_LINE_TOO_LONG,
+};
+
+#define SHELL_LINE_FAILED(status) ((status) >= SHELL_LINE_BAD_CMD)
+
+static const Shell_cmd *exec_cmd;		// the command the last line named, by name or prefix
+
+static int shell_exec(char *line, int len, int *status)
+{
+	const Shell_cmd *cmd;
+	int cargc, ret;
+
+	exec_cmd = 0;
+	cargc = convert_cmd_buf_to_substr(line, len, cargv, CMD_BUF_NARGS);
+
+	if(cargc == 0) {
+		*status = SHELL_LINE_EMPTY;
+		return 0;
+	}
+	if(cargv[0][0] == '#') {			// treat '#' as a commment
+		*status = SHELL_LINE_COMMENT;
+		return 1;
+	}
+	if((cmd = shell_find_cmd(cargv[0])) == 0 && (cmd = trie_unique(0, cargv[0])) == 0) {
+		*status = SHELL_LINE_BAD_CMD;
+		return 1;
+	}
+	exec_cmd = cmd;
+	if(cargc < cmd->sc_min || cargc > cmd->sc_max) {
+		*status = SHELL_LINE_BAD_ARGS;
+		return 1;
+	}
+
+	*status = SHELL_LINE_RAN;
+	ret = (*cmd->sc_func)(cargc, cargv);
+	FLUSHCC();
+
+	return ret;
+}
+
+// cargv[0] is still the command the line named
+
+static void shell_print_status(int status)
+{
+	const Shell_cmd *cmd = exec_cmd;
+	char obuf[9];
+
+	switch(status) {
+	case SHELL_LINE_BAD_CMD:		// had a string, but couldn't find it in list
+		PUTSS("bad command, ");
+		PUTSS(cargv[0]);
+		break;
+	case SHELL_LINE_BAD_ARGS:
+		PUTSS("wrong number of arguments, should be ");
+		PUTSS(format_x((uint32_t) cmd->sc_min, 2, obuf));
+		PUTSS(" <= x <= ");
+		PUTSS(format_x((uint32_t) cmd->sc_max, 2, obuf));
+		break;
+	case SHELL_LINE_TOO_LONG:
+		PUTSS("line too long");
+		break;
+	default:
+		return;
+	}
+	PUTSS(newline);
+}
+
+/*
+ * called with input character
+ *
+ * put in the buffer, do line editing to support
+ * backspace, etc
+ *
+ * if it is a 'q', count three without a command and return -1
+ *
+ * return 1 if a prompt should be printed, else return 0
+ *D
+
+
+ * support bypassing this and handing input character to other
+ * processing routine, e.g., memory probe
+ */
+
+int shell_process_input(char cc)
+{
+	int ret = 0;
+	int buffer_len = 0;
+	static int q_count = 0;
+	char byte_in;
+
+	byte_in = TOLOWER(cc);
+
+	// we are called with a character
+
+	if(pass_to_func) {		// if pass through is set, send char to that func
+		ret = (*pass_to_func)(byte_in);
+		return ret;
+	}
+
+	// if buffer is empty and we get a q or Q
+	// NB: q can be part of a command or argument, just the the first letter
+	// on an empty command line
+
+	else if((cmdline_buf_ind == 0 || buffer_has_data == 0)&& (byte_in == '\r' || byte_in == '\n')) {
+		cmdline_buf_ind = 0;
+		cmdline_cur = 0;
+		hist_pos = 0;
+		return 1;			// empty line, print prompt
+	}
+	else if(cmdline_buf_ind == 0 && esc_state == 0 && (byte_in == 'q')) {
+		q_count++;
 
 		if(q_count == 1) {
 			PUTSS("q : that's 1, exit on 2 more\n\r");
@@ -487,46 +1121,17 @@ int shell_process_input(char cc)
 	}
 
 	else {							// else process normally
-		buffer_len = add_to_cmdline_buffer(byte_in);
+		buffer_len = add_to_cmdline_buffer(cc);		// line editing wants the case of ESC sequences
 
 		// if buffer_len is non zero, we have a buffer to process
 
 		if(buffer_len) {
-			int cargc;
-
-			cargc = convert_cmd_buf_to_substr(cmdline_buf, buffer_len, cargv, CMD_BUF_NARGS);
+			int status;
 
-			if(cargc) {
+			ret = shell_exec(cmdline_buf, buffer_len, &status);
+			shell_print_status(status);
+			if(status != SHELL_LINE_EMPTY) q_count = 0;
 
-				if(cargv[0][0] == '#') {
-					// treat '#' as a commment
-					ret = 1;
-				}
-				else if((cmd = shell_find_cmd(cargv[0])) != 0) {
-					int (*func)(int argc, char *argv[]);
-
-					if(cargc < cmd->sc_min || cargc > cmd->sc_max) {
-						char obuf[9];
-						PUTSS("wrong number of arguments, should be ");
-						PUTSS(format_x((uint32_t) cmd->sc_min, 2, obuf));
-						PUTSS(" <= x <= ");
-						PUTSS(format_x((uint32_t) cmd->sc_max, 2, obuf));
-						PUTSS(newline);
-						ret = 1;
-					}
-					else {
-						func = cmd->sc_func;
-						ret = (*func)(cargc, cargv);
-					}
-				}
-				else {	// had a string, but couldn't find it in list
-					PUTSS("bad command, ");
-					PUTSS(cargv[0]);
-					PUTSS(newline);
-					ret = 1;
-				}
-				q_count = 0;
-			}
 			cmdline_buf_ind = 0;
 			buffer_has_data = 0;
 		}
@@ -536,11 +1141,169 @@ int shell_process_input(char cc)
 	return 0;
 }
 
+/*
+ * batch mode, scripts of command lines with no echo and no prompt
+ *
+ * a script is run from memory by shell_run_script(), from a file on the host
+ * by shell_run_file(), "console/shell -f script.txt", and on the target by
+ * "run addr len" from flash or "run" and the lines sent to the console, up to
+ * a line with just a '.' or a ^D.  A bad line stops it, "line 12: bad command,
+ * foo" says where.  Lines end with \n, \r or both.
+ */
+
+static Shell_task *shell_task;
+static int shell_step();
+
+// -1 for a bad line, which is printed, else what the command returned
+
+static int shell_run_line(char *line, int len, int line_num)
+{
+	char obuf[12];
+	int ret, status;
+
+	if(len >= CMDLINE_BUF_LEN) status = SHELL_LINE_TOO_LONG;
+	else ret = shell_exec(line, len, &status);
+
+	if(!SHELL_LINE_FAILED(status)) {
+		while(shell_task) shell_step();		// a task runs to its end
+		return ret;
+	}
+
+	PUTSS("line ");
+	PUTSS(format_u((uint32_t) line_num, obuf));
+	PUTSS(": ");
+	shell_print_status(status);
+
+	return -1;
+}
+
+/*
+ * returns 0, or the number of the line that stopped it
+ */
+
+int shell_run_script(const char *script, int len)
+{
+	char line[CMDLINE_BUF_LEN];
+	int pos = 0, start, line_num = 0;
+
+	while(pos < len) {
+		start = pos;
+		while(pos < len && script[pos] != '\n' && script[pos] != '\r') pos++;
+		line_num++;
+
+		if(pos - start < CMDLINE_BUF_LEN) {
+			memcpy(line, &script[start], pos - start);
+			line[pos - start] = 0;
+		}
+		if(shell_run_line(line, pos - start, line_num) < 0) return line_num;
+
+		if(pos < len && script[pos] == '\r') pos++;
+		if(pos < len && script[pos] == '\n') pos++;
+	}
+
+	return 0;
+}
+
+/*
+ * "run" with no arguments, the lines come through pass_to.  After a bad line
+ * the rest are dropped up to the end.
+ *
+ * there is no flow control, the receive fifo holds a line or two, not a
+ * script.  "run> " goes out when the run is ready for the next line, the
+ * host sends one and waits for it, after a stop too, the rest are dropped.
+ * A line whose bytes were lost on the way in, LOSTCC() moved, stops the run.
+ */
+
+#define SHELL_RUN_READY		"run> "
+
+static char run_line[CMDLINE_BUF_LEN];
+static int run_len, run_line_num, run_failed;
+static uint32_t run_lost;
+
+static int shell_run_pass(char cc)
+{
+	char obuf[12];
+	int end;
+
+	if(cc != '\n' && cc != '\r' && cc != 0x04) {
+		if(run_len < CMDLINE_BUF_LEN) run_line[run_len] = cc;
+		run_len++;
+		return 0;
+	}
+
+	// \r\n is one line end
+
+	if(cc == '\n' && run_len == 0 && run_line[0] == '\r') {
+		run_line[0] = 0;
+		return 0;
+	}
+
+	end = cc == 0x04 || (run_len == 1 && run_line[0] == '.');
+	if(!end && !run_failed) {
+		run_line_num++;
+		if(run_len < CMDLINE_BUF_LEN) run_line[run_len] = 0;
+		if(LOSTCC() != run_lost) {
+			PUTSS("line ");
+			PUTSS(format_u((uint32_t) run_line_num, obuf));
+			PUTSS(": input lost");
+			PUTSS(newline);
+			run_failed = run_line_num;
+		}
+		else if(shell_run_line(run_line, run_len, run_line_num) < 0) run_failed = run_line_num;
+	}
+	run_len = 0;
+	run_line[0] = cc;
+
+	if(!end) {
+		PUTSS(SHELL_RUN_READY);
+		return 0;
+	}
+
+	shell_clear_pass_to();
+	PUTSS(format_u((uint32_t) run_line_num, obuf));
+	PUTSS(run_failed ? " lines, stopped" : " lines, done");
+	PUTSS(newline);
+
+	return 1;
+}
+
+int shell_cmd_run(int sargc, char *sargv[])
+{
+	if(sargc == 3) {
+#ifdef CONSOLE_BUILD
+		PUTSS("run addr len is for the target, run a file with -f");
+		PUTSS(newline);
+#else
+		if(STRTOL(sargv[2]) < 0) {
+			PUTSS("run: len is negative");
+			PUTSS(newline);
+		}
+		else shell_run_script((const char*) (uintptr_t) STRTOL(sargv[1]), STRTOL(sargv[2]));
+#endif // CONSOLE_BUILD
+		return 1;
+	}
+
+	if(shell_set_pass_to(shell_run_pass) < 0) {
+		PUTSS("could set pass to function\r\n");
+		return 1;
+	}
+	run_len = run_line_num = run_failed = 0;
+	run_line[0] = 0;
+	run_lost = LOSTCC();
+	PUTSS(SHELL_RUN_READY);
+
+	return 0;
+}
+
+SHELL_COMMAND(cmd_run, "run", "run",
+		"run [addr len] : run the script at addr, or the lines sent up to a '.' line",
+		shell_cmd_run, 1, 3);
+
 char *shell_prompt_string = 0;
 
 void shell_print_prompt()
 {
-	PUTSS(shell_prompt_string);
+	if(shell_prompt_string) PUTSS(shell_prompt_string);
 }
 
 #ifdef CONSOLE_BUILD
@@ -550,40 +1313,77 @@ void shell_print_prompt()
 #endif // CONSOLE_BUILD
 
 /*
- * shell_init() initializes the cmd_list.
+ * shell_init() initializes the cmd_list and indexes the SHELL_COMMAND ones.
  *
  * THIS MUST BE DONE ONCE.
  */
 
+static void shell_cmds_init()
+{
+	INIT_LIST_HEAD(&cmd_list);
+	shell_hash_clear();
+	shell_index_cmds();
+}
+
 int shell_init(char *prompt_string)
 {
 #ifdef CONSOLE_BUILD
 
+	stdio_obuf();		// before any output
 	initscr();			// these three calls allow for raw tty input
 	noecho();
 	cbreak();
+	setvbuf(stdin, 0, _IONBF, 0);	// so AVAILCC() sees every character
 
 #endif // CONSOLE_BUILD
 
+	shell_cmds_init();
 
-	INIT_LIST_HEAD(&cmd_list);
+	shell_prompt_string = prompt_string;
 
-	// set up the terminal to allow no character processing
+	return 0;
+}
 
-	shell_add_cmd(&cmd_help);
-	shell_add_cmd(&cmd_break);
-	shell_add_cmd(&cmd_quit);
+#ifdef CONSOLE_BUILD
 
-	shell_prompt_string = prompt_string;
+/*
+ * batch mode on the host, in place of shell_init() and the shell loop.
+ * Returns 0, the number of the line that stopped the script, or -1 if the
+ * file can't be read.
+ */
 
-	return 0;
+int shell_run_file(char *path)
+{
+	FILE *ff;
+	char *script;
+	long len;
+	int ret = -1;
+
+	shell_cmds_init();
+
+	if((ff = fopen(path, "rb")) == 0) {
+		perror(path);
+		return -1;
+	}
+	if(fseek(ff, 0, SEEK_END) == 0 && (len = ftell(ff)) >= 0 && fseek(ff, 0, SEEK_SET) == 0
+			&& (script = malloc(len + 1)) != 0) {
+		if(fread(script, 1, len, ff) == len) ret = shell_run_script(script, (int) len);
+		else perror(path);
+		free(script);
+	}
+	fclose(ff);
+
+	return ret;
 }
 
+#endif // CONSOLE_BUILD
+
 int shell_exit()
 {
 #ifdef CONSOLE_BUILD
 
 
+	FLUSHCC();
 	nocbreak();		 // restore the terminal
 	noecho();
 	endwin();
@@ -604,41 +1404,131 @@ int shell_exit()
 }
 
 /*
- * this is a function that performs the heart of the shell, but allows
- * the caller to work around it.
- *
- * for example, it can be called from a pthread for a desktop program.
- * see mem_db.c.  After calling shell_init(), it addes some commands
- * via mem_db_init().
- *
- * if called with a non-zero arg, it prints the prompt
- *
- * shell_process_input returns < 0, 0 or 1
+ * the non blocking shell
  *
+ * 	shell_init(" :> ");
+ * 	while(shell_poll() >= 0) shell_wait();
+ * 	shell_exit();
  *
+ * shell_poll() takes the input there is, calls the poll hooks and a slice of
+ * the task, if one is running, and returns < 0 to exit.  Between calls the
+ * main loop can do its own work.  The input waits at most one slice.
  */
 
-int shell_func(int print_prompt)
+static int shell_prompt_due = 1;
+static int shell_held;				// length of a line typed during the task
+
+int shell_task_start(Shell_task *task)
 {
-	int cc;
-	int ret = 0;
+	if(shell_task) return -1;
 
-	if(print_prompt == 1) {
-		shell_print_prompt();
-	}
+	task->st_cancel = 0;
+	shell_task = task;
+
+	return 0;
+}
 
-	cc = GETCC();
+// one input character, returns < 0, 0 or 1 like shell_process_input()
+
+static int shell_feed(int cc)
+{
+	if(bypass_func) return (*bypass_func)(cc);
+	if(cc == EOF || cc == 0) return 0;
+	if(shell_task == 0) return shell_process_input(cc);
 
-	if(bypass_func) {
-		ret = (*bypass_func)(cc);
+	if(cc == 0x03) {				// ^C
+		shell_task->st_cancel = 1;
+		return 0;
 	}
-	else if(cc != EOF && cc != 0) {
-		ret = shell_process_input(cc);
+	if(shell_held == 0) shell_held = add_to_cmdline_buffer(cc);
+
+	return 0;
+}
+
+// a slice of the task, the held line when it ends
+
+static int shell_step()
+{
+	int ret = 0, status;
+
+	if(shell_task == 0) return 0;
+	if((*shell_task->st_step)(shell_task) && !shell_task->st_cancel) return 0;
+
+	if(shell_task->st_cancel) {
+		(*shell_task->st_step)(shell_task);
+		PUTSS("^C");
+		PUTSS(newline);
 	}
+	shell_task = 0;
+
+	if(shell_held == 0) return 1;
+
+	ret = shell_exec(cmdline_buf, shell_held, &status);
+	shell_print_status(status);
+	if(status == SHELL_LINE_EMPTY) ret = 1;
+	shell_held = 0;
+	cmdline_buf_ind = 0;
+	buffer_has_data = 0;
 
 	return ret;
 }
 
+int shell_poll()
+{
+	int (*const *hook)();
+	int ret, cc;
+
+	while(AVAILCC() && (cc = GETCC()) != EOF) {
+		if((ret = shell_feed(cc)) < 0) return ret;
+		if(ret) shell_prompt_due = 1;
+		if(shell_task) break;			// a slice before more input
+	}
+
+	for(hook = __start_shell_poll; hook < __stop_shell_poll; hook++) (**hook)();
+
+	if((ret = shell_step()) < 0) return ret;
+	if(ret) shell_prompt_due = 1;
+
+	if(shell_prompt_due && shell_task == 0 && pass_to_func == 0) {
+		shell_print_prompt();
+		shell_prompt_due = 0;
+	}
+	FLUSHCC();						// the echo, a slice's output, the prompt
+
+	return 0;
+}
+
+// wait for input when there is nothing else to do
+
+void shell_wait()
+{
+#ifdef CONSOLE_BUILD
+	struct pollfd pfd = { .fd = 0, .events = POLLIN };
+
+	if(shell_task == 0) poll(&pfd, 1, 1);
+#endif // CONSOLE_BUILD
+}
+
+/*
+ * the heart of the shell for a caller that loops around it, from a pthread
+ * for a desktop program for example, see byte_fifo.c.  One shell_poll(),
+ * the poll hooks and a slice of the task with it, then a wait for input.
+ * A print_prompt of 1 prompts again.
+ *
+ * returns < 0 to exit, else 0
+ */
+
+int shell_func(int print_prompt)
+{
+	int ret;
+
+	if(print_prompt == 1) shell_prompt_due = 1;
+	if((ret = shell_poll()) < 0) return ret;
+	shell_wait();
+
+	return 0;
+}
+
 /*
  * this is how to use shell_func()
  *
@@ -653,17 +1543,9 @@ int shell_func(int print_prompt)
 
 void shell_proc()
 {
-	int done = 0;
-	int shell_arg = 1;
-
 	shell_init("\r\n:> ");
 
-	while(!done) {
-		shell_arg = shell_func(shell_arg);
-		if(shell_arg < 0) {
-			done = 1;
-		}
-	}
+	while(shell_poll() >= 0) shell_wait();
 
 	shell_exit();
 }
@@ -678,6 +1560,8 @@ void shell_proc()
 
 int main(int argc, char *argv[])
 {
+	if(argc == 3 && strcmp(argv[1], "-f") == 0) return shell_run_file(argv[2]) ? 1 : 0;
+
 	shell_proc();
 }
 #endif // CONSOLE_BUILD
@@ -695,8 +1579,11 @@ int do_verbose;
 
 #define PRINTF if(do_verbose==1)printf
 
+int test_runs;
+
 int shell_cmd_test(int sargc, char *sargv[])
 {
+	test_runs++;
 	return 0;
 }
 	
@@ -710,14 +1597,273 @@ Shell_cmd cmd = {
 	.sc_max = 1,
 };
 
+/*
+ * lookups, the hash against the linear walk it replaced, for a growing
+ * number of commands.  The hash should stay flat.
+ */
+
+#include <time.h>
+
+#define BENCH_CMDS (SHELL_HASH_MAX / 2)		// fills the table
+#define BENCH_LOOKUPS (1000000)
+
+Shell_cmd bench_cmd[BENCH_CMDS];
+char bench_name[BENCH_CMDS][2][12];
+
+static const Shell_cmd *linear_find_cmd(char *name)
+{
+	Shell_cmd *cmd;
+
+	list_for_each_entry(cmd, &cmd_list, list) {
+		if(strcmp(name, cmd->sc_name) == 0) return cmd;
+		if(strcmp(name, cmd->sc_abrev) == 0) return cmd;
+	}
+	return (Shell_cmd*) 0;
+}
+
+static int bench_fill(int count)
+{
+	int ii, ret;
+
+	INIT_LIST_HEAD(&cmd_list);
+	shell_hash_clear();
+
+	for(ii = 0; ii < count; ii++) {
+		sprintf(bench_name[ii][0], "command_%d", ii);
+		sprintf(bench_name[ii][1], "c%d", ii);
+		bench_cmd[ii] = cmd;
+		bench_cmd[ii].list.next = bench_cmd[ii].list.prev = 0;
+		bench_cmd[ii].sc_name = bench_name[ii][0];
+		bench_cmd[ii].sc_abrev = bench_name[ii][1];
+		if((ret = shell_add_cmd(&bench_cmd[ii])) != 0) return ret;
+	}
+	return 0;
+}
+
+static double bench_ns(const Shell_cmd *(*find)(char*), int count)
+{
+	struct timespec start, end;
+	volatile uintptr_t sink = 0;
+	int ii;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(ii = 0; ii < BENCH_LOOKUPS; ii++)
+		sink += (uintptr_t) find(bench_name[ii % count][ii & 1]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / BENCH_LOOKUPS;
+}
+
+/*
+ * a long command as a task, and how long the input waits while it runs: the
+ * longest shell_poll() against the whole run, which is what it waited before.
+ * -v prints them, but the times are the machine's, so what is checked is
+ * that a poll runs at most one slice before it looks at the input again.
+ */
+
+static struct {
+	Shell_task spin_task;
+	uint32_t spin_left;
+	uint32_t spin_steps;
+	int spin_cancelled;
+} spin;
+
+static int spin_step(Shell_task *task)
+{
+	volatile uint32_t work = 0;
+	int ii;
+
+	if(task->st_cancel) {
+		spin.spin_cancelled = 1;
+		return 0;
+	}
+	spin.spin_steps++;
+	for(ii = 0; ii < SHELL_TASK_SLICE * 16 && spin.spin_left; ii++, spin.spin_left--) work += ii;
+
+	return spin.spin_left != 0;
+}
+
+static double now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int test_latency()
+{
+	double start, step, longest = 0, total;
+	uint32_t steps;
+	int polls = 0;
+
+	spin.spin_task.st_step = spin_step;
+	spin.spin_left = 20000000;
+	spin.spin_cancelled = 0;
+	if(shell_task_start(&spin.spin_task) != 0 || shell_task_start(&spin.spin_task) != -1) return -1;
+
+	// a line typed a little way in is held until the task ends
+
+	test_runs = 0;
+	start = now_ms();
+	while(shell_task) {
+		if(polls == 10) {
+			const char *typed = "test\r";
+
+			while(*typed) shell_feed(*typed++);
+		}
+		steps = spin.spin_steps;
+		step = now_ms();
+		if(shell_poll() < 0) return -1;
+		step = now_ms() - step;
+		if(step > longest) longest = step;
+		if(spin.spin_steps - steps > 1) return -1;
+		if(polls++ > 10 && test_runs && shell_task) return -1;
+	}
+	total = now_ms() - start;
+	if(test_runs != 1) return -1;
+
+	PRINTF("task %.1f ms in %d polls, input waited at most %.3f ms\n", total, polls, longest);
+	if(polls < 100) return -1;
+
+	// ^C
+
+	spin.spin_left = 20000000;
+	shell_task_start(&spin.spin_task);
+	shell_poll();
+	shell_feed(0x03);
+	shell_poll();
+
+	return shell_task || !spin.spin_cancelled ? -1 : 0;
+}
+
+/*
+ * line editing, keys fed the way the console sends them, and the history
+ * dropping whole old lines as it wraps
+ */
+
+static int feed_keys(const char *keys)
+{
+	int ret = 0;
+
+	while(*keys) ret = shell_process_input(*keys++);
+
+	return ret;
+}
+
+static int test_editing()
+{
+	char line[CMDLINE_BUF_LEN], want[24];
+	int ii, count;
+
+	test_runs = 0;
+	feed_keys("tesx\bt\r");					// backspace
+	feed_keys("\x1b[A\r");						// up
+	feed_keys("est\x1b[Ht");					// home, insert
+	if(strcmp(cmdline_buf, "test") != 0 || cmdline_cur != 1) return -1;
+	feed_keys("\r");
+	feed_keys("txest\x01\x06\x04\x1b[4~\r");	// ^A, ^F, ^D, end
+	if(test_runs != 4) return -1;
+
+	// one test in the history, the repeats aren't kept
+
+	if(hist_get(1, line) != 4 || strcmp(line, "test") != 0 || hist_get(2, line) != -1) return -1;
+	feed_keys("te\x1b[A\x1b[A\x1b[B");			// back to an empty line
+	if(cmdline_buf_ind != 0 || hist_pos != 0) return -1;
+	feed_keys("x\x15\r");						// ^U
+	if(cmdline_buf_ind != 0 || test_runs != 4) return -1;
+
+	for(ii = 0; ii < 200; ii++) {
+		count = sprintf(line, "line_%d", ii);
+		hist_add(line, count);
+	}
+	for(count = 1; hist_get(count, line) >= 0; count++) {
+		sprintf(want, "line_%d", 200 - count);
+		if(strcmp(line, want) != 0) return -1;
+	}
+	PRINTF("%d lines in %d bytes\n", count - 1, hist_used);
+	if(count < 2 || hist_used > SHELL_HIST_SIZE) return -1;
+
+	return 0;
+}
+
+/*
+ * prefixes and the tab key, for the commands and for a sub command table
+ */
+
+static const Shell_sub_cmd test_subs[] = {
+	{ 0, 2, 2, "start", "sa", "start" },
+	{ 1, 2, 2, "stop", "so", "stop" },
+	{ 2, 2, 2, "status", "st", "status" },
+};
+
+int test_sub;
+
+int shell_cmd_test_subs(int sargc, char *sargv[])
+{
+	test_sub = shell_sub_cmd_list_search(sargv[1], test_subs, SUB_CMD_LIST_LEN(test_subs));
+	return 0;
+}
+
+static int test_line(const char *keys, const char *want)
+{
+	feed_keys(keys);
+	if(strncmp(cmdline_buf, want, cmdline_buf_ind) != 0 || cmdline_buf_ind != strlen(want)) return -1;
+	feed_keys("\x15");
+
+	return 0;
+}
+
+static int test_complete()
+{
+	static Shell_cmd subs = {
+		.list = {0, 0}, .sc_name = "subs", .sc_abrev = "su", .sc_help = "subs start | stop | status",
+		.sc_func = shell_cmd_test_subs, .sc_min = 2, .sc_max = 2,
+		.sc_sub = test_subs, .sc_sub_len = SUB_CMD_LIST_LEN(test_subs),
+	};
+	const char *sub_lines[] = { "su sa\r", "subs stop\r", "su stat\r", "su sta\r", "su x\r" };
+	const int sub_want[] = { 0, 1, 2, -1, -1 };
+	int ii;
+
+	if(shell_add_cmd(&subs) != 0) return -1;
+
+	test_runs = 0;
+	feed_keys("tes\r");
+	if(test_runs != 1) return -1;
+	if(shell_run_script("tes extra\n", 10) != 1 || shell_run_script("hel a b c\n", 10) != 1
+			|| test_runs != 1)
+		return -1;
+	for(ii = 0; ii < 5; ii++) {
+		test_sub = 3;
+		feed_keys(sub_lines[ii]);
+		if(test_sub != sub_want[ii]) return -1;
+	}
+
+	if(test_line("he\t", "help ") || test_line("s\t", "su ") || test_line("x\t", "x")
+			|| test_line("su sto\t", "su stop ") || test_line("su stat\t", "su status ")
+			|| test_line("subs s\t", "subs s") || test_line("su sa\t", "su sa ")
+			|| test_line("test s\t", "test s") || test_line("hp\x01\x06\t", "hp"))
+		return -1;
+
+	PRINTF("%d trie nodes of %d bytes\n", trie_count, (int) sizeof(Shell_trie));
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
-	int ret;
+	int ret, ii, count, do_bench;
+	Shell_cmd same = cmd, full = cmd;
 	
 	INIT_LIST_HEAD(&cmd_list);
 
-	if(argc == 2 && *argv[1] == '-' && *(argv[1]+1) == 'v') do_verbose = 1;
-	else do_verbose = 0;
+	do_verbose = argc == 2 && *argv[1] == '-' && *(argv[1]+1) == 'v';
+	do_bench = argc == 2 && *argv[1] == '-' && *(argv[1]+1) == 'b';
+
+	// quiet, only 0 or -1: the echo, prompts and errors the tests cause go nowhere
+
+	if(!do_verbose && !do_bench && freopen("/dev/null", "w", stdout) == 0) return -1;
 
 	PRINTF("test validate\n");
 
@@ -729,6 +1875,83 @@ int main(int argc, char *argv[])
 
 	if(ret != 0) return ret;
 
+	// the abbreviation of one is the name of another
+
+	same.sc_name = "other";
+	same.sc_abrev = "test";
+	ret = shell_add_cmd(&same);
+	PRINTF("%s\n", shell_add_cmd_error_str(ret));	
+	if(ret != -SHELL_ADD_CMD_ALREADY_ADDED) return -1;
+
+	// the built in ones from the section, twice is an error
+
+	shell_index_cmds();
+	if(shell_find_cmd("help") != &cmd_help || shell_find_cmd("h") != &cmd_help
+			|| shell_find_cmd("b") != &cmd_break || shell_find_cmd("q") != &cmd_quit)
+		return -1;
+	if(shell_hash_add(&cmd_help) != -SHELL_ADD_CMD_ALREADY_ADDED) return -1;
+
+	// scripts stop at the first bad line and say which, \r\n is one end
+
+	PRINTF("test scripts\n");
+	{
+		static const char good[] = "# bring up\r\n\r\ntest\nrun 0 10\ntest\r\n";
+		static const char bad[] = "test\r\n# note\r\rtest extra\ntest\n";
+		char long_line[CMDLINE_BUF_LEN + 8];
+
+		memset(long_line, 't', sizeof(long_line));
+		if(shell_run_script(good, sizeof(good) - 1) != 0
+				|| shell_run_script(bad, sizeof(bad) - 1) != 4
+				|| shell_run_script(long_line, sizeof(long_line)) != 1)
+			return -1;
+
+		// run, the lines through pass_to, done at the '.'
+
+		char *run_argv[] = { "run" };
+		const char *piped = "test\r\ntest\r.\r";
+
+		if(shell_cmd_run(1, run_argv) != 0) return -1;
+		while(*piped) shell_process_input(*piped++);
+		if(pass_to_func || run_line_num != 2 || run_failed) return -1;
+	}
+
+	PRINTF("test task latency\n");
+	if(test_latency() != 0) return -1;
+
+	PRINTF("test line editing\n");
+	if(test_editing() != 0) return -1;
+
+	PRINTF("test prefixes and completion\n");
+	if(test_complete() != 0) return -1;
+
+	// every name and abbreviation found, through the collisions
+
+	PRINTF("test lookup\n");
+	if((ret = bench_fill(BENCH_CMDS)) != 0) return ret;
+	for(ii = 0; ii < BENCH_CMDS; ii++) {
+		if(shell_find_cmd(bench_name[ii][0]) != &bench_cmd[ii]
+				|| shell_find_cmd(bench_name[ii][1]) != &bench_cmd[ii])
+			return -1;
+	}
+	if(shell_find_cmd("command_") || shell_find_cmd("c") || shell_find_cmd(""))
+		return -1;
+
+	// the table is full, a single name doesn't fit either
+
+	full.sc_name = full.sc_abrev = "one_more";
+	ret = shell_add_cmd(&full);
+	PRINTF("%s\n", shell_add_cmd_error_str(ret));	
+	if(ret != -SHELL_ADD_CMD_TABLE_FULL) return -1;
+
+	if(do_bench) {
+		printf("commands   hash ns   linear ns\n");
+		for(count = 4; count <= BENCH_CMDS; count *= 2) {
+			if(bench_fill(count) != 0) return -1;
+			printf("%8d %9.1f %11.1f\n", count, bench_ns(shell_find_cmd, count),
+					bench_ns(linear_find_cmd, count));
+		}
+	}
+
 	return 0;
 }
 
@@ -28,15 +28,6 @@
 #include <stdint.h>
 #include "list.h"
 
-typedef struct _shell_cmd {
-	struct list_head list;
-	char *sc_name;		// long name
-	char *sc_abrev;		// short name
-	char *sc_help;		// help string
-	int (*sc_func)(int argc, char *argv[]);
-	uint8_t sc_min, sc_max;	// min and max optional args
-} Shell_cmd;
-
 /**
  * a Shell_cmd can have sub commands.
  * in this case, the module will implement the command and include the sub command 
@@ -44,6 +35,8 @@ typedef struct _shell_cmd {
  * the module will use the standard funtions listed in this module to search the
  * sub command list.
  *
+ * a table given to SHELL_COMMAND_SUBS() is indexed with the commands, its
+ * sub commands can be typed as a unique prefix and tab completes them.
  */
 
 typedef struct _shell_sub_cmd {
@@ -54,15 +47,105 @@ typedef struct _shell_sub_cmd {
 	char *ssc_help;		// help string
 } Shell_sub_cmd;
 
+typedef struct _shell_cmd {
+	struct list_head list;
+	char *sc_name;		// long name
+	char *sc_abrev;		// short name
+	char *sc_help;		// help string
+	int (*sc_func)(int argc, char *argv[]);
+	uint8_t sc_min, sc_max;	// min and max optional args
+	const Shell_sub_cmd *sc_sub;	// sub commands for prefixes and completion, or 0
+	uint8_t sc_sub_len;
+} Shell_cmd;
+
+/**
+ * a command defined at compile time, no shell_add_cmd() needed
+ *
+ * SHELL_COMMAND(cmd_dump, "dump", "d", "dump addr [len]", mem_db_cmd_dump, 2, 3);
+ *
+ * the Shell_cmd is const, a pointer to it goes in the shell_cmd section and
+ * shell_init() puts every one in the lookup table.  Pointers, so the section
+ * is an array whatever the compiler does to the alignment of a Shell_cmd.
+ * GNU ld defines __start_shell_cmd and __stop_shell_cmd on the host and the
+ * target.  With --gc-sections, or to place it, the STM32 linker script wants,
+ * next to .rodata,
+ *
+ * 	.shell_cmd : ALIGN(4)
+ * 	{
+ * 		__start_shell_cmd = .;
+ * 		KEEP(*(shell_cmd))
+ * 		__stop_shell_cmd = .;
+ * 	} >FLASH
+ *
+ * shell_add_cmd() is still there for commands made at run time.
+ */
+
+#define SHELL_CMD_SECTION __attribute__((section("shell_cmd"), used))
+
+#define SHELL_COMMAND(cmd, name, abrev, help, func, min, max) \
+	const Shell_cmd cmd = { .list = {0, 0}, .sc_name = (name), .sc_abrev = (abrev), \
+		.sc_help = (help), .sc_func = (func), .sc_min = (min), .sc_max = (max) }; \
+	const Shell_cmd *const cmd##_entry SHELL_CMD_SECTION = &cmd
+
+#define SHELL_COMMAND_SUBS(cmd, name, abrev, help, func, min, max, subs) \
+	const Shell_cmd cmd = { .list = {0, 0}, .sc_name = (name), .sc_abrev = (abrev), \
+		.sc_help = (help), .sc_func = (func), .sc_min = (min), .sc_max = (max), \
+		.sc_sub = (subs), .sc_sub_len = SUB_CMD_LIST_LEN(subs) }; \
+	const Shell_cmd *const cmd##_entry SHELL_CMD_SECTION = &cmd
+
+extern const Shell_cmd *const __start_shell_cmd[];
+extern const Shell_cmd *const __stop_shell_cmd[];
+
+/**
+ * a long command runs as a task, shell_poll() calls it a slice at a time
+ * between looking at the input, so the console and the poll hooks keep going
+ *
+ * static struct { Shell_task task; uint32_t left; } spin;	// the task first
+ *
+ * the command fills in st_step, calls shell_task_start(&spin.task) and
+ * returns 0, no prompt yet.  st_step does SHELL_TASK_SLICE iterations or so
+ * and returns 1 for more, 0 when done.  ^C sets st_cancel and calls it once
+ * more to tidy up.  One task at a time, a line typed meanwhile is echoed and
+ * run when it ends.
+ */
+
+#define SHELL_TASK_SLICE	(256)
+
+typedef struct _shell_task {
+	int (*st_step)(struct _shell_task *task);
+	uint8_t st_cancel;
+} Shell_task;
+
+extern int shell_task_start(Shell_task *task);
+
+/**
+ * poll hooks, called by every shell_poll(), the trace stream for one
+ *
+ * SHELL_POLL(dbt_stream_hook, dbt_stream_poll);
+ */
+
+#define SHELL_POLL_SECTION __attribute__((section("shell_poll"), used))
+
+#define SHELL_POLL(hook, func) \
+	int (*const hook)() SHELL_POLL_SECTION = (func)
+
+extern int (*const __start_shell_poll[])() __attribute__((weak));
+extern int (*const __stop_shell_poll[])() __attribute__((weak));
+
+extern int shell_poll();
+extern void shell_wait();
+
 extern int shell_set_pass_to(int (*func)(char));
 extern void shell_clear_pass_to();
 extern int shell_add_cmd(Shell_cmd *cmd);
 extern int sc_cmd_search(char *cmd); 
-extern int sc_sub_cmd_list_search(char *sub_cmd, Shell_sub_cmd *sub_cmd_list,
+extern int shell_sub_cmd_list_search(char *sub_cmd, const Shell_sub_cmd *sub_cmd_list,
 		int sub_cmd_list_len);
 extern int shell_func(int);
 extern void shell_proc();
 extern int shell_init(char *);
+extern int shell_run_script(const char *script, int len);
+extern int shell_run_file(char *path);
 extern int shell_exit();
 
 extern const char* newline;
@@ -31,6 +31,7 @@
 #include "micro_stdio.h"
 #include "format.h"
 #include "probe.h"
+#include "result.h"
 
 
 #ifdef CONSOLE_BUILD
@@ -109,26 +110,38 @@ Probe_funcs spi_probe_funcs = {
 	spf_print,
 };
 
-int spi_reg_print_all()
+static void spi_reg_print(int ii)
 {
-	int ii;
 	char obuf[9];
 	uint32_t* reg_ptr;
 
 	reg_ptr = (uint32_t*) SPI1;
 
-	for(ii = 0; ii < SPI_REG_COUNT; ii++) {
+	if(RES_TEXT()) {
 		PUTSS(spi_reg_name[ii]);
 		PUTSS(": ");
-		PUTSS(format_x(*reg_ptr++, 8, obuf));
+		PUTSS(format_x(reg_ptr[ii], 8, obuf));
 		PUTSS(newline);
 	}
+	else {
+		res_begin("spi_reg");
+		res_str("reg", spi_reg_name[ii]);
+		res_u32("value", reg_ptr[ii]);
+		res_end();
+	}
+}
+
+int spi_reg_print_all()
+{
+	int ii;
+
+	for(ii = 0; ii < SPI_REG_COUNT; ii++) spi_reg_print(ii);
+
 	return 0;
 }
 
 int spi_reg_cmd_access(int sargc, char *sargv[])
 {
-	char obuf[9];
 	if(sargc == 2) {
 		if(*sargv[1] == 'p') {
 			if(probe_set_funcs(&spi_probe_funcs) != -1) {
@@ -148,15 +161,10 @@ int spi_reg_cmd_access(int sargc, char *sargv[])
 			}
 			else {
 				int ii;
-				uint32_t* reg_ptr;
 
-				reg_ptr = (uint32_t*) SPI1;
 				for(ii = 0; ii < SPI_REG_COUNT; ii++) {
 					if(strcmp(sargv[2], spi_reg_name[ii]) == 0) {
-						PUTSS(spi_reg_name[ii]);
-						PUTSS(": ");
-						PUTSS(format_x(reg_ptr[ii], 8, obuf));
-						PUTSS(newline);
+						spi_reg_print(ii);
 						return 1;
 					}
 				}
@@ -195,21 +203,9 @@ spi_reg_access_exit:
 	return 1;
 }
 
-Shell_cmd cmd_spi_reg = {
-	.list = {0, 0},
-	.sc_name = "spi_reg",
-	.sc_abrev = "sp",
-	.sc_help = "spi_reg read | write | probe,  all | <name> : read or write or probe spi registers",
-
-	.sc_func = spi_reg_cmd_access,
-	.sc_min = 2,
-	.sc_max = 4,
-};
-
-void spi_reg_init()
-{
-	shell_add_cmd(&cmd_spi_reg);
-}
+SHELL_COMMAND(cmd_spi_reg, "spi_reg", "sp",
+		"spi_reg read | write | probe,  all | <name> : read or write or probe spi registers",
+		spi_reg_cmd_access, 2, 4);
 
 #ifdef CONSOLE_BUILD
 
@@ -217,18 +213,12 @@ void spi_reg_init()
 
 int main(int argc, char *argv[])
 {
-	int done = 0;
-	int shell_arg = 1;
+
+	if(argc == 3 && strcmp(argv[1], "-f") == 0) return shell_run_file(argv[2]) ? 1 : 0;
 
 	shell_init(" :> ");
-	spi_reg_init();
 
-	while(!done) {
-		shell_arg = shell_func(shell_arg);
-		if(shell_arg < 0) {
-			done = 1;
-		}
-	}
+	while(shell_poll() >= 0) shell_wait();
 	
 	shell_exit();
 }
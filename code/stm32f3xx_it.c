@@ -133,10 +133,9 @@ void USART1_IRQHandler(void)
     if(((isrflags & USART_ISR_RXNE) != RESET) && ((cr1its & USART_CR1_RXNEIE) != RESET)) {
 		// do receipt of character
 		// RDR is read data register, UART_RDR in ref manual
+		// a full fifo counts the drop, see "fifo stats"
 		uint32_t read_byte = USART1->RDR;	
-		if(bf_space_avail(&usart1_rx_fifo)) {
-			bf_write(&usart1_rx_fifo, (uint8_t) read_byte);
-		}
+		bf_write(&usart1_rx_fifo, (uint8_t) read_byte);
     }
 	// if transmit enabled and transmit empty
 	
@@ -0,0 +1,843 @@
+/*
+ * Copyright 2018 Daniel G. Robinson
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software. 
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+/**
+ * @file dbt_decode.c
+ * @brief rebuilds the debug trace timeline from a dbtrace stream
+ * @author Daniel G. Robinson
+ * @date 16 Oct 26
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "dbt.h"
+#include "frame.h"
+
+/*
+ * dbt_decode [-j | -c | -s] [input_file]
+ * dbt_decode [-j | -c | -s] [-t ticks_per_us] -r image [-p] [input_file]
+ *
+ * reads the frames of "dbtrace stream on", see dbt.h, from the file or
+ * stdin, a capture of the UART.  Records from all the rings are sorted by
+ * time and printed like "dbtrace dump", with the gaps in line where they
+ * were found:
+ *
+ * 	frames missing, a jump in the sequence, lost on the way
+ * 	words lost, a ring written over before the target could send it
+ *
+ * Bytes that aren't good frames, console text or line noise, are counted.
+ *
+ * 	-j	Chrome trace_event JSON, for chrome://tracing or Perfetto, a
+ * 		thread for each ring, the gaps as global instant events
+ * 	-c	CSV, time and delta in microseconds, ring, tag, then the
+ * 		fields in the order of the descriptor
+ * 	-s	per tag, the count, the rate over the capture and the time
+ * 		between hits, min, mean and max
+ *
+ * A record is named by its descriptor's tag, by its first field for the
+ * DBT_DUMP_FORMAT_TAG_* layouts and spans, or "#" and its id.  Spans are
+ * begin and end events in the JSON.  The time sync records are left out
+ * of all three.
+ *
+ * -r reads the rings straight out of image instead, post-mortem, the arena
+ * of dbt_init_persist() as a debugger read it out of the target or, on the
+ * host, the file of dbt_init_file().  It walks the bank the header says was
+ * being written, -p the other one, the run before's.  The records carry no
+ * names, input_file, a capture of "dbtrace stream on" from the same build,
+ * gives the descriptors and the ticks per microsecond, its records are left
+ * out.  Without one -t sets the ticks, 1000 to start, the host's.
+ */
+
+#define DD_MAX_DESC		(1024)
+#define DD_MAX_NAME		(32)
+
+typedef struct _dd_desc {
+	uint32_t dd_tag;
+	int dd_nfields;
+	uint8_t dd_type[DBT_MAX_FIELDS];
+	char dd_name[DBT_MAX_FIELDS][DD_MAX_NAME];
+} Dd_desc;
+
+enum {
+	DD_REC = 0,
+	DD_FRAMES_MISSING,
+	DD_WORDS_LOST,
+};
+
+typedef struct _dd_rec {
+	uint64_t dr_time;
+	uint32_t dr_order;		// arrival, keeps the sort stable
+	uint8_t dr_kind;
+	uint8_t dr_ring;
+	uint32_t dr_count;		// frames missing or words lost
+	uint32_t dr_words[DBT_REC_MAX];
+} Dd_rec;
+
+Dd_desc *descs[DD_MAX_DESC];
+Dd_rec *recs;
+uint32_t num_recs, max_recs;
+
+enum {
+	DD_OUT_TEXT = 0,
+	DD_OUT_JSON,
+	DD_OUT_CSV,
+	DD_OUT_SUMMARY,
+};
+
+typedef struct _dd_sum {
+	char ds_name[DD_MAX_NAME];
+	uint32_t ds_count;
+	uint64_t ds_last;
+	uint64_t ds_gap_min;
+	uint64_t ds_gap_max;
+	uint64_t ds_gap_sum;
+} Dd_sum;
+
+Dd_sum *sums;
+uint32_t num_sums, max_sums;
+
+uint32_t ticks_per_us = 1000;
+uint32_t good_frames, bad_frames, frames_missing, words_lost;
+int have_seq, raw_image;
+uint16_t next_seq;
+
+void usage(int err, char *errstr)
+{
+	if(errstr) fprintf(stderr, "%s\n", errstr);
+	fprintf(stderr, "dbt_decode [-j | -c | -s] [input_file]\n"
+			"dbt_decode [-j | -c | -s] [-t ticks_per_us] -r image [-p] [input_file]\n"
+			"\t-j Chrome trace_event JSON\n"
+			"\t-c CSV\n"
+			"\t-s per tag count, rate and time between\n"
+			"\t-r the rings of a dbt_init_persist() arena, input_file only for descriptors\n"
+			"\t-p the image's other bank, the run before\n"
+			"\t-t ticks per microsecond for an image without input_file\n"
+			"\treads stdin without input_file or -r\n");
+	exit(err);
+}
+
+static uint16_t get16(const uint8_t *ss)
+{
+	return (uint16_t) ss[0] | ((uint16_t) ss[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *ss)
+{
+	return (uint32_t) get16(ss) | ((uint32_t) get16(ss + 2) << 16);
+}
+
+static Dd_rec *new_rec(uint8_t kind, uint8_t ring, uint64_t time)
+{
+	Dd_rec *rec;
+
+	if(num_recs == max_recs) {
+		max_recs = max_recs ? max_recs * 2 : 1024;
+		if((recs = realloc(recs, max_recs * sizeof(Dd_rec))) == 0) {
+			perror("dbt_decode");
+			exit(-1);
+		}
+	}
+
+	rec = &recs[num_recs];
+	memset(rec, 0, sizeof(*rec));
+	rec->dr_time = time;
+	rec->dr_order = num_recs++;
+	rec->dr_kind = kind;
+	rec->dr_ring = ring;
+
+	return rec;
+}
+
+static void do_desc(const uint8_t *pp, int len)
+{
+	Dd_desc *desc;
+	uint16_t id;
+	int off, nn;
+
+	if(len < DBT_FRAME_HDR + 6) return;
+	id = get16(&pp[DBT_FRAME_HDR]);
+	if(id >= DD_MAX_DESC) return;
+
+	if(descs[id] == 0 && (descs[id] = calloc(1, sizeof(Dd_desc))) == 0) return;
+	desc = descs[id];
+	memset(desc, 0, sizeof(*desc));
+	desc->dd_tag = get32(&pp[DBT_FRAME_HDR + 2]);
+
+	off = DBT_FRAME_HDR + 6;
+	while(off < len && desc->dd_nfields < DBT_MAX_FIELDS) {
+		desc->dd_type[desc->dd_nfields] = pp[off++];
+		for(nn = 0; off < len && pp[off]; off++)
+			if(nn < DD_MAX_NAME - 1) desc->dd_name[desc->dd_nfields][nn++] = pp[off];
+		off++;
+		desc->dd_nfields++;
+	}
+}
+
+/*
+ * records follow the header, each its header word first.  The gap marks go
+ * ahead of them, at the time of the frame's first record.
+ */
+
+static void do_records(const uint8_t *pp, int len, uint16_t missing)
+{
+	Dd_rec *rec;
+	uint32_t hdr, high, lost, rec_len, ii;
+	uint64_t first;
+	uint8_t ring = pp[1];
+	int off = DBT_FRAME_RECS;
+
+	if(len < DBT_FRAME_RECS + 8) return;
+	lost = get16(&pp[4]);
+	high = get32(&pp[6]);
+	first = ((uint64_t) high << 32) | get32(&pp[DBT_FRAME_RECS + 4]);
+
+	if(missing) {
+		rec = new_rec(DD_FRAMES_MISSING, ring, first);
+		rec->dr_count = missing;
+	}
+	if(lost) {
+		rec = new_rec(DD_WORDS_LOST, ring, first);
+		rec->dr_count = lost;
+		words_lost += lost;
+	}
+
+	while(off + 8 <= len) {
+		hdr = get32(&pp[off]);
+		rec_len = DBT_HDR_LEN(hdr);
+		if(rec_len < DBT_REC_ARGS || off + rec_len * 4 > len) break;
+
+		rec = new_rec(DD_REC, ring, ((uint64_t) high << 32) | get32(&pp[off + 4]));
+		for(ii = 0; ii < rec_len; ii++) rec->dr_words[ii] = get32(&pp[off + ii * 4]);
+		off += rec_len * 4;
+	}
+}
+
+static void do_frame(const uint8_t *wire, int wlen)
+{
+	static uint8_t pp[FRAME_WIRE_MAX(DBT_FRAME_MAX) + 256];
+	uint16_t seq, missing;
+	int len;
+
+	if(wlen == 0) return;
+	if(wlen > sizeof(pp) || (len = frame_decode(wire, wlen, pp)) < DBT_FRAME_HDR) {
+		bad_frames++;
+		return;
+	}
+
+	good_frames++;
+	seq = get16(&pp[2]);
+	missing = have_seq ? (uint16_t) (seq - next_seq) : 0;
+	have_seq = 1;
+	next_seq = seq + 1;
+
+	switch(pp[0]) {
+	case DBT_FRAME_INFO:
+		if(len >= DBT_FRAME_HDR + 6) ticks_per_us = get32(&pp[6]);
+		if(ticks_per_us == 0) ticks_per_us = 1;
+		break;
+	case DBT_FRAME_DESC:
+		do_desc(pp, len);
+		break;
+	case DBT_FRAME_RECORDS:
+		if(!raw_image) do_records(pp, len, missing);
+		break;
+	}
+	frames_missing += missing;
+}
+
+/*
+ * post-mortem, the layout of DBT_persist in dbt.c: magic, rings, words in
+ * each, the bank being written and a CRC of those, 12 bytes, then the ring
+ * structs of both banks, then the buffers of both banks.  A ring struct is a
+ * pointer, the size and the state, so its size and where the structs start
+ * go by the pointer size of whoever wrote it, the target's 4 or the host's 8.
+ * The one whose sizes all match the header is it.
+ */
+
+#define DD_PERSIST_MAGIC	DBT_U8_TO_U32('D', 'B', 'T', 'P')
+#define DD_PERSIST_HDR		(12)
+#define DD_PERSIST_CRC		(10)		// the CRC's offset, what it covers
+
+#define DD_WORD(buf, words, idx)	get32(&(buf)[((idx) & ((words) - 1)) * 4])
+
+// a sync record by its descriptor, or without one by its shape, see dbt_ring_write()
+
+static int raw_is_sync(const uint32_t *ww)
+{
+	uint16_t id = DBT_HDR_ID(ww[0]);
+
+	if(DBT_HDR_LEN(ww[0]) != DBT_SYNC_LEN) return 0;
+	if(id < DD_MAX_DESC && descs[id]) return descs[id]->dd_tag == DBT_MAKE_TAG(0, '-', 'T', '-');
+
+	return ww[DBT_REC_TS] == ww[DBT_REC_ARGS];
+}
+
+/*
+ * back from the insertion point in state, like dbt_walk_prev(), to the first
+ * record written over, then the high words newest first, past a sync record
+ * going back the high word is the one it saved.  Records older than the
+ * oldest sync record have no high word and are left out, as are the sync
+ * records.
+ */
+
+static void do_ring(uint8_t ring, const uint8_t *buf, uint32_t words, uint32_t state)
+{
+	uint32_t ww[DBT_REC_MAX];
+	uint16_t *starts, end = (uint16_t) state, start = end;
+	uint32_t *highs, prev_len = (state >> 16) & 0xff, hdr, len, high = 0, nn = 0, ii, jj;
+	int have_high = 0;
+	Dd_rec *rec;
+
+	starts = malloc(words * sizeof(uint16_t));
+	highs = malloc(words * sizeof(uint32_t));
+	if(starts == 0 || highs == 0) {
+		perror("dbt_decode");
+		exit(-1);
+	}
+
+	while(prev_len && nn < words) {
+		start -= prev_len;
+		if((uint16_t) (end - start) > words) break;
+		hdr = DD_WORD(buf, words, start);
+		len = DBT_HDR_LEN(hdr);
+		if(DBT_HDR_LAP(hdr) != (uint8_t) (start / words) || len != prev_len
+				|| len < DBT_REC_ARGS || len > DBT_REC_MAX) break;
+		starts[nn++] = start;
+		prev_len = DBT_HDR_PREV(hdr);
+	}
+
+	for(ii = 0; ii < nn; ii++) {
+		for(jj = 0; jj < DBT_SYNC_LEN; jj++) ww[jj] = DD_WORD(buf, words, starts[ii] + jj);
+		if(raw_is_sync(ww)) {
+			high = ww[DBT_REC_ARGS + 1];
+			have_high = 1;
+			break;
+		}
+	}
+	if(!have_high) nn = 0;
+
+	for(ii = 0; ii < nn; ii++) {
+		for(jj = 0; jj < DBT_SYNC_LEN; jj++) ww[jj] = DD_WORD(buf, words, starts[ii] + jj);
+		highs[ii] = high;
+		if(raw_is_sync(ww)) {
+			highs[ii] = ww[DBT_REC_ARGS + 1];
+			high = (highs[ii] & ~(uint32_t) 0xff) | (ww[DBT_REC_ARGS + 2] & 0xff);
+			if(high > highs[ii]) high -= 0x100;
+		}
+	}
+
+	// oldest first, so records with the same time keep the ring's order
+
+	while(nn--) {
+		hdr = DD_WORD(buf, words, starts[nn]);
+		for(jj = 0; jj < DBT_HDR_LEN(hdr); jj++) ww[jj] = DD_WORD(buf, words, starts[nn] + jj);
+		if(raw_is_sync(ww)) continue;
+
+		rec = new_rec(DD_REC, ring, ((uint64_t) highs[nn] << 32) | ww[DBT_REC_TS]);
+		memcpy(rec->dr_words, ww, DBT_HDR_LEN(hdr) * sizeof(uint32_t));
+	}
+
+	free(starts);
+	free(highs);
+}
+
+static void do_image(const char *path, int prev)
+{
+	FILE *in;
+	uint8_t *img, *ring;
+	long size;
+	uint32_t rings, words, bank, ptr, hdr_len, ring_len, buf_off = 0, rr;
+
+	if((in = fopen(path, "rb")) == 0 || fseek(in, 0, SEEK_END) < 0 || (size = ftell(in)) < 0) {
+		perror(path);
+		exit(-1);
+	}
+	rewind(in);
+	if((img = malloc(size + 1)) == 0 || fread(img, 1, size, in) != (size_t) size) {
+		perror(path);
+		exit(-1);
+	}
+	fclose(in);
+
+	if(size < DD_PERSIST_HDR || get32(img) != DD_PERSIST_MAGIC
+			|| get16(&img[DD_PERSIST_CRC]) != frame_crc16(FRAME_CRC_INIT, img, DD_PERSIST_CRC)) {
+		fprintf(stderr, "%s: no dbt_init_persist() header\n", path);
+		exit(-1);
+	}
+	rings = get16(&img[4]);
+	words = get16(&img[6]);
+	bank = get16(&img[8]);
+	if(rings == 0 || rings > 32 || bank > 1 || words < DBT_RING_MIN || words > DBT_RING_MAX
+			|| (words & (words - 1))) {
+		fprintf(stderr, "%s: a header of %u rings of %u words, bank %u\n", path, rings, words, bank);
+		exit(-1);
+	}
+	if(prev) bank ^= 1;
+
+	for(ptr = 4; ptr <= 8; ptr += 4) {
+		hdr_len = (DD_PERSIST_HDR + ptr - 1) & ~(ptr - 1);
+		ring_len = ptr + 8;
+		buf_off = hdr_len + 2 * rings * ring_len;
+		if(buf_off + 2 * rings * words * 4 > size) continue;
+		for(rr = 0; rr < rings; rr++)
+			if(get16(&img[hdr_len + (bank * rings + rr) * ring_len + ptr]) != words) break;
+		if(rr == rings) break;
+	}
+	if(ptr > 8) {
+		fprintf(stderr, "%s: no rings of %u words in bank %u\n", path, words, bank);
+		exit(-1);
+	}
+
+	for(rr = 0; rr < rings; rr++) {
+		ring = &img[hdr_len + (bank * rings + rr) * ring_len];
+		do_ring((uint8_t) rr, &img[buf_off + (bank * rings + rr) * words * 4], words,
+				get32(&ring[ptr + 4]));
+	}
+	free(img);
+}
+
+static int rec_compare(const void *aa, const void *bb)
+{
+	const Dd_rec *ra = aa, *rb = bb;
+
+	if(ra->dr_time != rb->dr_time) return ra->dr_time < rb->dr_time ? -1 : 1;
+	if(ra->dr_ring != rb->dr_ring) return ra->dr_ring < rb->dr_ring ? -1 : 1;
+
+	return ra->dr_order < rb->dr_order ? -1 : 1;
+}
+
+static void tag_str(uint32_t tag, char *buf)
+{
+	int ii;
+	char cc;
+
+	for(ii = 1; ii < 4; ii++) {
+		cc = (char) (tag >> (ii * 8));
+		*buf++ = isprint((unsigned char) cc) ? cc : '.';
+	}
+	*buf = '\0';
+}
+
+static Dd_desc *rec_desc(Dd_rec *rec)
+{
+	uint16_t id = DBT_HDR_ID(rec->dr_words[0]);
+
+	return id < DD_MAX_DESC ? descs[id] : 0;
+}
+
+static int rec_is_time(Dd_rec *rec)
+{
+	Dd_desc *desc = rec_desc(rec);
+
+	return desc && desc->dd_tag == DBT_MAKE_TAG(0, '-', 'T', '-');
+}
+
+// 'B' or 'E' for the records of DBT_SPAN_BEGIN and DBT_SPAN_END, else 0
+
+static char rec_span(Dd_rec *rec)
+{
+	Dd_desc *desc = rec_desc(rec);
+
+	if(desc == 0 || DBT_HDR_LEN(rec->dr_words[0]) <= DBT_REC_ARGS) return 0;
+	if(desc->dd_tag == DBT_MAKE_TAG(0, '-', '{', '-')) return 'B';
+	if(desc->dd_tag == DBT_MAKE_TAG(0, '-', '}', '-')) return 'E';
+
+	return 0;
+}
+
+/*
+ * the name the exports and the summary go by, see the top
+ */
+
+static void rec_name(Dd_rec *rec, char *buf)
+{
+	Dd_desc *desc = rec_desc(rec);
+
+	if(desc && desc->dd_tag && !rec_span(rec)) tag_str(desc->dd_tag, buf);
+	else if(desc && desc->dd_nfields && desc->dd_type[0] == DBT_FT_TAG
+			&& DBT_HDR_LEN(rec->dr_words[0]) > DBT_REC_ARGS)
+		tag_str(rec->dr_words[DBT_REC_ARGS], buf);
+	else sprintf(buf, "#%u", DBT_HDR_ID(rec->dr_words[0]));
+}
+
+/*
+ * one field into buf, returns its type, DBT_FT_X32 for the words past the
+ * descriptor, -1 at the end
+ */
+
+static int rec_field(Dd_rec *rec, int *ff, int *ww, char *buf)
+{
+	const uint32_t *words = &rec->dr_words[DBT_REC_ARGS];
+	Dd_desc *desc = rec_desc(rec);
+	int nwords = DBT_HDR_LEN(rec->dr_words[0]) - DBT_REC_ARGS;
+	int type, ii;
+	char cc;
+
+	if(*ww >= nwords) return -1;
+
+	type = desc && *ff < desc->dd_nfields ? desc->dd_type[*ff] : DBT_FT_X32;
+	if(type == DBT_FT_X64 && *ww + 2 > nwords) type = DBT_FT_X32;
+	(*ff)++;
+
+	switch(type) {
+	case DBT_FT_U32:
+		sprintf(buf, "%u", words[(*ww)++]);
+		break;
+	case DBT_FT_S32:
+		sprintf(buf, "%d", (int32_t) words[(*ww)++]);
+		break;
+	case DBT_FT_X64:
+		sprintf(buf, "%08x%08x", words[*ww + 1], words[*ww]);
+		*ww += 2;
+		break;
+	case DBT_FT_TAG:
+		tag_str(words[(*ww)++], buf);
+		break;
+	case DBT_FT_CHR4:
+		for(ii = 0; ii < 4; ii++) {
+			cc = (char) (words[*ww] >> (ii * 8));
+			buf[ii] = isprint((unsigned char) cc) ? cc : '.';
+		}
+		buf[4] = '\0';
+		(*ww)++;
+		break;
+	default:
+		type = DBT_FT_X32;
+		sprintf(buf, "%08x", words[(*ww)++]);
+		break;
+	}
+
+	return type;
+}
+
+static const char *field_name(Dd_rec *rec, int ff)
+{
+	Dd_desc *desc = rec_desc(rec);
+
+	return desc && ff < desc->dd_nfields ? desc->dd_name[ff] : 0;
+}
+
+/*
+ * 000003:      1.234567 +   120.125 TM2 count=42 sr=00000001
+ */
+
+static void print_rec(Dd_rec *rec, uint32_t rec_num, uint64_t prev_time)
+{
+	Dd_desc *desc;
+	const char *name;
+	char buf[24];
+	int ff = 0, ww = 0;
+
+	printf("%06x: %13.6f +", rec_num, (double) (rec->dr_time / ticks_per_us) / 1e6);
+	if(prev_time == ~(uint64_t) 0) printf("          ");
+	else printf("%10.3f", (double) (rec->dr_time - prev_time) / ticks_per_us);
+	printf(" %u ", rec->dr_ring);
+
+	if(DBT_HDR_ID(rec->dr_words[0]) == DBT_ID_BUSY) {
+		printf("    being written\n");
+		return;
+	}
+
+	desc = rec_desc(rec);
+	if(desc && desc->dd_tag) tag_str(desc->dd_tag, buf);
+	else strcpy(buf, "   ");
+	printf("%s", buf);
+
+	while(rec_field(rec, &ff, &ww, buf) >= 0) {
+		if((name = field_name(rec, ff - 1))) printf(" %s=%s", name, buf);
+		else printf(" %s", buf);
+	}
+	printf("\n");
+}
+
+/*
+ * strings from tags and CHR4 fields are printable, only quotes and
+ * backslashes need escaping
+ */
+
+static void json_str(const char *ss)
+{
+	putchar('"');
+	for(; *ss; ss++) {
+		if(*ss == '"' || *ss == '\\') putchar('\\');
+		putchar(*ss);
+	}
+	putchar('"');
+}
+
+static void json_rec(Dd_rec *rec, int first)
+{
+	const char *name;
+	char buf[24], num[16];
+	int ff = 0, ww = 0, type, nn = 0;
+	char span;
+
+	printf("%s\n{\"ts\":%.3f,\"pid\":1,\"tid\":%u,", first ? "" : ",",
+			(double) rec->dr_time / ticks_per_us, rec->dr_ring);
+
+	switch(rec->dr_kind) {
+	case DD_FRAMES_MISSING:
+		printf("\"ph\":\"i\",\"s\":\"g\",\"name\":\"frames missing\",\"args\":{\"frames\":%u}}",
+				rec->dr_count);
+		return;
+	case DD_WORDS_LOST:
+		printf("\"ph\":\"i\",\"s\":\"g\",\"name\":\"words lost\",\"args\":{\"ring\":%u,\"words\":%u}}",
+				rec->dr_ring, rec->dr_count);
+		return;
+	}
+
+	rec_name(rec, buf);
+	if((span = rec_span(rec))) printf("\"ph\":\"%c\",\"cat\":\"dbt\",\"name\":", span);
+	else printf("\"ph\":\"i\",\"s\":\"t\",\"cat\":\"dbt\",\"name\":");
+	json_str(buf);
+	printf(",\"args\":{");
+	while((type = rec_field(rec, &ff, &ww, buf)) >= 0) {
+		if((name = field_name(rec, ff - 1)) == 0) {
+			sprintf(num, "w%d", ww - 1);
+			name = num;
+		}
+		printf("%s", nn++ ? "," : "");
+		json_str(name);
+		putchar(':');
+		if(type == DBT_FT_U32 || type == DBT_FT_S32) printf("%s", buf);
+		else json_str(buf);
+	}
+	printf("}}");
+}
+
+/*
+ * quoted when it has to be, a CHR4 field can hold anything printable
+ */
+
+static void csv_str(const char *ss)
+{
+	if(strpbrk(ss, ",\"") == 0) {
+		printf("%s", ss);
+		return;
+	}
+	putchar('"');
+	for(; *ss; ss++) {
+		if(*ss == '"') putchar('"');
+		putchar(*ss);
+	}
+	putchar('"');
+}
+
+static void csv_rec(Dd_rec *rec, uint64_t prev_time)
+{
+	char buf[24];
+	int ff = 0, ww = 0;
+
+	printf("%.3f,", (double) rec->dr_time / ticks_per_us);
+	if(prev_time != ~(uint64_t) 0) printf("%.3f", (double) (rec->dr_time - prev_time) / ticks_per_us);
+	printf(",%u,", rec->dr_ring);
+
+	switch(rec->dr_kind) {
+	case DD_FRAMES_MISSING:
+		printf("frames missing,%u\n", rec->dr_count);
+		return;
+	case DD_WORDS_LOST:
+		printf("words lost,%u\n", rec->dr_count);
+		return;
+	}
+
+	rec_name(rec, buf);
+	csv_str(buf);
+	while(rec_field(rec, &ff, &ww, buf) >= 0) {
+		putchar(',');
+		csv_str(buf);
+	}
+	printf("\n");
+}
+
+/*
+ * a linear search, a capture has tens of tags
+ */
+
+static void sum_rec(Dd_rec *rec)
+{
+	Dd_sum *sum;
+	uint64_t gap;
+	char name[DD_MAX_NAME];
+	uint32_t ii;
+
+	rec_name(rec, name);
+	for(ii = 0; ii < num_sums; ii++)
+		if(strcmp(sums[ii].ds_name, name) == 0) break;
+
+	if(ii == num_sums) {
+		if(num_sums == max_sums) {
+			max_sums = max_sums ? max_sums * 2 : 64;
+			if((sums = realloc(sums, max_sums * sizeof(Dd_sum))) == 0) {
+				perror("dbt_decode");
+				exit(-1);
+			}
+		}
+		sum = &sums[num_sums++];
+		memset(sum, 0, sizeof(*sum));
+		strcpy(sum->ds_name, name);
+		sum->ds_gap_min = ~(uint64_t) 0;
+	}
+	else sum = &sums[ii];
+
+	if(sum->ds_count) {
+		gap = rec->dr_time - sum->ds_last;
+		if(gap < sum->ds_gap_min) sum->ds_gap_min = gap;
+		if(gap > sum->ds_gap_max) sum->ds_gap_max = gap;
+		sum->ds_gap_sum += gap;
+	}
+	sum->ds_last = rec->dr_time;
+	sum->ds_count++;
+}
+
+/*
+ * the rate is over the whole capture, from its first record to its last
+ */
+
+static void print_sums(uint64_t span)
+{
+	Dd_sum *sum;
+	double secs = (double) span / ticks_per_us / 1e6;
+	uint32_t ii;
+
+	printf("tag        count       rate/s  between us:      min         mean          max\n");
+	for(ii = 0; ii < num_sums; ii++) {
+		sum = &sums[ii];
+		printf("%-6s %9u %12.1f", sum->ds_name, sum->ds_count, secs > 0 ? sum->ds_count / secs : 0.0);
+		if(sum->ds_count > 1)
+			printf("              %12.3f %12.3f %12.3f", (double) sum->ds_gap_min / ticks_per_us,
+					(double) sum->ds_gap_sum / (sum->ds_count - 1) / ticks_per_us,
+					(double) sum->ds_gap_max / ticks_per_us);
+		printf("\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in = stdin;
+	char *image = 0;
+	int prev = 0, ticks = 0;
+	uint8_t *wire;
+	uint64_t prev_time = ~(uint64_t) 0, first_time = 0;
+	uint32_t ii, rec_num = 0, gaps = 0, events = 0, rings = 0;
+	int cc, wlen = 0, wmax = FRAME_WIRE_MAX(DBT_FRAME_MAX) + 256;
+	int out = DD_OUT_TEXT;
+
+	while(argc > 1 && *argv[1] == '-') {
+		switch(argv[1][1]) {
+		case 'j': out = DD_OUT_JSON; break;
+		case 'c': out = DD_OUT_CSV; break;
+		case 's': out = DD_OUT_SUMMARY; break;
+		case 'p': prev = 1; break;
+		case 'r':
+		case 't':
+			if(argc < 3) usage(-1, 0);
+			if(argv[1][1] == 'r') image = argv[2];
+			else if((ticks = atoi(argv[2])) <= 0) usage(-1, "ticks per microsecond, 1 or more");
+			argc--;
+			argv++;
+			break;
+		default: usage(-1, 0);
+		}
+		argc--;
+		argv++;
+	}
+	if(argc > 2 || (prev && image == 0)) usage(-1, 0);
+	if(argc == 2 && (in = fopen(argv[1], "rb")) == 0) {
+		perror("opening input file");
+		usage(-1, 0);
+	}
+	if(image && argc < 2) in = 0;
+	raw_image = image != 0;
+	if(ticks) ticks_per_us = ticks;
+
+	/*
+	 * split on the zeros, anything too long to be a frame is a bad one
+	 */
+
+	wire = malloc(wmax);
+	while(in && (cc = getc(in)) != EOF) {
+		if(cc == 0) {
+			if(wlen > wmax) bad_frames++;
+			else do_frame(wire, wlen);
+			wlen = 0;
+		}
+		else if(wlen++ < wmax) wire[wlen - 1] = (uint8_t) cc;
+	}
+	if(wlen) bad_frames++;
+	if(ticks) ticks_per_us = ticks;
+	if(image) do_image(image, prev);
+
+	qsort(recs, num_recs, sizeof(Dd_rec), rec_compare);
+
+	if(out == DD_OUT_JSON) {
+		printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+		for(ii = 0; ii < num_recs; ii++) rings |= 1 << (recs[ii].dr_ring & 0x1f);
+		for(ii = 0; ii < 32; ii++)
+			if(rings & (1 << ii))
+				printf("%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"ring %u\"}}",
+						events++ ? "," : "", ii, ii);
+	}
+	else if(out == DD_OUT_CSV) printf("time_us,delta_us,ring,tag,fields\n");
+
+	for(ii = 0; ii < num_recs; ii++) {
+		if(out != DD_OUT_TEXT && recs[ii].dr_kind == DD_REC && (rec_is_time(&recs[ii])
+				|| DBT_HDR_ID(recs[ii].dr_words[0]) == DBT_ID_BUSY))
+			continue;
+
+		switch(out) {
+		case DD_OUT_JSON:
+			json_rec(&recs[ii], events++ == 0);
+			break;
+		case DD_OUT_CSV:
+			csv_rec(&recs[ii], recs[ii].dr_kind == DD_REC ? prev_time : ~(uint64_t) 0);
+			break;
+		case DD_OUT_SUMMARY:
+			if(recs[ii].dr_kind == DD_REC) sum_rec(&recs[ii]);
+			break;
+		default:
+			if(recs[ii].dr_kind == DD_FRAMES_MISSING)
+				printf("------ %u frames missing\n", recs[ii].dr_count);
+			else if(recs[ii].dr_kind == DD_WORDS_LOST)
+				printf("------ ring %u: %u words lost\n", recs[ii].dr_ring, recs[ii].dr_count);
+			else print_rec(&recs[ii], rec_num, prev_time);
+			break;
+		}
+
+		if(recs[ii].dr_kind == DD_REC) {
+			if(rec_num++ == 0) first_time = recs[ii].dr_time;
+			prev_time = recs[ii].dr_time;
+		}
+		else gaps++;
+	}
+
+	if(out == DD_OUT_JSON) printf("\n]}\n");
+	else if(out == DD_OUT_SUMMARY) {
+		print_sums(rec_num ? prev_time - first_time : 0);
+		if(gaps) printf("%u gaps, the times between take them in\n", gaps);
+	}
+
+	fprintf(stderr, "%u records, %u good frames, %u bad, %u missing, %u words lost\n",
+			rec_num, good_frames, bad_frames, frames_missing, words_lost);
+
+	return 0;
+}